@@ -0,0 +1,78 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <err.h>
+
+#include "rcc.h"
+
+/*
+ * Bump-pointer arenas. Every object belongs to the arena of the phase that
+ * last needs it, and the whole arena is dropped at once when that phase is
+ * done instead of freeing objects one by one.
+ */
+
+struct arena ast_arena;
+struct arena ir_arena;
+
+unsigned long arena_allocs;
+unsigned long arena_bytes;
+
+#define	ARENA_CHUNK_SIZE (64 * 1024)
+#define	ARENA_ALIGN 16
+
+struct arena_chunk {
+	struct arena_chunk *next;
+	size_t size;
+	char data[];
+};
+
+static void
+arena_grow(struct arena *a, size_t size)
+{
+	struct arena_chunk *c;
+	size_t len;
+
+	len = ARENA_CHUNK_SIZE;
+	if (size > len - sizeof(struct arena_chunk))
+		len = size + sizeof(struct arena_chunk);
+
+	if ((c = malloc(len)) == NULL)
+		err(1, "malloc");
+	c->size = len;
+	c->next = a->chunks;
+	a->chunks = c;
+	a->cur = c->data;
+	a->end = (char *)c + len;
+}
+
+void *
+arena_alloc(struct arena *a, size_t size)
+{
+	void *p;
+
+	size = (size + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1);
+	if (a->cur == NULL || (size_t)(a->end - a->cur) < size)
+		arena_grow(a, size);
+
+	p = a->cur;
+	a->cur += size;
+	memset(p, 0, size);
+	arena_allocs++;
+	arena_bytes += size;
+
+	return (p);
+}
+
+void
+arena_free(struct arena *a)
+{
+	struct arena_chunk *c, *next;
+
+	for (c = a->chunks; c; c = next) {
+		next = c->next;
+		free(c);
+	}
+	a->chunks = NULL;
+	a->cur = NULL;
+	a->end = NULL;
+}
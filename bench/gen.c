@@ -0,0 +1,218 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <err.h>
+
+/*
+ * Generate a synthetic translation unit in the subset of C that rcc
+ * accepts. The output only depends on the options and the seed, so the
+ * same command line always measures the same input.
+ */
+
+static int nr_funcs = 1000;
+static int nr_stmts = 20;
+static int depth = 3;
+static int nr_globals = 200;
+static int nr_fields = 8;
+static int nr_strings = 100;
+static unsigned long seed = 1;
+
+static int strings_left;
+
+static unsigned int
+rnd(unsigned int n)
+{
+	/* xorshift64*, so the corpus doesn't depend on the libc. */
+	seed ^= seed >> 12;
+	seed ^= seed << 25;
+	seed ^= seed >> 27;
+	return (((seed * 2685821657736338717UL) >> 33) % n);
+}
+
+static void
+operand(void)
+{
+	switch (rnd(7)) {
+	case 0:
+		printf("%u", rnd(1000));
+		break;
+	case 1:
+		printf("a");
+		break;
+	case 2:
+		printf("b");
+		break;
+	case 3:
+		printf("x");
+		break;
+	case 4:
+		printf("g%u", rnd(nr_globals));
+		break;
+	case 5:
+		printf("s%u.f%u", rnd(nr_globals), rnd(nr_fields));
+		break;
+	default:
+		printf("v%u[%u]", rnd(nr_globals), rnd(16));
+		break;
+	}
+}
+
+static void
+expr(int d)
+{
+	static const char *ops[] = { "+", "-", "*", "&", "|", "^" };
+
+	if (d == 0 || rnd(4) == 0) {
+		operand();
+		return;
+	}
+	printf("(");
+	expr(d - 1);
+	printf(" %s ", ops[rnd(sizeof(ops) / sizeof(ops[0]))]);
+	expr(d - 1);
+	printf(")");
+}
+
+static void
+cond(void)
+{
+	static const char *ops[] = { "<", "<=", ">", ">=", "==", "!=" };
+
+	expr(1);
+	printf(" %s ", ops[rnd(sizeof(ops) / sizeof(ops[0]))]);
+	expr(1);
+}
+
+static void
+stmt(int fn, int indent)
+{
+	printf("%*s", indent, "");
+	switch (rnd(10)) {
+	case 0:
+		printf("if (");
+		cond();
+		printf(")\n%*sx = ", indent + 8, "");
+		expr(depth);
+		printf(";\n%*selse\n%*sy = ", indent, "", indent + 8, "");
+		expr(depth);
+		printf(";\n");
+		break;
+	case 1:
+		printf("for (i = 0; i < %u; i = i + 1)\n%*sx = x + ",
+		    rnd(16) + 1, indent + 8, "");
+		expr(depth);
+		printf(";\n");
+		break;
+	case 2:
+		printf("while (y < %u)\n%*sy = y + 1;\n", rnd(100), indent + 8,
+		    "");
+		break;
+	case 3:
+		if (fn > 0) {
+			printf("y = f%u(x, ", rnd(fn));
+			expr(depth - 1);
+			printf(");\n");
+			break;
+		}
+		/* FALLTHROUGH */
+	case 4:
+		if (strings_left > 0) {
+			strings_left--;
+			printf("p = \"string %u of %d\";\n", rnd(100000),
+			    nr_strings);
+			break;
+		}
+		/* FALLTHROUGH */
+	case 5:
+		printf("g%u = ", rnd(nr_globals));
+		expr(depth);
+		printf(";\n");
+		break;
+	case 6:
+		printf("s%u.f%u = ", rnd(nr_globals), rnd(nr_fields));
+		expr(depth);
+		printf(";\n");
+		break;
+	case 7:
+		printf("v%u[%u] = ", rnd(nr_globals), rnd(16));
+		expr(depth);
+		printf(";\n");
+		break;
+	default:
+		printf("x = ");
+		expr(depth);
+		printf(";\n");
+		break;
+	}
+}
+
+static void
+usage(char *prog)
+{
+	errx(1, "Usage: %s [-d depth] [-F fields] [-f functions] [-g globals]"
+	    " [-r seed] [-S strings] [-s statements]", prog);
+}
+
+int
+main(int argc, char **argv)
+{
+	int ch, i, j;
+
+	while ((ch = getopt(argc, argv, "d:F:f:g:r:S:s:")) != -1) {
+		switch (ch) {
+		case 'd':
+			depth = atoi(optarg);
+			break;
+		case 'F':
+			nr_fields = atoi(optarg);
+			break;
+		case 'f':
+			nr_funcs = atoi(optarg);
+			break;
+		case 'g':
+			nr_globals = atoi(optarg);
+			break;
+		case 'r':
+			seed = strtoul(optarg, NULL, 0);
+			break;
+		case 'S':
+			nr_strings = atoi(optarg);
+			break;
+		case 's':
+			nr_stmts = atoi(optarg);
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+	if (depth < 1 || nr_fields < 1 || nr_funcs < 1 || nr_globals < 1 ||
+	    nr_strings < 0 || nr_stmts < 0 || seed == 0)
+		usage(argv[0]);
+	strings_left = nr_strings;
+
+	printf("/* rcc benchmark input: -d %d -F %d -f %d -g %d -r %lu "
+	    "-S %d -s %d */\n\n", depth, nr_fields, nr_funcs, nr_globals, seed,
+	    nr_strings, nr_stmts);
+
+	printf("struct rec {\n");
+	for (i = 0; i < nr_fields; i++)
+		printf("\tlong f%d;\n", i);
+	printf("};\n\n");
+
+	for (i = 0; i < nr_globals; i++)
+		printf("long g%d;\nlong v%d[16];\nstruct rec s%d;\n", i, i, i);
+
+	for (i = 0; i < nr_funcs; i++) {
+		printf("\nlong\nf%d(long a, long b)\n{\n", i);
+		printf("\tlong i;\n\tlong x;\n\tlong y;\n\tchar *p;\n\n");
+		printf("\tx = a;\n\ty = b;\n");
+		for (j = 0; j < nr_stmts; j++)
+			stmt(i, 8);
+		printf("\treturn (x + y);\n}\n");
+	}
+
+	printf("\nint\nmain()\n{\n\tprintf(\"%%ld\\n\", f%d(1, 2));\n"
+	    "\treturn (0);\n}\n", nr_funcs - 1);
+
+	return (0);
+}
@@ -0,0 +1,128 @@
+#include <sys/time.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <err.h>
+
+#include "../rcc.h"
+
+/*
+ * Compare the flex scanner with the hand-written one: both are run over
+ * the same files, their token streams must agree, and the time each one
+ * takes is reported.
+ */
+
+#define	NR_RUNS 5
+
+struct lexer {
+	char *name;
+	void (*open)(FILE *);
+	int (*token)(struct token *);
+	double best;
+};
+
+static struct lexer lexers[] = {
+	{ "flex", flex_open, flex_token, 0 },
+	{ "scan", scan_open, scan_token, 0 },
+};
+
+#define	NR_LEXERS (sizeof(lexers) / sizeof(lexers[0]))
+
+static double
+now(void)
+{
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+	return (tv.tv_sec + tv.tv_usec / 1e6);
+}
+
+static long
+run(struct lexer *l, char *file)
+{
+	FILE *f;
+	long n;
+
+	if ((f = fopen(file, "r")) == NULL)
+		err(1, "fopen %s", file);
+	l->open(f);
+	lex(l->token);
+	for (n = 0; tok->tok != TOK_EOF; n++)
+		lex_next();
+	fclose(f);
+	arena_free(&ast_arena);
+
+	return (n);
+}
+
+static void
+compare(char *file)
+{
+	struct token a, b;
+	FILE *fa, *fb;
+
+	if ((fa = fopen(file, "r")) == NULL || (fb = fopen(file, "r")) == NULL)
+		err(1, "fopen %s", file);
+	lexers[0].open(fa);
+	lexers[1].open(fb);
+	do {
+		memset(&a, 0, sizeof(a));
+		memset(&b, 0, sizeof(b));
+		lexers[0].token(&a);
+		lexers[1].token(&b);
+		if (a.tok != b.tok || a.line != b.line ||
+		    (a.tok == TOK_CONSTANT && a.val != b.val) ||
+		    ((a.tok == TOK_ID || a.tok == TOK_STRING) &&
+		    strcmp(a.str, b.str)))
+			errx(1, "%s:%d: token mismatch %s %d, %s %d", file,
+			    a.line, lexers[0].name, a.tok, lexers[1].name,
+			    b.tok);
+	} while (a.tok != TOK_EOF);
+	fclose(fa);
+	fclose(fb);
+	arena_free(&ast_arena);
+}
+
+int
+main(int argc, char **argv)
+{
+	struct lexer *l;
+	double t;
+	long bytes, ntok;
+	FILE *f;
+	int i, r;
+
+	if (argc < 2)
+		errx(1, "Usage: %s <file> ...", argv[0]);
+
+	bytes = 0;
+	for (i = 1; i < argc; i++) {
+		compare(argv[i]);
+		if ((f = fopen(argv[i], "r")) == NULL)
+			err(1, "fopen %s", argv[i]);
+		fseek(f, 0, SEEK_END);
+		bytes += ftell(f);
+		fclose(f);
+	}
+
+	ntok = 0;
+	for (l = lexers; l < lexers + NR_LEXERS; l++) {
+		for (r = 0; r < NR_RUNS; r++) {
+			t = now();
+			for (i = 1, ntok = 0; i < argc; i++)
+				ntok += run(l, argv[i]);
+			t = now() - t;
+			if (r == 0 || t < l->best)
+				l->best = t;
+		}
+	}
+
+	printf("%ld bytes, %ld tokens, best of %d runs\n", bytes, ntok,
+	    NR_RUNS);
+	for (l = lexers; l < lexers + NR_LEXERS; l++)
+		printf("%-6s %8.3f ms %8.1f MB/s %10.0f tokens/s\n", l->name,
+		    l->best * 1e3, bytes / l->best / 1e6, ntok / l->best);
+	printf("speedup %.2fx\n", lexers[0].best / lexers[1].best);
+
+	return (0);
+}
@@ -0,0 +1,46 @@
+#include <stdio.h>
+#define	N 64
+
+/* Sample input for the lexer benchmark. */
+struct point {
+	long x;
+	long y;
+	struct point *next;
+};
+
+struct point points[N];
+char names[N];
+
+long
+dist(struct point *a, struct point *b)
+{
+	long dx;
+	long dy;
+
+	dx = a->x - b->x;
+	dy = a->y - b->y;
+	if (dx < 0)
+		dx = -dx;
+	if (dy < 0)
+		dy = -dy;
+	return (dx + dy);
+}
+
+int
+main()
+{
+	int i;
+	long total;
+
+	total = 0;
+	for (i = 0; i < 64; i++) {
+		points[i].x = i * 3 + 0x10;
+		points[i].y = i / 2 - 017;
+		names[i] = 'a' + (i & 15);
+	}
+	for (i = 1; i < 64; i++)
+		total += dist(&points[i - 1], &points[i]);
+	// report the result
+	printf("total %ld\n", total);
+	return (0);
+}
@@ -0,0 +1,83 @@
+/*
+ * Kernels for the vectoriser benchmark (see bench/vecbench.c), in the
+ * subset of C that rcc accepts. The checksum at the end is the same
+ * however they were compiled.
+ */
+int ia[4096];
+int ib[4096];
+int ic[4096];
+long la[4096];
+long lb[4096];
+long lc[4096];
+char ca[16384];
+char cb[16384];
+
+int
+add(int *c, int *a, int *b, int n)
+{
+	int i;
+
+	for (i = 0; i < n; i = i + 1)
+		c[i] = a[i] + b[i];
+	return 0;
+}
+
+int
+blend(long *d, long *a, long *b, long m, int n)
+{
+	int i;
+
+	for (i = 0; i < n; i = i + 1)
+		d[i] = (a[i] & m) + b[i];
+	return 0;
+}
+
+int
+brighten(char *d, char *s, int k, int n)
+{
+	int i;
+
+	for (i = 0; i < n; i = i + 1)
+		d[i] = s[i] + k;
+	return 0;
+}
+
+int
+shift(int *a, int n)
+{
+	int i;
+
+	for (i = 0; i < n - 8; i = i + 1)
+		a[i] = a[i + 8] ^ a[i];
+	return 0;
+}
+
+int
+main()
+{
+	long sum;
+	int i;
+	int r;
+
+	for (i = 0; i < 4096; i = i + 1) {
+		ia[i] = i * 7;
+		ib[i] = 4096 - i;
+		la[i] = i * 1000003;
+		lb[i] = i * 77;
+	}
+	for (i = 0; i < 16384; i = i + 1)
+		ca[i] = i;
+	for (r = 0; r < 20000; r = r + 1) {
+		add(ic, ia, ib, 4096);
+		blend(lc, la, lb, 65535, 4096);
+		brighten(cb, ca, r, 16384);
+		shift(ic, 4096);
+	}
+	sum = 0;
+	for (i = 0; i < 4096; i = i + 1)
+		sum = sum * 31 + ic[i] + lc[i];
+	for (i = 0; i < 16384; i = i + 1)
+		sum = sum * 31 + cb[i];
+	printf("%ld\n", sum);
+	return 0;
+}
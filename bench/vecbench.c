@@ -0,0 +1,90 @@
+#include <sys/time.h>
+#include <sys/wait.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <err.h>
+
+/*
+ * Time programs built from bench/vec.c with and without vectorisation:
+ * each one is run a few times, what they print must agree, and the best
+ * time of each and its speedup over the first one are reported.
+ */
+
+#define	NR_RUNS 5
+
+static double
+now(void)
+{
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+	return (tv.tv_sec + tv.tv_usec / 1e6);
+}
+
+/* Run prog and return how long it took, with its output in buf. */
+static double
+run(char *prog, char *buf, size_t size)
+{
+	double t;
+	size_t len;
+	ssize_t n;
+	pid_t pid;
+	int fd[2], status;
+
+	if (pipe(fd) == -1)
+		err(1, "pipe");
+	t = now();
+	if ((pid = fork()) == -1)
+		err(1, "fork");
+	if (pid == 0) {
+		close(fd[0]);
+		if (dup2(fd[1], STDOUT_FILENO) == -1)
+			err(1, "dup2");
+		execl(prog, prog, (char *)NULL);
+		err(1, "exec %s", prog);
+	}
+	close(fd[1]);
+	for (len = 0; len < size - 1 &&
+	    (n = read(fd[0], buf + len, size - 1 - len)) > 0; len += n)
+		;
+	buf[len] = '\0';
+	close(fd[0]);
+	if (waitpid(pid, &status, 0) == -1)
+		err(1, "waitpid");
+	t = now() - t;
+	if (!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+		errx(1, "%s failed", prog);
+	return (t);
+}
+
+int
+main(int argc, char **argv)
+{
+	char first[256], out[256];
+	double best, base, t;
+	int i, r;
+
+	if (argc < 2)
+		errx(1, "Usage: %s <program> ...", argv[0]);
+
+	base = 0;
+	for (i = 1; i < argc; i++) {
+		best = run(argv[i], out, sizeof(out));
+		for (r = 1; r < NR_RUNS; r++)
+			if ((t = run(argv[i], out, sizeof(out))) < best)
+				best = t;
+		if (i == 1) {
+			strcpy(first, out);
+			base = best;
+		} else if (strcmp(first, out))
+			errx(1, "%s: output differs from %s", argv[i],
+			    argv[1]);
+		printf("%-20s %8.3f ms %6.2fx\n", argv[i], best * 1e3,
+		    base / best);
+	}
+	printf("best of %d runs\n", NR_RUNS);
+
+	return (0);
+}
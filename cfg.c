@@ -0,0 +1,508 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <err.h>
+
+#include "rcc.h"
+
+/*
+ * Control-flow graph over the IR list of one function. A block is a run
+ * of instructions [head, tail] that starts at a label or after a branch;
+ * the KILLs that follow a branch stay with the block they end. Edges live
+ * in one array, each block pointing at its own successor and predecessor
+ * slices. Everything is allocated in ir_arena.
+ */
+
+static int
+is_branch(struct ir *ir)
+{
+	return (ir->op == IR_JUMP || ir->op == IR_CBR || ir->op == IR_RET);
+}
+
+/* The last instruction that isn't a KILL. */
+struct ir *
+block_last(struct block *b)
+{
+	struct ir *ir, *last;
+
+	last = NULL;
+	for (ir = b->head; ir; ir = ir->next) {
+		if (ir->op != IR_KILL)
+			last = ir;
+		if (ir == b->tail)
+			break;
+	}
+	return (last);
+}
+
+static int
+label_block(struct cfg *cfg, long label)
+{
+	int b;
+
+	if (label < cfg->min_label || label > cfg->max_label ||
+	    (b = cfg->label_blocks[label - cfg->min_label]) == -1)
+		errx(1, "Branch to unknown label %ld", label);
+	return (b);
+}
+
+static void
+add_succ(struct cfg *cfg, struct block *b, int s)
+{
+	int i;
+
+	for (i = 0; i < b->nr_succs; i++)
+		if (b->succs[i] == s)
+			return;
+	b->succs[b->nr_succs++] = s;
+	cfg->blocks[s].nr_preds++;
+}
+
+struct cfg *
+cfg_build(struct ir *head)
+{
+	struct block *b;
+	struct cfg *cfg;
+	struct ir *ir, *last;
+	int i, n, nr_edges, start;
+
+	cfg = arena_alloc(&ir_arena, sizeof(struct cfg));
+
+	/* Count the blocks and the range of labels they start with. */
+	cfg->min_label = cfg->max_label = -1;
+	n = 0;
+	start = 1;
+	for (ir = head; ir; ir = ir->next) {
+		if (ir->op == IR_KILL)
+			continue;
+		if (start || ir->op == IR_LABEL)
+			n++;
+		start = is_branch(ir);
+		if (ir->op == IR_LABEL) {
+			if (cfg->min_label == -1 || ir->o1 < cfg->min_label)
+				cfg->min_label = ir->o1;
+			if (ir->o1 > cfg->max_label)
+				cfg->max_label = ir->o1;
+		}
+	}
+
+	cfg->nr_blocks = n;
+	cfg->blocks = arena_alloc(&ir_arena, n * sizeof(struct block));
+	if (cfg->max_label != -1) {
+		n = cfg->max_label - cfg->min_label + 1;
+		cfg->label_blocks = arena_alloc(&ir_arena, n * sizeof(int));
+		memset(cfg->label_blocks, -1, n * sizeof(int));
+	}
+
+	/* Split. */
+	b = NULL;
+	start = 1;
+	for (ir = head; ir; ir = ir->next) {
+		if (ir->op != IR_KILL && (start || ir->op == IR_LABEL)) {
+			b = b ? b + 1 : cfg->blocks;
+			b->head = ir;
+			b->label = -1;
+		}
+		if (ir->op == IR_LABEL) {
+			b->label = ir->o1;
+			cfg->label_blocks[ir->o1 - cfg->min_label] = b -
+			    cfg->blocks;
+		}
+		b->tail = ir;
+		if (ir->op != IR_KILL)
+			start = is_branch(ir);
+	}
+
+	/* Successor slices first, then the predecessor ones. */
+	nr_edges = 0;
+	for (i = 0; i < cfg->nr_blocks; i++) {
+		b = &cfg->blocks[i];
+		last = block_last(b);
+		if (last && last->op == IR_CBR)
+			nr_edges += 2;
+		else if (!last || last->op != IR_RET)
+			nr_edges++;
+	}
+	cfg->edges = arena_alloc(&ir_arena, 2 * nr_edges * sizeof(int));
+
+	n = 0;
+	for (i = 0; i < cfg->nr_blocks; i++) {
+		b = &cfg->blocks[i];
+		b->succs = cfg->edges + n;
+		last = block_last(b);
+		if (last && last->op == IR_JUMP)
+			add_succ(cfg, b, label_block(cfg, last->dst));
+		else if (last && last->op == IR_CBR) {
+			add_succ(cfg, b, label_block(cfg, last->o2));
+			add_succ(cfg, b, label_block(cfg, last->dst));
+		} else if ((!last || last->op != IR_RET) && i + 1 <
+		    cfg->nr_blocks)
+			add_succ(cfg, b, i + 1);
+		n += b->nr_succs;
+	}
+	for (i = 0; i < cfg->nr_blocks; i++) {
+		b = &cfg->blocks[i];
+		b->preds = cfg->edges + n;
+		n += b->nr_preds;
+		b->nr_preds = 0;
+	}
+	for (i = 0; i < cfg->nr_blocks; i++) {
+		b = &cfg->blocks[i];
+		for (n = 0; n < b->nr_succs; n++) {
+			struct block *s = &cfg->blocks[b->succs[n]];
+
+			s->preds[s->nr_preds++] = i;
+		}
+	}
+	cfg->nr_edges = nr_edges;
+
+	return (cfg);
+}
+
+static int
+block_label(struct block *b)
+{
+	struct ir *ir;
+
+	if (b->label == -1) {
+		b->label = new_label();
+		ir = ir_alloc(IR_LABEL, b->label, 0, 0);
+		ir->next = b->head;
+		b->head = ir;
+	}
+	return (b->label);
+}
+
+/*
+ * Lay the blocks out in the given order (the ones that aren't dead, in
+ * their original order, if order is NULL) and return the instruction list.
+ * Jumps to the next block are dropped and fall-throughs to any other block
+ * get one.
+ */
+struct ir *
+cfg_linearize(struct cfg *cfg, int *order, int nr_order)
+{
+	struct block *b;
+	struct ir *ir, *last, *head, **tailp;
+	int i, k, next;
+
+	if (order == NULL) {
+		order = arena_alloc(&ir_arena, cfg->nr_blocks * sizeof(int));
+		for (i = nr_order = 0; i < cfg->nr_blocks; i++)
+			if (!cfg->blocks[i].dead)
+				order[nr_order++] = i;
+	}
+
+	/* Labels for new jumps go in before any block is linked. */
+	for (k = 0; k < nr_order; k++) {
+		b = &cfg->blocks[order[k]];
+		next = k + 1 < nr_order ? order[k + 1] : -1;
+		last = block_last(b);
+		if ((!last || !is_branch(last)) && b->nr_succs &&
+		    b->succs[0] != next)
+			block_label(&cfg->blocks[b->succs[0]]);
+	}
+
+	head = NULL;
+	tailp = &head;
+	for (k = 0; k < nr_order; k++) {
+		i = order[k];
+		b = &cfg->blocks[i];
+		next = k + 1 < nr_order ? order[k + 1] : -1;
+		last = block_last(b);
+		for (ir = b->head;; ir = ir->next) {
+			if (ir != last || ir->op != IR_JUMP ||
+			    b->succs[0] != next) {
+				*tailp = ir;
+				tailp = &ir->next;
+			}
+			if (ir == b->tail)
+				break;
+		}
+		if ((!last || !is_branch(last)) && b->nr_succs &&
+		    b->succs[0] != next) {
+			ir = ir_alloc(IR_JUMP, 0, 0,
+			    cfg->blocks[b->succs[0]].label);
+			*tailp = ir;
+			tailp = &ir->next;
+		}
+	}
+	*tailp = NULL;
+
+	return (head);
+}
+
+/*
+ * Give every edge from a conditional branch to a block with several
+ * predecessors a block of its own, so that code for the edge always has
+ * somewhere to go. Returns the new list; the CFG has to be built again.
+ */
+struct ir *
+cfg_split_edges(struct ir *head)
+{
+	struct block *b, *s;
+	struct cfg *cfg;
+	struct ir *ir, *last;
+	int i, k, l;
+
+	cfg = cfg_build(head);
+	for (i = 0; i < cfg->nr_blocks; i++) {
+		b = &cfg->blocks[i];
+		if (b->nr_succs != 2)
+			continue;
+		last = block_last(b);
+		for (k = 0; k < 2; k++) {
+			s = &cfg->blocks[b->succs[k]];
+			if (s->nr_preds < 2)
+				continue;
+			l = new_label();
+			ir = ir_alloc(IR_JUMP, 0, 0, s->label);
+			ir->next = b->tail->next;
+			b->tail->next = ir_alloc(IR_LABEL, l, 0, 0);
+			b->tail->next->next = ir;
+			b->tail = ir;
+			if (last->o2 == s->label)
+				last->o2 = l;
+			else
+				last->dst = l;
+		}
+	}
+	return (head);
+}
+
+/*
+ * Put an empty block in front of every loop header, which all entries
+ * into the loop go through and the back edges pass by, for code hoisted
+ * out of the loop. Returns the new list; the CFG has to be built again.
+ */
+struct ir *
+cfg_add_preheaders(struct ir *head)
+{
+	struct block *b, *h;
+	struct cfg *cfg;
+	struct ir *ir, *last, *label;
+	int i, j, l;
+
+	cfg = cfg_build(head);
+	cfg_dominators(cfg);
+	for (i = 1; i < cfg->nr_blocks; i++) {
+		h = &cfg->blocks[i];
+		if (h->rpo == -1 || h->label == -1)
+			continue;
+		for (j = 0; j < h->nr_preds; j++)
+			if (back_edge(cfg, h->preds[j], i))
+				break;
+		if (j == h->nr_preds)
+			continue;
+
+		l = new_label();
+		for (j = 0; j < h->nr_preds; j++) {
+			if (back_edge(cfg, h->preds[j], i))
+				continue;
+			last = block_last(&cfg->blocks[h->preds[j]]);
+			if (last && last->op == IR_JUMP)
+				last->dst = l;
+			else if (last && last->op == IR_CBR) {
+				if (last->o2 == h->label)
+					last->o2 = l;
+				if (last->dst == h->label)
+					last->dst = l;
+			}
+		}
+
+		/* The block before may be a latch that falls through. */
+		b = &cfg->blocks[i - 1];
+		last = block_last(b);
+		if (back_edge(cfg, i - 1, i) && (!last || !is_branch(last))) {
+			ir = ir_alloc(IR_JUMP, 0, 0, h->label);
+			ir->next = b->tail->next;
+			b->tail->next = ir;
+			b->tail = ir;
+		}
+		label = ir_alloc(IR_LABEL, l, 0, 0);
+		label->next = b->tail->next;
+		b->tail->next = label;
+	}
+	return (head);
+}
+
+static int
+intersect(struct cfg *cfg, int a, int b)
+{
+	while (a != b) {
+		while (cfg->blocks[a].rpo > cfg->blocks[b].rpo)
+			a = cfg->blocks[a].idom;
+		while (cfg->blocks[b].rpo > cfg->blocks[a].rpo)
+			b = cfg->blocks[b].idom;
+	}
+	return (a);
+}
+
+/*
+ * Reverse postorder and immediate dominators, with the iterative
+ * algorithm of Cooper, Harvey and Kennedy. Unreachable blocks get an rpo
+ * and an idom of -1; the entry block is its own idom. The children of
+ * each block in the dominator tree are kept as slices of one array.
+ */
+void
+cfg_dominators(struct cfg *cfg)
+{
+	struct block *b;
+	int *kids, *next, *stack, *start;
+	int changed, i, j, k, n, sp, idom;
+
+	n = cfg->nr_blocks;
+	cfg->rpo = arena_alloc(&ir_arena, n * sizeof(int));
+	stack = arena_alloc(&ir_arena, n * sizeof(int));
+	next = arena_alloc(&ir_arena, n * sizeof(int));
+	for (i = 0; i < n; i++) {
+		cfg->blocks[i].rpo = -1;
+		cfg->blocks[i].idom = -1;
+	}
+
+	/* Iterative DFS; rpo doubles as the visited mark until numbered. */
+	k = n;
+	sp = 0;
+	stack[sp++] = 0;
+	cfg->blocks[0].rpo = 0;
+	while (sp) {
+		b = &cfg->blocks[stack[sp - 1]];
+		if (next[stack[sp - 1]] < b->nr_succs) {
+			j = b->succs[next[stack[sp - 1]]++];
+			if (cfg->blocks[j].rpo == -1) {
+				cfg->blocks[j].rpo = 0;
+				stack[sp++] = j;
+			}
+			continue;
+		}
+		cfg->rpo[--k] = stack[--sp];
+	}
+	cfg->nr_rpo = n - k;
+	memmove(cfg->rpo, cfg->rpo + k, cfg->nr_rpo * sizeof(int));
+	for (i = 0; i < cfg->nr_rpo; i++)
+		cfg->blocks[cfg->rpo[i]].rpo = i;
+
+	cfg->blocks[0].idom = 0;
+	do {
+		changed = 0;
+		for (i = 1; i < cfg->nr_rpo; i++) {
+			b = &cfg->blocks[cfg->rpo[i]];
+			idom = -1;
+			for (j = 0; j < b->nr_preds; j++) {
+				k = b->preds[j];
+				if (cfg->blocks[k].idom == -1)
+					continue;
+				idom = idom == -1 ? k : intersect(cfg, k, idom);
+			}
+			if (b->idom != idom) {
+				b->idom = idom;
+				changed = 1;
+			}
+		}
+	} while (changed);
+
+	kids = cfg->dom_kids = arena_alloc(&ir_arena, n * sizeof(int));
+	start = cfg->dom_kids_start = arena_alloc(&ir_arena, (n + 1) *
+	    sizeof(int));
+	for (i = 1; i < cfg->nr_rpo; i++)
+		start[cfg->blocks[cfg->rpo[i]].idom + 1]++;
+	for (i = 0; i < n; i++)
+		start[i + 1] += start[i];
+	for (i = 1; i < cfg->nr_rpo; i++)
+		kids[start[cfg->blocks[cfg->rpo[i]].idom]++] = cfg->rpo[i];
+	for (i = n; i > 0; i--)
+		start[i] = start[i - 1];
+	start[0] = 0;
+}
+
+/* Whether from -> to goes back to a block dominating from. */
+int
+back_edge(struct cfg *cfg, int from, int to)
+{
+	return (cfg->blocks[from].rpo != -1 && dominates(cfg, to, from));
+}
+
+/* Whether block a dominates block b; both have to be reachable. */
+int
+dominates(struct cfg *cfg, int a, int b)
+{
+	while (b != a && b != 0)
+		b = cfg->blocks[b].idom;
+	return (b == a);
+}
+
+/* Insert ir at the end of b, before the branch if there is one. */
+void
+block_append(struct block *b, struct ir *ir)
+{
+	struct ir *prev;
+
+	if (b->tail->op != IR_JUMP) {
+		ir->next = b->tail->next;
+		b->tail->next = ir;
+		b->tail = ir;
+		return;
+	}
+	for (prev = b->head; prev->next != b->tail; prev = prev->next)
+		;
+	ir->next = b->tail;
+	prev->next = ir;
+}
+
+/* Drop the edge along with its operand in the PHIs of the target. */
+void
+cfg_remove_edge(struct cfg *cfg, int from, int to)
+{
+	struct block *b, *s;
+	struct ir *ir;
+	int i, j;
+
+	b = &cfg->blocks[from];
+	s = &cfg->blocks[to];
+	for (i = 0; i < b->nr_succs && b->succs[i] != to; i++)
+		;
+	if (i == b->nr_succs)
+		return;
+	memmove(b->succs + i, b->succs + i + 1, (--b->nr_succs - i) *
+	    sizeof(int));
+	for (j = 0; s->preds[j] != from; j++)
+		;
+	memmove(s->preds + j, s->preds + j + 1, (--s->nr_preds - j) *
+	    sizeof(int));
+	for (ir = s->head;; ir = ir->next) {
+		if (ir->op == IR_PHI) {
+			memmove(ir->args + j, ir->args + j + 1,
+			    (--ir->nr_args - j) * sizeof(long));
+		}
+		if (ir == s->tail)
+			break;
+	}
+}
+
+void
+dump_cfg(struct cfg *cfg)
+{
+	struct block *b;
+	struct ir *ir;
+	int i, j;
+
+	for (i = 0; i < cfg->nr_blocks; i++) {
+		b = &cfg->blocks[i];
+		printf("B%d:", i);
+		if (b->label != -1)
+			printf(" L%d", b->label);
+		printf(" preds");
+		for (j = 0; j < b->nr_preds; j++)
+			printf(" B%d", b->preds[j]);
+		printf(" succs");
+		for (j = 0; j < b->nr_succs; j++)
+			printf(" B%d", b->succs[j]);
+		printf("\n");
+		for (ir = b->head;; ir = ir->next) {
+			printf("\t");
+			dump_ir_op(stdout, ir);
+			if (ir == b->tail)
+				break;
+		}
+	}
+}
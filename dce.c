@@ -0,0 +1,101 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <err.h>
+
+#include "rcc.h"
+
+/*
+ * Dead code elimination on the SSA form. Stores, calls, branches and
+ * everything else that doesn't just compute a register are live; so is
+ * the definition of whatever a live instruction reads, PHI args included.
+ * The rest goes, even when it only feeds itself around a loop. The blocks
+ * that can't be reached from the ENTER were already dropped while going
+ * into SSA form and by sccp().
+ */
+
+static struct ir **defs;		/* by register, in SSA form */
+static char *live;			/* by register */
+static long *work;
+static int nr_work;
+
+static void
+mark(long r)
+{
+	if (r == RARP || live[r])
+		return;
+	live[r] = 1;
+	work[nr_work++] = r;
+}
+
+static void
+mark_uses(struct ir *ir)
+{
+	long *u[MAX_IR_USES];
+	int i, k;
+
+	k = ir_uses(ir, u);
+	for (i = 0; i < k; i++)
+		mark(*u[i]);
+	for (i = 0; i < ir->nr_args; i++)
+		mark(ir->args[i]);
+}
+
+static int
+critical(struct ir *ir)
+{
+	return (!ir_defines(ir) || ir->op == IR_CALL || ir->op == IR_ARG ||
+	    ir->op == IR_VLOOP);
+}
+
+/* Returns the number of instructions removed. */
+int
+dead_code(struct cfg *cfg)
+{
+	struct block *b;
+	struct ir *ir, *prev;
+	int i, n, removed;
+
+	n = ir_nr_regs();
+	defs = arena_alloc(&ir_arena, n * sizeof(struct ir *));
+	live = arena_alloc(&ir_arena, n);
+	work = arena_alloc(&ir_arena, n * sizeof(long));
+	nr_work = 0;
+	for (i = 0; i < cfg->nr_blocks; i++) {
+		b = &cfg->blocks[i];
+		if (b->dead)
+			continue;
+		for (ir = b->head;; ir = ir->next) {
+			if (ir_defines(ir))
+				defs[ir->dst] = ir;
+			if (critical(ir))
+				mark_uses(ir);
+			if (ir == b->tail)
+				break;
+		}
+	}
+	while (nr_work) {
+		ir = defs[work[--nr_work]];
+		if (ir)
+			mark_uses(ir);
+	}
+
+	/* A block starts with its label or the ENTER, which both stay. */
+	removed = 0;
+	for (i = 0; i < cfg->nr_blocks; i++) {
+		b = &cfg->blocks[i];
+		if (b->dead)
+			continue;
+		for (prev = b->head; prev != b->tail; ) {
+			ir = prev->next;
+			if (critical(ir) || live[ir->dst]) {
+				prev = ir;
+				continue;
+			}
+			prev->next = ir->next;
+			if (ir == b->tail)
+				b->tail = prev;
+			removed++;
+		}
+	}
+	return (removed);
+}
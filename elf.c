@@ -0,0 +1,352 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <elf.h>
+#include <err.h>
+
+#include "rcc.h"
+
+/*
+ * ELF64 relocatable objects. The encoder appends bytes to the sections
+ * below and records symbols and .text relocations by name; everything is
+ * laid out and written once the whole unit has been compiled.
+ */
+
+struct elf_buf {
+	char *data;
+	size_t len;
+	size_t cap;
+};
+
+struct elf_sym {
+	char *name;
+	int sect;			/* -1 if undefined */
+	unsigned long value;
+	int global;
+	int index;			/* in .symtab, set by elf_write() */
+};
+
+struct elf_reloc {
+	unsigned long off;
+	int sym;
+	int type;
+	long addend;
+};
+
+/* Section header indices; the as_section sections come first. */
+enum {
+	SH_NULL,
+	SH_TEXT,
+	SH_DATA,
+	SH_RODATA,
+	SH_RELA_TEXT,
+	SH_SYMTAB,
+	SH_STRTAB,
+	SH_NOTE_STACK,
+	SH_SHSTRTAB,
+	NR_SH,
+};
+
+static char *sh_names[NR_SH] = {
+    [SH_NULL] = "",
+    [SH_TEXT] = ".text",
+    [SH_DATA] = ".data",
+    [SH_RODATA] = ".rodata",
+    [SH_RELA_TEXT] = ".rela.text",
+    [SH_SYMTAB] = ".symtab",
+    [SH_STRTAB] = ".strtab",
+    [SH_NOTE_STACK] = ".note.GNU-stack",
+    [SH_SHSTRTAB] = ".shstrtab",
+};
+
+static struct elf_buf sects[NR_AS_SECTIONS];
+
+static struct elf_sym *syms;
+static int nr_syms, max_syms;
+static int *sym_hash;
+static unsigned int sym_hash_size;
+
+static struct elf_reloc *relocs;
+static int nr_relocs, max_relocs;
+
+static void *
+grow(void *p, int *max, size_t size)
+{
+	*max = *max ? *max * 2 : 1024;
+	if ((p = realloc(p, *max * size)) == NULL)
+		err(1, "realloc");
+	return (p);
+}
+
+static void
+buf_add(struct elf_buf *b, const void *p, size_t len)
+{
+	if (b->len + len > b->cap) {
+		while (b->len + len > b->cap)
+			b->cap = b->cap ? b->cap * 2 : 64 * 1024;
+		if ((b->data = realloc(b->data, b->cap)) == NULL)
+			err(1, "realloc");
+	}
+	if (p)
+		memcpy(b->data + b->len, p, len);
+	else
+		memset(b->data + b->len, 0, len);
+	b->len += len;
+}
+
+void
+elf_bytes(enum as_section sect, const void *p, size_t len)
+{
+	buf_add(&sects[sect], p, len);
+}
+
+unsigned long
+elf_offset(enum as_section sect)
+{
+	return (sects[sect].len);
+}
+
+void
+elf_patch32(enum as_section sect, unsigned long off, int v)
+{
+	memcpy(sects[sect].data + off, &v, 4);
+}
+
+static void
+sym_rehash(void)
+{
+	unsigned int i, h;
+
+	free(sym_hash);
+	sym_hash_size = sym_hash_size ? sym_hash_size * 2 : 1024;
+	if ((sym_hash = malloc(sym_hash_size * sizeof(int))) == NULL)
+		err(1, "malloc");
+	memset(sym_hash, -1, sym_hash_size * sizeof(int));
+	for (i = 0; i < nr_syms; i++) {
+		h = atom_hash(syms[i].name) & (sym_hash_size - 1);
+		while (sym_hash[h] != -1)
+			h = (h + 1) & (sym_hash_size - 1);
+		sym_hash[h] = i;
+	}
+}
+
+/* Names are interned, so symbols are looked up by pointer. */
+static int
+sym_index(char *name)
+{
+	unsigned int h;
+	int i;
+
+	if (nr_syms * 2 >= sym_hash_size)
+		sym_rehash();
+	h = atom_hash(name) & (sym_hash_size - 1);
+	while ((i = sym_hash[h]) != -1) {
+		if (syms[i].name == name)
+			return (i);
+		h = (h + 1) & (sym_hash_size - 1);
+	}
+
+	if (nr_syms == max_syms)
+		syms = grow(syms, &max_syms, sizeof(struct elf_sym));
+	syms[nr_syms].name = name;
+	syms[nr_syms].sect = -1;
+	syms[nr_syms].value = 0;
+	syms[nr_syms].global = 0;
+	sym_hash[h] = nr_syms;
+
+	return (nr_syms++);
+}
+
+void
+elf_symbol(char *name, enum as_section sect)
+{
+	struct elf_sym *s;
+	int i;
+
+	i = sym_index(name);
+	s = &syms[i];
+	if (s->sect != -1)
+		errx(1, "Symbol %s defined twice", name);
+	s->sect = sect;
+	s->value = sects[sect].len;
+}
+
+void
+elf_global(char *name)
+{
+	int i;
+
+	i = sym_index(name);
+	syms[i].global = 1;
+}
+
+void
+elf_reloc(unsigned long off, char *name, int type, long addend)
+{
+	struct elf_reloc *r;
+
+	if (nr_relocs == max_relocs)
+		relocs = grow(relocs, &max_relocs, sizeof(struct elf_reloc));
+	r = &relocs[nr_relocs++];
+	r->off = off;
+	r->sym = sym_index(name);
+	r->type = type;
+	r->addend = addend;
+}
+
+static unsigned long
+pad(unsigned long off, unsigned long align)
+{
+	static const char zero[16];
+	unsigned long n;
+
+	n = (align - off % align) % align;
+	out_write(zero, n);
+	return (off + n);
+}
+
+void
+elf_write(void)
+{
+	Elf64_Shdr sh[NR_SH];
+	Elf64_Ehdr eh;
+	Elf64_Sym es;
+	Elf64_Rela er;
+	struct elf_buf symtab, strtab, shstrtab, relatab;
+	unsigned long off;
+	int i, pass, nr_locals;
+
+	memset(&symtab, 0, sizeof(symtab));
+	memset(&strtab, 0, sizeof(strtab));
+	memset(&shstrtab, 0, sizeof(shstrtab));
+	memset(&relatab, 0, sizeof(relatab));
+
+	/* Locals have to precede globals in .symtab. */
+	memset(&es, 0, sizeof(es));
+	buf_add(&symtab, &es, sizeof(es));
+	buf_add(&strtab, "", 1);
+	nr_locals = 1;
+	for (pass = 0; pass < 2; pass++) {
+		for (i = 0; i < nr_syms; i++) {
+			struct elf_sym *s = &syms[i];
+
+			if ((s->global || s->sect == -1) != pass)
+				continue;
+			s->index = symtab.len / sizeof(Elf64_Sym);
+			es.st_name = strtab.len;
+			es.st_info = ELF64_ST_INFO(pass ? STB_GLOBAL : STB_LOCAL,
+			    STT_NOTYPE);
+			es.st_other = STV_DEFAULT;
+			es.st_shndx = s->sect == -1 ? SHN_UNDEF : SH_TEXT +
+			    s->sect;
+			es.st_value = s->value;
+			es.st_size = 0;
+			buf_add(&symtab, &es, sizeof(es));
+			buf_add(&strtab, s->name, strlen(s->name) + 1);
+			if (!pass)
+				nr_locals++;
+		}
+	}
+
+	for (i = 0; i < nr_relocs; i++) {
+		er.r_offset = relocs[i].off;
+		er.r_info = ELF64_R_INFO(syms[relocs[i].sym].index,
+		    relocs[i].type);
+		er.r_addend = relocs[i].addend;
+		buf_add(&relatab, &er, sizeof(er));
+	}
+
+	memset(sh, 0, sizeof(sh));
+	for (i = 0; i < NR_SH; i++) {
+		sh[i].sh_name = shstrtab.len;
+		buf_add(&shstrtab, sh_names[i], strlen(sh_names[i]) + 1);
+	}
+	sh[SH_TEXT].sh_type = SHT_PROGBITS;
+	sh[SH_TEXT].sh_flags = SHF_ALLOC | SHF_EXECINSTR;
+	sh[SH_TEXT].sh_addralign = 16;
+	sh[SH_TEXT].sh_size = sects[AS_TEXT].len;
+	sh[SH_DATA].sh_type = SHT_PROGBITS;
+	sh[SH_DATA].sh_flags = SHF_ALLOC | SHF_WRITE;
+	sh[SH_DATA].sh_addralign = 16;
+	sh[SH_DATA].sh_size = sects[AS_DATA].len;
+	sh[SH_RODATA].sh_type = SHT_PROGBITS;
+	sh[SH_RODATA].sh_flags = SHF_ALLOC;
+	sh[SH_RODATA].sh_addralign = 1;
+	sh[SH_RODATA].sh_size = sects[AS_RODATA].len;
+	sh[SH_RELA_TEXT].sh_type = SHT_RELA;
+	sh[SH_RELA_TEXT].sh_flags = SHF_INFO_LINK;
+	sh[SH_RELA_TEXT].sh_link = SH_SYMTAB;
+	sh[SH_RELA_TEXT].sh_info = SH_TEXT;
+	sh[SH_RELA_TEXT].sh_addralign = 8;
+	sh[SH_RELA_TEXT].sh_entsize = sizeof(Elf64_Rela);
+	sh[SH_RELA_TEXT].sh_size = relatab.len;
+	sh[SH_SYMTAB].sh_type = SHT_SYMTAB;
+	sh[SH_SYMTAB].sh_link = SH_STRTAB;
+	sh[SH_SYMTAB].sh_info = nr_locals;
+	sh[SH_SYMTAB].sh_addralign = 8;
+	sh[SH_SYMTAB].sh_entsize = sizeof(Elf64_Sym);
+	sh[SH_SYMTAB].sh_size = symtab.len;
+	sh[SH_STRTAB].sh_type = SHT_STRTAB;
+	sh[SH_STRTAB].sh_addralign = 1;
+	sh[SH_STRTAB].sh_size = strtab.len;
+	sh[SH_NOTE_STACK].sh_type = SHT_PROGBITS;
+	sh[SH_NOTE_STACK].sh_addralign = 1;
+	sh[SH_SHSTRTAB].sh_type = SHT_STRTAB;
+	sh[SH_SHSTRTAB].sh_addralign = 1;
+	sh[SH_SHSTRTAB].sh_size = shstrtab.len;
+
+	off = sizeof(eh);
+	for (i = 1; i < NR_SH; i++) {
+		off = (off + sh[i].sh_addralign - 1) & ~(sh[i].sh_addralign - 1);
+		sh[i].sh_offset = off;
+		off += sh[i].sh_size;
+	}
+
+	memset(&eh, 0, sizeof(eh));
+	memcpy(eh.e_ident, ELFMAG, SELFMAG);
+	eh.e_ident[EI_CLASS] = ELFCLASS64;
+	eh.e_ident[EI_DATA] = ELFDATA2LSB;
+	eh.e_ident[EI_VERSION] = EV_CURRENT;
+	eh.e_ident[EI_OSABI] = ELFOSABI_SYSV;
+	eh.e_type = ET_REL;
+	eh.e_machine = EM_X86_64;
+	eh.e_version = EV_CURRENT;
+	eh.e_shoff = (off + 7) & ~7UL;
+	eh.e_ehsize = sizeof(eh);
+	eh.e_shentsize = sizeof(Elf64_Shdr);
+	eh.e_shnum = NR_SH;
+	eh.e_shstrndx = SH_SHSTRTAB;
+
+	out_write((char *)&eh, sizeof(eh));
+	off = sizeof(eh);
+	for (i = 1; i < NR_SH; i++) {
+		off = pad(off, sh[i].sh_addralign);
+		switch (i) {
+		case SH_TEXT:
+		case SH_DATA:
+		case SH_RODATA:
+			out_write(sects[i - SH_TEXT].data, sh[i].sh_size);
+			break;
+		case SH_RELA_TEXT:
+			out_write(relatab.data, relatab.len);
+			break;
+		case SH_SYMTAB:
+			out_write(symtab.data, symtab.len);
+			break;
+		case SH_STRTAB:
+			out_write(strtab.data, strtab.len);
+			break;
+		case SH_SHSTRTAB:
+			out_write(shstrtab.data, shstrtab.len);
+			break;
+		}
+		off += sh[i].sh_size;
+	}
+	pad(off, 8);
+	out_write((char *)sh, sizeof(sh));
+
+	free(symtab.data);
+	free(strtab.data);
+	free(shstrtab.data);
+	free(relatab.data);
+}
@@ -0,0 +1,432 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <limits.h>
+#include <err.h>
+
+#include "rcc.h"
+
+/*
+ * Constant folding and algebraic simplification on the AST of a function,
+ * before it is turned into IR. Arithmetic is done on longs with the same
+ * wraparound as the generated code. Sums and differences with constants
+ * are brought into the form s * x + k first, which takes care of x + 0,
+ * -(-x) and the (0 - x) - 1 the parser makes of ~x in one go. Expressions
+ * whose value is thrown away are folded as statements, so x++ there is
+ * just the assignment.
+ */
+
+static struct node *fold_expr(struct node *n);
+static struct node *fold_stmt(struct node *n);
+
+static struct node *
+new_const(long v, struct type *t)
+{
+	struct node *n;
+
+	n = arena_alloc(&ast_arena, sizeof(struct node));
+	n->op = N_CONSTANT;
+	n->val = v;
+	n->type = t ? t : type_base(4);
+	return (n);
+}
+
+static struct node *
+new_binary(int op, struct node *l, struct node *r, struct type *t)
+{
+	struct node *n;
+
+	n = arena_alloc(&ast_arena, sizeof(struct node));
+	n->op = op;
+	n->l = l;
+	n->r = r;
+	n->type = t;
+	return (n);
+}
+
+static int
+is_const(struct node *n, long v)
+{
+	return (n->op == N_CONSTANT && n->val == v);
+}
+
+/* Whether n can be dropped or evaluated out of order. */
+static int
+pure(struct node *n)
+{
+	switch (n->op) {
+	case N_CONSTANT:
+	case N_SYM:
+		return (1);
+	case N_ADD:
+	case N_SUB:
+	case N_MUL:
+	case N_OR:
+	case N_AND:
+	case N_XOR:
+	case N_EQ:
+	case N_NE:
+	case N_LT:
+	case N_LE:
+	case N_GT:
+	case N_GE:
+	case N_LOR:
+	case N_LAND:
+		return (pure(n->l) && pure(n->r));
+	case N_DIV:
+	case N_MOD:
+		return (n->r->op == N_CONSTANT && n->r->val != 0 &&
+		    pure(n->l));
+	case N_NOT:
+	case N_DEREF:
+	case N_FIELD:
+	case N_ADDR:
+		return (pure(n->l));
+	default:
+		return (0);
+	}
+}
+
+static int
+fold_binary(int op, long a, long b, long *c)
+{
+	unsigned long ua, ub;
+
+	ua = a;
+	ub = b;
+	switch (op) {
+	case N_ADD:
+		*c = ua + ub;
+		break;
+	case N_SUB:
+		*c = ua - ub;
+		break;
+	case N_MUL:
+		*c = ua * ub;
+		break;
+	case N_DIV:
+		if (b == 0 || (a == LONG_MIN && b == -1))
+			return (0);
+		*c = a / b;
+		break;
+	case N_MOD:
+		if (b == 0 || (a == LONG_MIN && b == -1))
+			return (0);
+		*c = a % b;
+		break;
+	case N_OR:
+		*c = a | b;
+		break;
+	case N_AND:
+		*c = a & b;
+		break;
+	case N_XOR:
+		*c = a ^ b;
+		break;
+	case N_EQ:
+		*c = a == b;
+		break;
+	case N_NE:
+		*c = a != b;
+		break;
+	case N_LT:
+		*c = a < b;
+		break;
+	case N_LE:
+		*c = a <= b;
+		break;
+	case N_GT:
+		*c = a > b;
+		break;
+	case N_GE:
+		*c = a >= b;
+		break;
+	default:
+		return (0);
+	}
+	return (1);
+}
+
+static int
+is_ptr(struct node *n)
+{
+	return (n->type && n->type->ptr);
+}
+
+/*
+ * Take a sum of integers apart into sign * x + k, where x is the one
+ * operand that isn't a constant, or NULL if there is none. Returns how
+ * many constants went into k.
+ */
+static int
+linear(struct node *n, struct node **x, int *sign, long *k)
+{
+	int nr;
+
+	if (n->op == N_CONSTANT) {
+		*x = NULL;
+		*sign = 0;
+		*k = n->val;
+		return (1);
+	}
+	if ((n->op != N_ADD && n->op != N_SUB) || is_ptr(n) || is_ptr(n->l) ||
+	    is_ptr(n->r) || (n->l->op != N_CONSTANT &&
+	    n->r->op != N_CONSTANT)) {
+		*x = n;
+		*sign = 1;
+		*k = 0;
+		return (0);
+	}
+	if (n->r->op == N_CONSTANT) {
+		nr = linear(n->l, x, sign, k) + 1;
+		*k = n->op == N_ADD ? (unsigned long)*k + n->r->val :
+		    (unsigned long)*k - n->r->val;
+		return (nr);
+	}
+	nr = linear(n->r, x, sign, k) + 1;
+	if (n->op == N_SUB) {
+		*sign = -*sign;
+		*k = (unsigned long)n->l->val - *k;
+	} else
+		*k = (unsigned long)*k + n->l->val;
+	return (nr);
+}
+
+static struct node *
+fold_sum(struct node *n)
+{
+	struct node *x;
+	long k;
+	int sign;
+
+	if (linear(n, &x, &sign, &k) < 2 && !is_const(n->r, 0) &&
+	    !(n->op == N_ADD && is_const(n->l, 0)) &&
+	    !(n->op == N_SUB && n->r->op == N_SUB && is_const(n->r->l, 0)))
+		return (n);
+	if (x == NULL)
+		return (new_const(k, n->type));
+	if (sign == 1)
+		return (k ? new_binary(N_ADD, x, new_const(k, NULL), n->type) :
+		    x);
+	return (new_binary(N_SUB, new_const(k, NULL), x, n->type));
+}
+
+static struct node *
+fold_logical(struct node *n)
+{
+	struct node *x;
+	long c;
+	int land;
+
+	land = n->op == N_LAND;
+	if (n->l->op == N_CONSTANT) {
+		c = n->l->val != 0;
+		x = n->r;
+	} else if (n->r->op == N_CONSTANT && pure(n->l)) {
+		c = n->r->val != 0;
+		x = n->l;
+	} else
+		return (n);
+	/* 0 && x and 1 || x are decided, otherwise it's just x != 0. */
+	if (c != land)
+		return (new_const(c, n->type));
+	if (x->op == N_CONSTANT)
+		return (new_const(x->val != 0, n->type));
+	return (new_binary(N_NE, x, new_const(0, NULL), n->type));
+}
+
+static struct node *
+fold_expr(struct node *n)
+{
+	struct param *p;
+	long c;
+
+	switch (n->op) {
+	case N_ADD:
+	case N_SUB:
+	case N_MUL:
+	case N_DIV:
+	case N_MOD:
+	case N_OR:
+	case N_AND:
+	case N_XOR:
+	case N_EQ:
+	case N_NE:
+	case N_LT:
+	case N_LE:
+	case N_GT:
+	case N_GE:
+		n->l = fold_expr(n->l);
+		n->r = fold_expr(n->r);
+		if (n->l->op == N_CONSTANT && n->r->op == N_CONSTANT &&
+		    !is_ptr(n->l) && !is_ptr(n->r) &&
+		    fold_binary(n->op, n->l->val, n->r->val, &c))
+			return (new_const(c, n->type));
+		switch (n->op) {
+		case N_ADD:
+		case N_SUB:
+			return (fold_sum(n));
+		case N_MUL:
+			if (is_const(n->r, 1))
+				return (n->l);
+			if (is_const(n->l, 1))
+				return (n->r);
+			if ((is_const(n->r, 0) && pure(n->l)) ||
+			    (is_const(n->l, 0) && pure(n->r)))
+				return (new_const(0, n->type));
+			break;
+		case N_DIV:
+			if (is_const(n->r, 1))
+				return (n->l);
+			break;
+		case N_MOD:
+			if (is_const(n->r, 1) && pure(n->l))
+				return (new_const(0, n->type));
+			break;
+		case N_AND:
+			if ((is_const(n->r, 0) && pure(n->l)) ||
+			    (is_const(n->l, 0) && pure(n->r)))
+				return (new_const(0, n->type));
+			if (is_const(n->r, -1))
+				return (n->l);
+			if (is_const(n->l, -1))
+				return (n->r);
+			break;
+		case N_OR:
+		case N_XOR:
+			if (is_const(n->r, 0))
+				return (n->l);
+			if (is_const(n->l, 0))
+				return (n->r);
+			break;
+		}
+		return (n);
+	case N_LOR:
+	case N_LAND:
+		n->l = fold_expr(n->l);
+		n->r = fold_expr(n->r);
+		return (fold_logical(n));
+	case N_NOT:
+		n->l = fold_expr(n->l);
+		if (n->l->op == N_CONSTANT)
+			return (new_const(!n->l->val, n->type));
+		return (n);
+	case N_DEREF:
+	case N_FIELD:
+		n->l = fold_expr(n->l);
+		return (n);
+	case N_ASSIGN:
+		if (n->l->op != N_SYM)
+			n->l = fold_expr(n->l);
+		n->r = fold_expr(n->r);
+		return (n);
+	case N_CALL:
+		for (p = n->params; p; p = p->next)
+			p->n = fold_expr(p->n);
+		return (n);
+	case N_COMMA:
+		/* The value of a comma is its left operand here, see x++. */
+		n->l = fold_expr(n->l);
+		n->r = fold_stmt(n->r);
+		if (n->r->op == N_NOP)
+			return (n->l);
+		return (n);
+	default:
+		return (n);
+	}
+}
+
+static struct node *
+nop(void)
+{
+	struct node *n;
+
+	n = arena_alloc(&ast_arena, sizeof(struct node));
+	n->op = N_NOP;
+	return (n);
+}
+
+/* A list of statements; the ones that fold to nothing are left out. */
+static struct node *
+fold_list(struct node *n)
+{
+	struct node *head, **tailp, *next, *s;
+
+	head = NULL;
+	tailp = &head;
+	for (; n; n = next) {
+		next = n->next;
+		s = fold_stmt(n);
+		if (s->op == N_NOP)
+			continue;
+		s->next = NULL;
+		*tailp = s;
+		tailp = &s->next;
+	}
+	return (head);
+}
+
+static struct node *
+fold_stmt(struct node *n)
+{
+	if (n == NULL)
+		return (nop());
+
+	switch (n->op) {
+	case N_MULTIPLE:
+		if ((n->l = fold_list(n->l)) == NULL)
+			return (nop());
+		if (n->l->next == NULL)
+			return (n->l);
+		return (n);
+	case N_IF:
+		n->cond = fold_expr(n->cond);
+		if (n->cond->op == N_CONSTANT)
+			return (fold_stmt(n->cond->val ? n->l : n->r));
+		n->l = fold_stmt(n->l);
+		if (n->r)
+			n->r = fold_stmt(n->r);
+		return (n);
+	case N_FOR:
+		n->pre = fold_stmt(n->pre);
+		n->cond = fold_expr(n->cond);
+		if (is_const(n->cond, 0))
+			return (n->pre);
+		n->l = fold_stmt(n->l);
+		n->post = fold_stmt(n->post);
+		return (n);
+	case N_WHILE:
+		n->cond = fold_expr(n->cond);
+		if (is_const(n->cond, 0))
+			return (nop());
+		n->l = fold_stmt(n->l);
+		return (n);
+	case N_DO:
+		n->l = fold_stmt(n->l);
+		n->cond = fold_expr(n->cond);
+		return (n);
+	case N_RETURN:
+		if (n->l)
+			n->l = fold_expr(n->l);
+		return (n);
+	case N_GOTO:
+	case N_NOP:
+		return (n);
+	case N_COMMA:
+		n->l = fold_stmt(n->l);
+		n->r = fold_stmt(n->r);
+		if (n->l->op == N_NOP)
+			return (n->r);
+		if (n->r->op == N_NOP)
+			return (n->l);
+		return (n);
+	default:
+		n = fold_expr(n);
+		return (pure(n) ? nop() : n);
+	}
+}
+
+void
+fold_func(struct symbol *s)
+{
+	s->body = fold_stmt(s->body);
+}
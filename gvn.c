@@ -0,0 +1,370 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <err.h>
+
+#include "rcc.h"
+
+/*
+ * Dominator-based value numbering (Briggs, Cooper and Simpson) on the SSA
+ * form. The blocks are walked down the dominator tree with a scoped table
+ * of the expressions computed so far; an instruction that computes one of
+ * them again has its result replaced by the earlier register everywhere
+ * and is left for dead_code(). Copies are replaced by what they copy; one
+ * that narrows is numbered along with its width.
+ *
+ * Constants, addresses of globals and arithmetic that only ever ends up in
+ * an address are cheaper to compute again than to keep in a register, and
+ * isel() takes the latter into the addressing modes of the loads and
+ * stores that use them. Those get a value number, so that what is computed
+ * from them can still be found again, but are left where they are.
+ *
+ * Loads are keyed on a memory version as well, which every store and call
+ * moves on. A block keeps the version of its idom only when that is its
+ * single predecessor; otherwise memory could have changed on the way in.
+ * A store of a whole word leaves its value to be found by a later load of
+ * the same address.
+ */
+
+struct vn {
+	struct vn *next;
+	int op;
+	long o1;
+	long o2;
+	int mem;
+	long reg;
+};
+
+static struct cfg *cfg;
+static long *repl;			/* by register, itself if not replaced */
+static long *val;			/* by register, its value number */
+static char *addr_only;			/* by register */
+static struct vn **table;
+static unsigned int table_mask;
+static int *exit_mem;			/* memory version at the end of a block */
+static int nr_mems;
+
+static unsigned int *undo_log;
+static int nr_undo, max_undo;
+
+static unsigned int
+hash(int op, long o1, long o2, int mem)
+{
+	unsigned long h;
+
+	h = op;
+	h = h * 31 + o1;
+	h = h * 31 + o2;
+	h = h * 31 + mem;
+	return ((h ^ (h >> 17)) & table_mask);
+}
+
+static long
+lookup(int op, long o1, long o2, int mem)
+{
+	struct vn *v;
+
+	for (v = table[hash(op, o1, o2, mem)]; v; v = v->next)
+		if (v->op == op && v->o1 == o1 && v->o2 == o2 && v->mem == mem)
+			return (v->reg);
+	return (-1);
+}
+
+static void
+insert(int op, long o1, long o2, int mem, long reg)
+{
+	struct vn *v;
+	unsigned int h;
+
+	h = hash(op, o1, o2, mem);
+	v = arena_alloc(&ir_arena, sizeof(struct vn));
+	v->op = op;
+	v->o1 = o1;
+	v->o2 = o2;
+	v->mem = mem;
+	v->reg = reg;
+	v->next = table[h];
+	table[h] = v;
+	if (nr_undo == max_undo) {
+		max_undo = max_undo ? max_undo * 2 : 256;
+		if ((undo_log = realloc(undo_log, max_undo *
+		    sizeof(unsigned int))) == NULL)
+			err(1, "realloc");
+	}
+	undo_log[nr_undo++] = h;
+}
+
+static void
+rename_uses(struct ir *ir)
+{
+	long *u[MAX_IR_USES];
+	int i, k;
+
+	k = ir_uses(ir, u);
+	for (i = 0; i < k; i++)
+		*u[i] = repl[*u[i]];
+	for (i = 0; i < ir->nr_args; i++)
+		ir->args[i] = repl[ir->args[i]];
+}
+
+static int
+commutes(int op)
+{
+	switch (op) {
+	case IR_ADD:
+	case IR_MUL:
+	case IR_MULH:
+	case IR_AND:
+	case IR_OR:
+	case IR_XOR:
+	case IR_EQ:
+	case IR_NE:
+		return (1);
+	default:
+		return (0);
+	}
+}
+
+/* Whether ir computes its result from its operands and memory alone. */
+static int
+pure(int op)
+{
+	switch (op) {
+	case IR_ADD:
+	case IR_SUB:
+	case IR_MUL:
+	case IR_DIV:
+	case IR_MOD:
+	case IR_MULH:
+	case IR_SHL:
+	case IR_SHR:
+	case IR_SAR:
+	case IR_NOT:
+	case IR_OR:
+	case IR_AND:
+	case IR_XOR:
+	case IR_EQ:
+	case IR_NE:
+	case IR_LT:
+	case IR_LE:
+	case IR_GT:
+	case IR_GE:
+	case IR_LOADI:
+	case IR_LOADG:
+	case IR_LOAD:
+	case IR_LOAD32:
+	case IR_LOAD8:
+	case IR_LOADO:
+	case IR_LOADO32:
+	case IR_LOADO8:
+	case IR_MOV:
+		return (1);
+	default:
+		return (0);
+	}
+}
+
+static int
+reads_memory(int op)
+{
+	return (op >= IR_LOAD && op <= IR_LOADO8);
+}
+
+static int
+address_arith(int op)
+{
+	return (op == IR_ADD || op == IR_MUL || op == IR_SHL);
+}
+
+/* Whether the operand at u of ir is used as (part of) an address. */
+static int
+in_address(struct ir *ir, long *u)
+{
+	switch (ir->op) {
+	case IR_LOAD:
+	case IR_LOAD32:
+	case IR_LOAD8:
+	case IR_LOADO:
+	case IR_LOADO32:
+	case IR_LOADO8:
+		return (1);
+	case IR_STORE:
+	case IR_STORE32:
+	case IR_STORE8:
+		return (u != &ir->o1);
+	default:
+		return (address_arith(ir->op) && addr_only[ir->dst]);
+	}
+}
+
+/*
+ * By register, whether it is an ADD, MUL or SHL that only feeds
+ * addresses, which isel() can take into the loads and stores using them.
+ */
+char *
+find_addresses(struct cfg *_cfg)
+{
+	struct block *b;
+	struct ir *ir;
+	long *u[MAX_IR_USES];
+	int changed, i, j, k;
+
+	cfg = _cfg;
+	addr_only = arena_alloc(&ir_arena, ir_nr_regs());
+	for (i = 0; i < cfg->nr_blocks; i++) {
+		b = &cfg->blocks[i];
+		if (b->dead)
+			continue;
+		for (ir = b->head;; ir = ir->next) {
+			if (address_arith(ir->op))
+				addr_only[ir->dst] = 1;
+			if (ir == b->tail)
+				break;
+		}
+	}
+	do {
+		changed = 0;
+		for (i = 0; i < cfg->nr_blocks; i++) {
+			b = &cfg->blocks[i];
+			if (b->dead)
+				continue;
+			for (ir = b->head;; ir = ir->next) {
+				k = ir_uses(ir, u);
+				for (j = 0; j < k; j++)
+					if (addr_only[*u[j]] &&
+					    !in_address(ir, u[j])) {
+						addr_only[*u[j]] = 0;
+						changed = 1;
+					}
+				for (j = 0; j < ir->nr_args; j++)
+					addr_only[ir->args[j]] = 0;
+				if (ir == b->tail)
+					break;
+			}
+		}
+	} while (changed);
+	return (addr_only);
+}
+
+static void
+number(struct ir *ir, int mem)
+{
+	long o1, o2, r, t;
+
+	o1 = ir->o1;
+	o2 = ir->o2;
+	switch (ir->op) {
+	case IR_LOADI:
+	case IR_LOADG:
+		o2 = 0;
+		break;
+	case IR_NOT:
+	case IR_LOAD:
+	case IR_LOAD32:
+	case IR_LOAD8:
+		o1 = val[o1];
+		o2 = 0;
+		break;
+	case IR_MOV:
+		o1 = val[o1];
+		break;
+	default:
+		o1 = val[o1];
+		o2 = val[o2];
+		break;
+	}
+	if (commutes(ir->op) && o1 > o2) {
+		t = o1;
+		o1 = o2;
+		o2 = t;
+	}
+	if (!reads_memory(ir->op))
+		mem = 0;
+	if ((r = lookup(ir->op, o1, o2, mem)) == -1)
+		insert(ir->op, o1, o2, mem, ir->dst);
+	else if (ir->op == IR_LOADI || ir->op == IR_LOADG ||
+	    addr_only[ir->dst])
+		val[ir->dst] = r;
+	else
+		repl[ir->dst] = r;
+}
+
+static void
+visit(int i)
+{
+	struct block *b;
+	struct ir *ir;
+	int j, mark, mem;
+
+	b = &cfg->blocks[i];
+	mark = nr_undo;
+	if (i && b->nr_preds == 1 && b->preds[0] == b->idom)
+		mem = exit_mem[b->idom];
+	else
+		mem = ++nr_mems;
+	for (ir = b->head;; ir = ir->next) {
+		if (ir->op != IR_PHI)
+			rename_uses(ir);
+		if (ir->op == IR_MOV && ir->o2 == 0)
+			repl[ir->dst] = ir->o1;
+		else if (pure(ir->op))
+			number(ir, mem);
+		else if (ir->op == IR_STORE || ir->op == IR_STORE32 ||
+		    ir->op == IR_STORE8 || ir->op == IR_CALL) {
+			mem = ++nr_mems;
+			if (ir->op == IR_STORE)
+				insert(IR_LOAD, val[ir->dst], 0, mem, ir->o1);
+		}
+		if (ir == b->tail)
+			break;
+	}
+	exit_mem[i] = mem;
+
+	for (j = cfg->dom_kids_start[i]; j < cfg->dom_kids_start[i + 1]; j++)
+		if (!cfg->blocks[cfg->dom_kids[j]].dead)
+			visit(cfg->dom_kids[j]);
+
+	while (nr_undo > mark) {
+		nr_undo--;
+		table[undo_log[nr_undo]] = table[undo_log[nr_undo]]->next;
+	}
+}
+
+void
+value_number(struct cfg *_cfg)
+{
+	struct block *b;
+	struct ir *ir;
+	unsigned int size;
+	int i, n;
+
+	cfg = _cfg;
+	n = ir_nr_regs();
+	repl = arena_alloc(&ir_arena, n * sizeof(long));
+	val = arena_alloc(&ir_arena, n * sizeof(long));
+	for (i = 0; i < n; i++)
+		repl[i] = val[i] = i;
+	for (size = 64; size < 2 * n; size *= 2)
+		;
+	table = arena_alloc(&ir_arena, size * sizeof(struct vn *));
+	table_mask = size - 1;
+	exit_mem = arena_alloc(&ir_arena, cfg->nr_blocks * sizeof(int));
+	nr_mems = 0;
+	nr_undo = 0;
+
+	find_addresses(cfg);
+	cfg_dominators(cfg);
+	visit(0);
+
+	/* PHI args can come from further down the tree. */
+	for (i = 0; i < cfg->nr_blocks; i++) {
+		b = &cfg->blocks[i];
+		if (b->dead)
+			continue;
+		for (ir = b->head;; ir = ir->next) {
+			rename_uses(ir);
+			if (ir == b->tail)
+				break;
+		}
+	}
+}
@@ -0,0 +1,169 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <limits.h>
+#include <err.h>
+
+#include "rcc.h"
+
+/*
+ * Which calls gen_ir() expands in place of an IR_CALL. A call saves every
+ * live register and moves its arguments around, so a callee whose body is
+ * about as big as that, counted in AST nodes, is taken; each constant
+ * argument raises the limit, since sccp() will fold what it feeds. Calls
+ * in the callee count as a call's worth, as they stay calls.
+ *
+ * A function is never expanded inside itself, however indirectly, nor
+ * further than MAX_INLINE_DEPTH calls deep, and what a function grows by
+ * is bounded. With -finline-report every decision on a call to a function
+ * with a body is printed; -fno-inline turns expansion off.
+ */
+
+#define	CALL_COST	12
+#define	CONST_ARG_BONUS	4
+#define	MAX_INLINE_DEPTH 4
+#define	MAX_GROWTH	200
+
+int inline_funcs = 1;
+int inline_report;
+
+static struct symbol *stack[MAX_INLINE_DEPTH + 1];
+static int depth;
+static int growth;
+static int lbl_lo, lbl_hi;
+
+/* Also finds the range of the loop labels parse() gave the body. */
+static int
+size(struct node *n)
+{
+	struct param *p;
+	int k;
+
+	if (n == NULL)
+		return (0);
+	switch (n->op) {
+	case N_NOP:
+		return (0);
+	case N_CONSTANT:
+	case N_SYM:
+	case N_GOTO:
+		return (1);
+	case N_FIELD:
+		return (1 + size(n->l));
+	case N_CALL:
+		for (k = CALL_COST, p = n->params; p; p = p->next)
+			k += size(p->n);
+		return (k);
+	case N_MULTIPLE:
+		for (k = 1, n = n->l; n; n = n->next)
+			k += size(n);
+		return (k);
+	case N_IF:
+		return (1 + size(n->cond) + size(n->l) + size(n->r));
+	case N_FOR:
+	case N_WHILE:
+	case N_DO:
+		if (lbl_lo > n->break_lbl)
+			lbl_lo = n->break_lbl;
+		if (lbl_lo > n->cont_lbl)
+			lbl_lo = n->cont_lbl;
+		if (lbl_hi <= n->break_lbl)
+			lbl_hi = n->break_lbl + 1;
+		if (lbl_hi <= n->cont_lbl)
+			lbl_hi = n->cont_lbl + 1;
+		return (1 + size(n->cond) + size(n->l) + size(n->pre) +
+		    size(n->post));
+	default:
+		return (1 + size(n->l) + size(n->r));
+	}
+}
+
+static char *
+refuse(struct node *call, struct symbol *f)
+{
+	struct param *a, *p;
+	int i;
+
+	for (i = 0; i <= depth; i++)
+		if (stack[i] == f)
+			return ("recursive");
+	if (depth == MAX_INLINE_DEPTH)
+		return ("too deep");
+	for (a = call->params, p = f->params; a && p; a = a->next, p = p->next)
+		if (p->sym->type->array || p->sym->type->_struct)
+			return ("aggregate parameter");
+	if (a || p)
+		return ("argument count");
+	return (NULL);
+}
+
+static void
+report(struct symbol *f, char *fmt, ...)
+{
+	va_list ap;
+
+	if (!inline_report)
+		return;
+	fprintf(stderr, "%s: ", stack[0]->name);
+	va_start(ap, fmt);
+	vfprintf(stderr, fmt, ap);
+	va_end(ap);
+	fprintf(stderr, " (%s into %s)\n", f->name, stack[depth]->name);
+}
+
+void
+inline_begin(struct symbol *s)
+{
+	stack[0] = s;
+	depth = growth = 0;
+}
+
+/*
+ * Whether to expand call here. If so the callee's loop labels are in
+ * [*lo, *hi), and inline_end() must follow its body.
+ */
+int
+inline_call(struct node *call, int *lo, int *hi)
+{
+	struct symbol *f;
+	struct param *a;
+	char *why;
+	int k, limit;
+
+	f = call->l->sym;
+	if (!inline_funcs || f->body == NULL)
+		return (0);
+	if ((why = refuse(call, f)) != NULL) {
+		report(f, "not inlined, %s", why);
+		return (0);
+	}
+
+	limit = CALL_COST;
+	for (a = call->params; a; a = a->next)
+		if (a->n->op == N_CONSTANT)
+			limit += CONST_ARG_BONUS;
+	lbl_lo = INT_MAX;
+	lbl_hi = 0;
+	k = size(f->body);
+	if (k > limit) {
+		report(f, "not inlined, size %d over %d", k, limit);
+		return (0);
+	}
+	if (growth + k > MAX_GROWTH) {
+		report(f, "not inlined, grown by %d already", growth);
+		return (0);
+	}
+	report(f, "inlined, size %d of %d", k, limit);
+	growth += k;
+	stack[++depth] = f;
+	*lo = lbl_lo < lbl_hi ? lbl_lo : 0;
+	*hi = lbl_lo < lbl_hi ? lbl_hi : 0;
+	return (1);
+}
+
+void
+inline_end(void)
+{
+	depth--;
+}
@@ -0,0 +1,72 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <err.h>
+
+#include "rcc.h"
+
+/*
+ * Identifier interning. Every distinct name is stored once, preceded by
+ * its hash, so names can be compared by pointer and hashed for free by
+ * the symbol tables.
+ */
+
+#define	HASHSTEP(x, c) (((x << 5) + x) + (c))
+#define	INTERN_INIT_SIZE 4096
+
+static struct arena atom_arena;
+static struct atom **atoms;
+static unsigned int atoms_size;
+static unsigned int nr_atoms;
+
+static void
+intern_grow(void)
+{
+	struct atom **old, *a;
+	unsigned int i, j, old_size;
+
+	old = atoms;
+	old_size = atoms_size;
+	atoms_size = old_size ? old_size * 2 : INTERN_INIT_SIZE;
+	if ((atoms = calloc(atoms_size, sizeof(struct atom *))) == NULL)
+		err(1, "calloc");
+
+	for (i = 0; i < old_size; i++) {
+		if ((a = old[i]) == NULL)
+			continue;
+		for (j = a->hash & (atoms_size - 1); atoms[j];
+		    j = (j + 1) & (atoms_size - 1))
+			;
+		atoms[j] = a;
+	}
+	free(old);
+}
+
+char *
+intern(const char *s, size_t len)
+{
+	struct atom *a;
+	unsigned int hash, i;
+	size_t n;
+
+	hash = 0;
+	for (n = 0; n < len; n++)
+		hash = HASHSTEP(hash, s[n]);
+
+	if (2 * (nr_atoms + 1) > atoms_size)
+		intern_grow();
+
+	for (i = hash & (atoms_size - 1); (a = atoms[i]) != NULL;
+	    i = (i + 1) & (atoms_size - 1))
+		if (a->hash == hash && a->len == len && !memcmp(a->str, s, len))
+			return (a->str);
+
+	a = arena_alloc(&atom_arena, sizeof(struct atom) + len + 1);
+	a->hash = hash;
+	a->len = len;
+	memcpy(a->str, s, len);
+	atoms[i] = a;
+	nr_atoms++;
+
+	return (a->str);
+}
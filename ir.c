@@ -11,15 +11,26 @@ static struct ir *last_ir;
 
 static int gen_ir_op(struct node *n);
 
+/* The size is computed once, when the canonical type is built. */
 static int
 _sizeof(struct type *t)
 {
-	if (t->array)
-		return (_sizeof(t->ptr) * t->size);
-	else if (t->ptr)
-		return (8);
-	else
-		return (t->size);
+	return (t->stacksize);
+}
+
+/* An instruction that isn't linked anywhere yet. */
+struct ir *
+ir_alloc(int op, long o1, long o2, long dst)
+{
+	struct ir *ir;
+
+	ir = arena_alloc(&ir_arena, sizeof(struct ir));
+	ir->op = op;
+	ir->o1 = o1;
+	ir->o2 = o2;
+	ir->dst = dst;
+
+	return (ir);
 }
 
 static struct ir *
@@ -27,23 +38,16 @@ new_ir(int op, long o1, long o2, long dst)
 {
 	struct ir *ir;
 
-	ir = malloc(sizeof(struct ir));
-	memset(ir, 0, sizeof(struct ir));
+	ir = ir_alloc(op, o1, o2, dst);
 	if (!head_ir)
 		head_ir = ir;
 	if (last_ir)
 		last_ir->next = ir;
 	last_ir = ir;
-	ir->op = op;
-	ir->o1 = o1;
-	ir->o2 = o2;
-	ir->dst = dst;
 
 	return (ir);
 }
 
-/* IR register 0 is pointer to AR. */
-#define	RARP 0
 static int cur_reg = 1;
 
 static int
@@ -52,6 +56,88 @@ alloc_reg(void)
 	return cur_reg++;
 }
 
+/* The passes allocate from the same numbering as gen_ir() did. */
+int
+ir_new_reg(void)
+{
+	return (alloc_reg());
+}
+
+int
+ir_nr_regs(void)
+{
+	return (cur_reg);
+}
+
+/*
+ * When optimising, scalar locals and parameters that never have their
+ * address taken are kept in an IR register instead of the AR: reads copy
+ * it out and assignments copy into it, which SSA construction later folds
+ * away. A parameter's register is set from where it was passed by an ARG
+ * right after the ENTER.
+ */
+static int promote;
+static int promote_gen;
+static int nr_gens;
+
+static int
+promoted(struct symbol *s)
+{
+	if (!promote || s->global || s->addr_taken ||
+	    s->type->array || s->type->_struct)
+		return (0);
+	if (s->reg_gen != promote_gen) {
+		s->reg = alloc_reg();
+		s->reg_gen = promote_gen;
+	}
+	return (1);
+}
+
+/*
+ * A call inline_call() takes is expanded in place: the arguments are
+ * evaluated as for a call and then bound to the parameters, whose
+ * registers come from a promotion generation of their own. The callee's
+ * locals go in the caller's frame past everything in use there, its loop
+ * labels are renumbered, and a return becomes a copy into the call's
+ * register and a jump past the body.
+ */
+struct inlined {
+	int base;			/* of the callee's locals in the frame */
+	int top;
+	int lbl_lo;			/* the callee's labels, [lo, hi) */
+	int lbl_hi;
+	int lbl_base;			/* where lbl_lo went */
+	int ret_reg;			/* -1 if not inlining */
+	int ret_lbl;
+};
+
+static struct inlined inl;
+static int frame_size;
+
+static int
+local_off(struct symbol *s)
+{
+	return (s->loc + inl.base);
+}
+
+static int
+label(long l)
+{
+	if (l >= inl.lbl_lo && l < inl.lbl_hi)
+		return (l - inl.lbl_lo + inl.lbl_base);
+	return (l);
+}
+
+/* Narrow copies zero-extend, like LOAD32 and LOAD8. */
+static int
+mov_size(struct type *t)
+{
+	int size;
+
+	size = _sizeof(t);
+	return (size == 1 || size == 4 ? size : 0);
+}
+
 static void
 ir_load(long o1, long dst, int size)
 {
@@ -93,36 +179,76 @@ ir_store(long o1, long dst, int size)
 {
 	switch (size) {
 	case 8:
-		new_ir(IR_STORE, o1, 0, dst);
+		new_ir(IR_STORE, o1, -1, dst);
 		break;
 	case 4:
-		new_ir(IR_STORE32, o1, 0, dst);
+		new_ir(IR_STORE32, o1, -1, dst);
 		break;
 	case 1:
-		new_ir(IR_STORE8, o1, 0, dst);
+		new_ir(IR_STORE8, o1, -1, dst);
 		break;
 	default:
 		errx(1, "Invalid store size %d", size);
 	}
 }
 
+/* Statements discard their value, so release it here. */
+static void
+gen_stmt(struct node *n)
+{
+	int r;
+
+	if ((r = gen_ir_op(n)) != -1)
+		new_ir(IR_KILL, r, 0, 0);
+}
+
+/*
+ * Jump to t if n is true and to f if not. The operands of && and || and
+ * of ! branch straight to where their value decides, so a condition is
+ * never turned into 0 or 1 only to be tested again.
+ */
+static void
+gen_branch(struct node *n, int t, int f)
+{
+	int cond, next;
+
+	switch (n->op) {
+	case N_LOR:
+		next = new_label();
+		gen_branch(n->l, t, next);
+		new_ir(IR_LABEL, next, 0, 0);
+		gen_branch(n->r, t, f);
+		return;
+	case N_LAND:
+		next = new_label();
+		gen_branch(n->l, next, f);
+		new_ir(IR_LABEL, next, 0, 0);
+		gen_branch(n->r, t, f);
+		return;
+	case N_NOT:
+		gen_branch(n->l, f, t);
+		return;
+	}
+	cond = gen_ir_op(n);
+	new_ir(IR_CBR, cond, t, f);
+	new_ir(IR_KILL, cond, 0, 0);
+}
+
 static int
 gen_if(struct node *n)
 {
-	int cond, else_lbl, if_lbl, out_lbl;
+	int else_lbl, if_lbl, out_lbl;
 
-	cond = gen_ir_op(n->cond);
 	if_lbl = new_label();
 	else_lbl = new_label();
 	out_lbl = new_label();
-	new_ir(IR_CBR, cond, if_lbl, else_lbl);
-	new_ir(IR_KILL, cond, 0, 0);
+	gen_branch(n->cond, if_lbl, else_lbl);
 	new_ir(IR_LABEL, if_lbl, 0, 0);
-	gen_ir_op(n->l);
+	gen_stmt(n->l);
 	new_ir(IR_JUMP, 0, 0, out_lbl);
 	new_ir(IR_LABEL, else_lbl, 0, 0);
 	if (n->r)
-		gen_ir_op(n->r);
+		gen_stmt(n->r);
 	new_ir(IR_LABEL, out_lbl, 0, 0);
 
 	return (-1);
@@ -131,21 +257,19 @@ gen_if(struct node *n)
 static int
 gen_for(struct node *n)
 {
-	int cond, start, in, next, out;
+	int start, in, next, out;
 
 	start = new_label();
 	in = new_label();
-	out = n->break_lbl;
-	next = n->cont_lbl;
-	gen_ir_op(n->pre);
+	out = label(n->break_lbl);
+	next = label(n->cont_lbl);
+	gen_stmt(n->pre);
 	new_ir(IR_LABEL, start, 0, 0);
-	cond = gen_ir_op(n->cond);
-	new_ir(IR_CBR, cond, in, out);
-	new_ir(IR_KILL, cond, 0, 0);
+	gen_branch(n->cond, in, out);
 	new_ir(IR_LABEL, in, 0, 0);
-	gen_ir_op(n->l);
+	gen_stmt(n->l);
 	new_ir(IR_LABEL, next, 0, 0);
-	gen_ir_op(n->post);
+	gen_stmt(n->post);
 	new_ir(IR_JUMP, 0, 0, start);
 	new_ir(IR_LABEL, out, 0, 0);
 
@@ -155,17 +279,15 @@ gen_for(struct node *n)
 static int
 gen_do(struct node *n)
 {
-	int cond, start, next, out;
+	int start, next, out;
 
 	start = new_label();
-	out = n->break_lbl;
-	next = n->cont_lbl;
+	out = label(n->break_lbl);
+	next = label(n->cont_lbl);
 	new_ir(IR_LABEL, start, 0, 0);
-	gen_ir_op(n->l);
+	gen_stmt(n->l);
 	new_ir(IR_LABEL, next, 0, 0);
-	cond = gen_ir_op(n->cond);
-	new_ir(IR_CBR, cond, start, out);
-	new_ir(IR_KILL, cond, 0, 0);
+	gen_branch(n->cond, start, out);
 	new_ir(IR_LABEL, out, 0, 0);
 	return (-1);
 }
@@ -173,68 +295,33 @@ gen_do(struct node *n)
 static int
 gen_while(struct node *n)
 {
-	int cond, start, in, out;
+	int start, in, out;
 
-	start = n->cont_lbl;
+	start = label(n->cont_lbl);
 	in = new_label();
-	out = n->break_lbl;
+	out = label(n->break_lbl);
 	new_ir(IR_LABEL, start, 0, 0);
-	cond = gen_ir_op(n->cond);
-	new_ir(IR_CBR, cond, in, out);
-	new_ir(IR_KILL, cond, 0, 0);
+	gen_branch(n->cond, in, out);
 	new_ir(IR_LABEL, in, 0, 0);
-	gen_ir_op(n->l);
+	gen_stmt(n->l);
 	new_ir(IR_JUMP, 0, 0, start);
 	new_ir(IR_LABEL, out, 0, 0);
 
 	return (-1);
 }
 
+/* && and || only compute their value where it's asked for. */
 static int
-gen_lor(struct node *n)
+gen_logical(struct node *n)
 {
-	int dst, f, l, next, out, r, t;
+	int dst, f, out, t;
 
 	dst = alloc_reg();
-	next = new_label();
 	out = new_label();
 	t = new_label();
 	f = new_label();
 
-	l = gen_ir_op(n->l);
-	new_ir(IR_CBR, l, t, next);
-	new_ir(IR_LABEL, next, 0, 0);
-	r = gen_ir_op(n->r);
-	new_ir(IR_CBR, r, t, f);
-	new_ir(IR_LABEL, f, 0, 0);
-	new_ir(IR_LOADI, 0, 0, dst);
-	new_ir(IR_JUMP, 0, 0, out);
-	new_ir(IR_LABEL, t, 0, 0);
-	new_ir(IR_LOADI, 1, 0, dst);
-	new_ir(IR_JUMP, 0, 0, out);
-	new_ir(IR_LABEL, out, 0, 0);
-	new_ir(IR_KILL, l, 0, 0);
-	new_ir(IR_KILL, r, 0, 0);
-
-	return (dst);
-}
-
-static int
-gen_land(struct node *n)
-{
-	int dst, f, l, next, out, r, t;
-
-	dst = alloc_reg();
-	next = new_label();
-	out = new_label();
-	t = new_label();
-	f = new_label();
-
-	l = gen_ir_op(n->l);
-	new_ir(IR_CBR, l, next, f);
-	new_ir(IR_LABEL, next, 0, 0);
-	r = gen_ir_op(n->r);
-	new_ir(IR_CBR, r, t, f);
+	gen_branch(n, t, f);
 	new_ir(IR_LABEL, t, 0, 0);
 	new_ir(IR_LOADI, 1, 0, dst);
 	new_ir(IR_JUMP, 0, 0, out);
@@ -242,8 +329,6 @@ gen_land(struct node *n)
 	new_ir(IR_LOADI, 0, 0, dst);
 	new_ir(IR_JUMP, 0, 0, out);
 	new_ir(IR_LABEL, out, 0, 0);
-	new_ir(IR_KILL, l, 0, 0);
-	new_ir(IR_KILL, r, 0, 0);
 
 	return (dst);
 }
@@ -262,7 +347,7 @@ gen_lval(struct node *n)
 			new_ir(IR_LOADG, (long)n->sym->name, 0, dst);
 		else {
 			tmp = alloc_reg();
-			new_ir(IR_LOADI, n->sym->loc, 0, tmp);
+			new_ir(IR_LOADI, local_off(n->sym), 0, tmp);
 			new_ir(IR_ADD, tmp, RARP, dst);
 			new_ir(IR_KILL, tmp, 0, 0);
 		}
@@ -279,12 +364,57 @@ gen_lval(struct node *n)
 	}
 }
 
+/* What falls off the end of the body returns 0. */
+static void
+gen_inline(struct symbol *f, long *args, int dst, int lo, int hi)
+{
+	struct inlined saved;
+	struct param *p;
+	int gen, i, tmp;
+
+	saved = inl;
+	gen = promote_gen;
+	promote_gen = ++nr_gens;
+	inl.base = (inl.top + 7) & ~7;
+	inl.top = inl.base + f->tab->ar_offset;
+	if (frame_size < inl.top)
+		frame_size = inl.top;
+	inl.lbl_lo = lo;
+	inl.lbl_hi = hi;
+	inl.lbl_base = lo < hi ? new_label() : 0;
+	for (i = lo + 1; i < hi; i++)
+		new_label();
+	inl.ret_reg = dst;
+	inl.ret_lbl = new_label();
+
+	new_ir(IR_LOADI, 0, 0, dst);
+	for (i = 0, p = f->params; p; p = p->next, i++) {
+		if (promoted(p->sym)) {
+			new_ir(IR_MOV, args[i], mov_size(p->sym->type),
+			    p->sym->reg);
+			continue;
+		}
+		tmp = alloc_reg();
+		new_ir(IR_LOADI, local_off(p->sym), 0, tmp);
+		new_ir(IR_ADD, tmp, RARP, tmp);
+		ir_store(args[i], tmp, _sizeof(p->sym->type));
+		new_ir(IR_KILL, tmp, 0, 0);
+	}
+	gen_stmt(f->body);
+	new_ir(IR_LABEL, inl.ret_lbl, 0, 0);
+
+	promote_gen = gen;
+	inl = saved;
+}
+
 static int
 gen_ir_op(struct node *n)
 {
 	struct struct_field *f;
 	struct param *p;
-	int dst, l, op, r, tmp;
+	struct ir *ir;
+	long *args;
+	int dst, i, l, op, r, tmp;
 
 	switch (n->op) {
 	case N_NOP:
@@ -304,12 +434,23 @@ gen_ir_op(struct node *n)
 			n->r = _t;
 		}
 		l = gen_ir_op(n->l);
-		r = gen_ir_op(n->r);
-		if (n->l->type->ptr) {
-			tmp = alloc_reg();
-			new_ir(IR_LOADI, _sizeof(n->l->type->ptr), 0, tmp);
-			new_ir(IR_MUL, tmp, r, r);
-			new_ir(IR_KILL, tmp, 0, 0);
+		if (n->l->type->ptr && n->r->op == N_CONSTANT) {
+			/* A constant index is scaled here, not at run time. */
+			r = alloc_reg();
+			new_ir(IR_LOADI, n->r->val * _sizeof(n->l->type->ptr), 0,
+			    r);
+		} else {
+			r = gen_ir_op(n->r);
+			if (n->l->type->ptr) {
+				tmp = alloc_reg();
+				new_ir(IR_LOADI, _sizeof(n->l->type->ptr), 0,
+				    tmp);
+				i = alloc_reg();
+				new_ir(IR_MUL, r, tmp, i);
+				new_ir(IR_KILL, tmp, 0, 0);
+				new_ir(IR_KILL, r, 0, 0);
+				r = i;
+			}
 		}
 		dst = alloc_reg();
 		new_ir(op, l, r, dst);
@@ -318,6 +459,7 @@ gen_ir_op(struct node *n)
 		return (dst);
 	case N_MUL:
 	case N_DIV:
+	case N_MOD:
 	case N_OR:
 	case N_AND:
 	case N_XOR:
@@ -325,6 +467,8 @@ gen_ir_op(struct node *n)
 			op = IR_MUL;
 		else if (n->op == N_DIV)
 			op = IR_DIV;
+		else if (n->op == N_MOD)
+			op = IR_MOD;
 		else if (n->op == N_OR)
 			op = IR_OR;
 		else if (n->op == N_AND)
@@ -350,7 +494,7 @@ gen_ir_op(struct node *n)
 			new_ir(IR_LOADG, (long)n->l->sym->name, 0, dst);
 		else {
 			tmp = alloc_reg();
-			new_ir(IR_LOADI, n->l->sym->loc, 0, tmp);
+			new_ir(IR_LOADI, local_off(n->l->sym), 0, tmp);
 			new_ir(IR_ADD, tmp, RARP, dst);
 			new_ir(IR_KILL, tmp, 0, 0);
 		}
@@ -367,12 +511,16 @@ gen_ir_op(struct node *n)
 		return (dst);
 	case N_SYM:
 		dst = alloc_reg();
+		if (!n->type->array && promoted(n->sym)) {
+			new_ir(IR_MOV, n->sym->reg, 0, dst);
+			return (dst);
+		}
 		if (n->type->array) {
 			if (n->sym->global)
 				new_ir(IR_LOADG, (long)n->sym->name, 0, dst);
 			else {
 				tmp = alloc_reg();
-				new_ir(IR_LOADI, n->sym->loc, 0, tmp);
+				new_ir(IR_LOADI, local_off(n->sym), 0, tmp);
 				new_ir(IR_ADD, tmp, RARP, dst);
 				new_ir(IR_KILL, tmp, 0, 0);
 			}
@@ -383,10 +531,10 @@ gen_ir_op(struct node *n)
 			new_ir(IR_LOADG, (long)n->sym->name, 0, tmp);
 			ir_load(tmp, dst, _sizeof(n->type));
 		} else {
-			new_ir(IR_LOADI, n->sym->loc, 0, tmp);
+			new_ir(IR_LOADI, local_off(n->sym), 0, tmp);
 			ir_loado(RARP, tmp, dst, _sizeof(n->type));
-			new_ir(IR_KILL, tmp, 0, 0);
 		}
+		new_ir(IR_KILL, tmp, 0, 0);
 		return (dst);
 	case N_FIELD:
 		f = (struct struct_field *)n->r;
@@ -401,30 +549,49 @@ gen_ir_op(struct node *n)
 		return (dst);
 	case N_ASSIGN:
 		r = gen_ir_op(n->r);
+		if (n->l->op == N_SYM && promoted(n->l->sym)) {
+			new_ir(IR_MOV, r, mov_size(n->l->type), n->l->sym->reg);
+			return (r);
+		}
 		tmp = gen_lval(n->l);
 		ir_store(r, tmp, _sizeof(n->l->type));
 		new_ir(IR_KILL, tmp, 0, 0);
 		return (r);
 	case N_MULTIPLE:
-		for (n = n->l; n; n = n->next) {
-			l = gen_ir_op(n);
-			if (l != -1)
-				new_ir(IR_KILL, l, 0, 0);
-		}
+		for (n = n->l; n; n = n->next)
+			gen_stmt(n);
 		return (-1);
 	case N_CALL:
 		dst = alloc_reg();
 		assert(n->l->op == N_SYM);
-		for (p = n->params; p; p = p->next)
-			 p->val = gen_ir_op(p->n);
-		new_ir(IR_CALL, (long)n->l->sym, (long)n->params, dst);
-		for (p = n->params; p; p = p->next)
-			new_ir(IR_KILL, p->val, 0, 0);
+		for (i = 0, p = n->params; p; p = p->next)
+			i++;
+		args = arena_alloc(&ir_arena, i * sizeof(long));
+		for (i = 0, p = n->params; p; p = p->next)
+			args[i++] = gen_ir_op(p->n);
+		if (promote && inline_call(n, &l, &r)) {
+			gen_inline(n->l->sym, args, dst, l, r);
+			inline_end();
+		} else {
+			ir = new_ir(IR_CALL, (long)n->l->sym, 0, dst);
+			ir->args = args;
+			ir->nr_args = i;
+		}
+		while (i--)
+			new_ir(IR_KILL, args[i], 0, 0);
 		return (dst);
 	case N_RETURN:
 		l = -1;
 		if (n->l)
 			l = gen_ir_op(n->l);
+		if (inl.ret_reg != -1) {
+			if (l != -1) {
+				new_ir(IR_MOV, l, 0, inl.ret_reg);
+				new_ir(IR_KILL, l, 0, 0);
+			}
+			new_ir(IR_JUMP, 0, 0, inl.ret_lbl);
+			return (-1);
+		}
 		new_ir(IR_RET, l, 0, 0);
 		return (-1);
 	case N_NE:
@@ -453,9 +620,8 @@ gen_ir_op(struct node *n)
 		new_ir(IR_KILL, r, 0, 0);
 		return (dst);
 	case N_LOR:
-		return (gen_lor(n));
 	case N_LAND:
-		return (gen_land(n));
+		return (gen_logical(n));
 	case N_IF:
 		return (gen_if(n));
 	case N_DO:
@@ -465,7 +631,7 @@ gen_ir_op(struct node *n)
 	case N_WHILE:
 		return (gen_while(n));
 	case N_GOTO:
-		new_ir(IR_JUMP, 0, 0, (long)n->l);
+		new_ir(IR_JUMP, 0, 0, label((long)n->l));
 		return (-1);
 	case N_COMMA:
 		dst = alloc_reg();
@@ -481,22 +647,28 @@ gen_ir_op(struct node *n)
 }
 
 void
-gen_ir(void)
+gen_ir(struct symbol *s, int opt)
 {
-	struct symbol *s;
+	struct param *p;
+	struct ir *enter;
 	int i;
 
-	for (i = 0; i < SYMTAB_SIZE; i++) {
-		s = symtab->tab[i];
-		if (s && s->body) {
-			head_ir = NULL;
-			last_ir = NULL;
-			cur_reg = 1;
-			new_ir(IR_ENTER, s->tab->ar_offset, (long)s->params, 0);
-			gen_ir_op(s->body);
-			s->ir = head_ir;
-		}
-	}
+	head_ir = NULL;
+	last_ir = NULL;
+	cur_reg = 1;
+	promote = opt;
+	promote_gen = ++nr_gens;
+	memset(&inl, 0, sizeof(inl));
+	inl.top = frame_size = s->tab->ar_offset;
+	inl.ret_reg = -1;
+	inline_begin(s);
+	enter = new_ir(IR_ENTER, s->tab->ar_offset, (long)s->params, 0);
+	for (i = 0, p = s->params; p; p = p->next, i++)
+		if (!p->sym->type->array && promoted(p->sym))
+			new_ir(IR_ARG, i, mov_size(p->sym->type), p->sym->reg);
+	gen_ir_op(s->body);
+	enter->o1 = frame_size;
+	s->ir = head_ir;
 }
 
 static char *ir_names[NR_IR_OPS] = {
@@ -504,6 +676,15 @@ static char *ir_names[NR_IR_OPS] = {
     [IR_SUB] = "SUB",
     [IR_MUL] = "MUL",
     [IR_DIV] = "DIV",
+    [IR_MOD] = "MOD",
+    [IR_MULH] = "MULH",
+    [IR_SHL] = "SHL",
+    [IR_SHR] = "SHR",
+    [IR_SAR] = "SAR",
+    [IR_NOT] = "NOT",
+    [IR_OR] = "OR",
+    [IR_AND] = "AND",
+    [IR_XOR] = "XOR",
     [IR_LOADI] = "LOADI",
     [IR_LOADG] = "LOADG",
     [IR_LOAD] = "LOAD",
@@ -519,6 +700,7 @@ static char *ir_names[NR_IR_OPS] = {
     [IR_RET] = "RET",
     [IR_MOV] = "MOV",
     [IR_ENTER] = "ENTER",
+    [IR_ARG] = "ARG",
     [IR_RET] = "RET",
     [IR_EQ] = "EQ",
     [IR_NE] = "NE",
@@ -530,13 +712,106 @@ static char *ir_names[NR_IR_OPS] = {
     [IR_JUMP] = "JUMP",
     [IR_LABEL] = "LABEL",
     [IR_CALL] = "CALL",
+    [IR_PHI] = "PHI",
+    [IR_VLOOP] = "VLOOP",
 };
 
+char *
+ir_op_name(int op)
+{
+	return (ir_names[op]);
+}
+
+/*
+ * Point uses[] at the register operands ir reads and return how many
+ * there are; the args of PHI and CALL are not included. KILL isn't a use.
+ */
+int
+ir_uses(struct ir *ir, long **uses)
+{
+	int i, j, n;
+
+	n = 0;
+	switch (ir->op) {
+	case IR_ADD:
+	case IR_SUB:
+	case IR_MUL:
+	case IR_DIV:
+	case IR_MOD:
+	case IR_MULH:
+	case IR_SHL:
+	case IR_SHR:
+	case IR_SAR:
+	case IR_OR:
+	case IR_AND:
+	case IR_XOR:
+	case IR_EQ:
+	case IR_NE:
+	case IR_LT:
+	case IR_LE:
+	case IR_GT:
+	case IR_GE:
+	case IR_LOADO:
+	case IR_LOADO32:
+	case IR_LOADO8:
+		uses[n++] = &ir->o1;
+		uses[n++] = &ir->o2;
+		break;
+	case IR_STORE:
+	case IR_STORE32:
+	case IR_STORE8:
+		uses[n++] = &ir->o1;
+		uses[n++] = &ir->dst;
+		uses[n++] = &ir->o2;
+		break;
+	case IR_NOT:
+	case IR_MOV:
+	case IR_LOAD:
+	case IR_LOAD32:
+	case IR_LOAD8:
+	case IR_CBR:
+	case IR_RET:
+		uses[n++] = &ir->o1;
+		break;
+	}
+	/* RET without a value and the operands isel() folded away. */
+	for (i = j = 0; i < n; i++)
+		if (*uses[i] != -1)
+			uses[j++] = uses[i];
+	return (j);
+}
+
+/* Whether ir writes the register in ir->dst. */
+int
+ir_defines(struct ir *ir)
+{
+	switch (ir->op) {
+	case IR_STORE:
+	case IR_STORE32:
+	case IR_STORE8:
+	case IR_KILL:
+	case IR_ENTER:
+	case IR_RET:
+	case IR_CBR:
+	case IR_JUMP:
+	case IR_LABEL:
+		return (0);
+	default:
+		/* A compare isel() left for a branch only sets the flags. */
+		return (ir->dst != -1);
+	}
+}
+
 void
 dump_ir_op(FILE *f, struct ir *ir)
 {
-	fprintf(f, "%s %ld, %ld, %ld\n", ir_names[ir->op], ir->o1, ir->o2,
+	int i;
+
+	fprintf(f, "%s %ld, %ld, %ld", ir_op_name(ir->op), ir->o1, ir->o2,
 	    ir->dst);
+	for (i = 0; i < ir->nr_args; i++)
+		fprintf(f, "%s%ld", i ? ", " : " [", ir->args[i]);
+	fprintf(f, "%s\n", ir->nr_args ? "]" : "");
 }
 
 void
@@ -0,0 +1,401 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <limits.h>
+#include <err.h>
+
+#include "rcc.h"
+
+/*
+ * Instruction selection by tiling the IR of a laid out function with a
+ * table of patterns from the target. Instructions are visited from the
+ * last one up, so a load or store takes in the additions and scaling of
+ * its address before they could be matched on their own. An operand whose
+ * only definition is a LOADI that fits in 32 bits can become an
+ * immediate; an address can take in ADDs of a constant or a second
+ * register and a MUL of its index by 1, 2, 4 or 8 (or the SHL it was
+ * reduced to), as long as they are only used there, sit earlier in the
+ * same block and their own operands aren't written in between. A compare
+ * only tested by a CBR is moved down to it and just sets the flags the
+ * branch looks at. What was taken in and isn't used anymore is dropped.
+ */
+
+/* How far back an address is looked for, to keep this linear. */
+#define	MAX_FOLD_DIST 32
+
+struct mem {
+	long base;
+	long index;
+	int scale;
+	long disp;
+};
+
+static struct ir **at;
+static int *blk;			/* block at each position */
+static int *def_pos;			/* -1 if none, -2 if several */
+static int *nr_uses;
+
+static void
+number(struct ir *head, int nr_pos)
+{
+	struct ir *ir;
+	long *u[MAX_IR_USES];
+	int b, i, j, k, n;
+
+	n = ir_nr_regs();
+	at = arena_alloc(&ir_arena, nr_pos * sizeof(struct ir *));
+	blk = arena_alloc(&ir_arena, nr_pos * sizeof(int));
+	def_pos = arena_alloc(&ir_arena, n * sizeof(int));
+	nr_uses = arena_alloc(&ir_arena, n * sizeof(int));
+	for (i = 0; i < n; i++)
+		def_pos[i] = -1;
+	for (b = i = 0, ir = head; ir; ir = ir->next, i++) {
+		if (ir->op == IR_LABEL)
+			b++;
+		at[i] = ir;
+		blk[i] = b;
+		if (ir->op == IR_JUMP || ir->op == IR_CBR || ir->op == IR_RET)
+			b++;
+		k = ir_uses(ir, u);
+		for (j = 0; j < k; j++)
+			nr_uses[*u[j]]++;
+		for (j = 0; j < ir->nr_args; j++)
+			nr_uses[ir->args[j]]++;
+		if (ir_defines(ir))
+			def_pos[ir->dst] = def_pos[ir->dst] == -1 ? i : -2;
+	}
+}
+
+static int
+fits(long c)
+{
+	return (c >= INT_MIN && c <= INT_MAX);
+}
+
+/* The value of r, if it is a constant the target can take in. */
+static int
+const_of(long r, long *c)
+{
+	struct ir *d;
+
+	if (r <= RARP || def_pos[r] < 0)
+		return (0);
+	d = at[def_pos[r]];
+	if (d->op != IR_LOADI || !fits(d->o1))
+		return (0);
+	*c = d->o1;
+	return (1);
+}
+
+static void
+drop(struct ir *ir)
+{
+	ir->op = IR_KILL;
+	ir->nr_args = 0;
+}
+
+/* One use of the constant in r has been taken in. */
+static void
+consume(long r)
+{
+	if (--nr_uses[r] == 0)
+		drop(at[def_pos[r]]);
+}
+
+/* Whether the definition of r can be moved into its use at pos. */
+static int
+foldable(long r, int pos)
+{
+	struct ir *d, *ir;
+	long *u[MAX_IR_USES];
+	int i, j, k, q;
+
+	if (r <= RARP || (q = def_pos[r]) < 0 || nr_uses[r] != 1 ||
+	    q >= pos || pos - q > MAX_FOLD_DIST || blk[q] != blk[pos])
+		return (0);
+	d = at[q];
+	k = ir_uses(d, u);
+	for (i = q + 1; i < pos; i++) {
+		ir = at[i];
+		if (!ir_defines(ir))
+			continue;
+		for (j = 0; j < k; j++)
+			if (ir->dst == *u[j])
+				return (0);
+	}
+	return (1);
+}
+
+static int
+fold_base(struct mem *m, int pos)
+{
+	struct ir *d;
+	long c;
+
+	if (!foldable(m->base, pos))
+		return (0);
+	d = at[def_pos[m->base]];
+	if (d->op != IR_ADD)
+		return (0);
+	if (const_of(d->o2, &c) && fits(m->disp + c)) {
+		m->base = d->o1;
+		m->disp += c;
+		consume(d->o2);
+	} else if (const_of(d->o1, &c) && fits(m->disp + c)) {
+		m->base = d->o2;
+		m->disp += c;
+		consume(d->o1);
+	} else if (m->index == -1) {
+		m->base = d->o1;
+		m->index = d->o2;
+		m->scale = 1;
+	} else
+		return (0);
+	drop(d);
+	return (1);
+}
+
+static int
+fold_index(struct mem *m, int pos)
+{
+	struct ir *d;
+	long c;
+
+	if (m->index == -1)
+		return (0);
+	if (const_of(m->index, &c) && fits(m->disp + c * m->scale)) {
+		consume(m->index);
+		m->disp += c * m->scale;
+		m->index = -1;
+		m->scale = 1;
+		return (1);
+	}
+	if (!foldable(m->index, pos))
+		return (0);
+	d = at[def_pos[m->index]];
+	if (d->op == IR_MUL && m->scale == 1) {
+		if (const_of(d->o2, &c) && (c == 1 || c == 2 || c == 4 ||
+		    c == 8)) {
+			m->index = d->o1;
+			consume(d->o2);
+		} else if (const_of(d->o1, &c) && (c == 1 || c == 2 ||
+		    c == 4 || c == 8)) {
+			m->index = d->o2;
+			consume(d->o1);
+		} else
+			return (0);
+		m->scale = c;
+	} else if (d->op == IR_SHL && m->scale == 1 &&
+	    const_of(d->o2, &c) && c >= 0 && c <= 3) {
+		m->index = d->o1;
+		m->scale = 1 << c;
+		consume(d->o2);
+	} else if (d->op == IR_ADD && const_of(d->o2, &c) &&
+	    fits(m->disp + c * m->scale)) {
+		m->index = d->o1;
+		m->disp += c * m->scale;
+		consume(d->o2);
+	} else
+		return (0);
+	drop(d);
+	return (1);
+}
+
+/* Loads become the LOADO form, stores keep the index in o2. */
+static void
+fold_mem(struct ir *ir, int pos)
+{
+	struct mem m;
+
+	m.scale = 1;
+	m.disp = 0;
+	switch (ir->op) {
+	case IR_LOAD:
+	case IR_LOAD32:
+	case IR_LOAD8:
+		m.base = ir->o1;
+		m.index = -1;
+		break;
+	case IR_LOADO:
+	case IR_LOADO32:
+	case IR_LOADO8:
+		m.base = ir->o1;
+		m.index = ir->o2;
+		break;
+	default:
+		m.base = ir->dst;
+		m.index = -1;
+		break;
+	}
+	while (fold_base(&m, pos) || fold_index(&m, pos))
+		;
+
+	switch (ir->op) {
+	case IR_LOAD:
+		ir->op = IR_LOADO;
+		break;
+	case IR_LOAD32:
+		ir->op = IR_LOADO32;
+		break;
+	case IR_LOAD8:
+		ir->op = IR_LOADO8;
+		break;
+	}
+	if (ir->op == IR_STORE || ir->op == IR_STORE32 || ir->op == IR_STORE8)
+		ir->dst = m.base;
+	else
+		ir->o1 = m.base;
+	ir->o2 = m.index;
+	ir->scale = m.scale;
+	ir->imm = m.disp;
+}
+
+static int
+is_compare(int op)
+{
+	switch (op) {
+	case IR_EQ:
+	case IR_NE:
+	case IR_LT:
+	case IR_LE:
+	case IR_GT:
+	case IR_GE:
+		return (1);
+	default:
+		return (0);
+	}
+}
+
+static int
+match(long r, int shape, int pos)
+{
+	long c;
+
+	switch (shape) {
+	case P_IMM:
+		return (const_of(r, &c));
+	case P_FLAGS:
+		return (foldable(r, pos) && is_compare(at[def_pos[r]]->op));
+	default:
+		return (1);
+	}
+}
+
+static void select_op(struct ir *ir, int pos);
+
+/*
+ * The compare is copied to just before ir, where nothing else can touch
+ * the flags, and selected on its own there.
+ */
+static void
+to_flags(struct ir *ir, long r, int pos)
+{
+	struct ir *cmp, *d;
+
+	d = at[def_pos[r]];
+	cmp = ir_alloc(d->op, d->o1, d->o2, -1);
+	cmp->next = ir;
+	at[pos - 1]->next = cmp;
+	drop(d);
+	select_op(cmp, pos);
+	/* Selection may have swapped the operands and flipped the op. */
+	ir->imm = cmp->op;
+}
+
+static void
+apply(struct ir *ir, long *r, int shape, int pos)
+{
+	switch (shape) {
+	case P_IMM:
+		const_of(*r, &ir->imm);
+		consume(*r);
+		*r = -1;
+		break;
+	case P_FLAGS:
+		to_flags(ir, *r, pos);
+		*r = -1;
+		break;
+	}
+}
+
+/* Constants go on the right, where the patterns look for them. */
+static void
+canonicalize(struct ir *ir)
+{
+	long c, t;
+	int op;
+
+	switch (ir->op) {
+	case IR_LT:
+		op = IR_GT;
+		break;
+	case IR_LE:
+		op = IR_GE;
+		break;
+	case IR_GT:
+		op = IR_LT;
+		break;
+	case IR_GE:
+		op = IR_LE;
+		break;
+	case IR_ADD:
+	case IR_MUL:
+	case IR_AND:
+	case IR_OR:
+	case IR_XOR:
+	case IR_EQ:
+	case IR_NE:
+		op = ir->op;
+		break;
+	default:
+		return;
+	}
+	if (!const_of(ir->o1, &c) || const_of(ir->o2, &c))
+		return;
+	t = ir->o1;
+	ir->o1 = ir->o2;
+	ir->o2 = t;
+	ir->op = op;
+}
+
+static struct pattern *pats;
+static int nr_pats;
+
+static void
+select_op(struct ir *ir, int pos)
+{
+	struct pattern *p;
+	int i;
+
+	canonicalize(ir);
+	for (i = 0; i < nr_pats; i++) {
+		p = &pats[i];
+		if (p->op == ir->op && match(ir->o1, p->o1, pos) &&
+		    match(ir->o2, p->o2, pos) && match(ir->dst, p->dst, pos))
+			break;
+	}
+	if (i == nr_pats)
+		return;
+	if (p->o1 == P_MEM || p->dst == P_MEM)
+		fold_mem(ir, pos);
+	apply(ir, &ir->o1, p->o1, pos);
+	apply(ir, &ir->o2, p->o2, pos);
+	ir->pat = i + 1;
+}
+
+struct ir *
+isel(struct ir *head, struct pattern *table, int nr_table)
+{
+	struct ir *ir;
+	int nr_pos, pos;
+
+	for (nr_pos = 0, ir = head; ir; ir = ir->next)
+		nr_pos++;
+	number(head, nr_pos);
+	pats = table;
+	nr_pats = nr_table;
+
+	for (pos = nr_pos - 1; pos >= 0; pos--)
+		if (at[pos]->op != IR_KILL)
+			select_op(at[pos], pos);
+	return (strip_kills(head));
+}
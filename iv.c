@@ -0,0 +1,435 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <limits.h>
+#include <string.h>
+#include <err.h>
+
+#include "rcc.h"
+
+/*
+ * Strength reduction of induction variables on the SSA form. A basic
+ * induction variable is a PHI of a loop header whose value around the back
+ * edge is itself plus or minus a constant. A multiplication of one by
+ * something the loop doesn't change becomes an induction variable of its
+ * own, started in the preheader and stepped along with the original, so
+ * i * k costs an add per iteration, and so on for a multiplication of
+ * that one. What else goes into the address, a scale of 2, 4 or 8 and a
+ * base, isel() still takes into the addressing mode.
+ *
+ * Each reduced variable costs a register and the copies of its PHI, which
+ * a multiplication by 3, 5 or 9 (a single lea) doesn't make up for unless
+ * the original counter goes away. It does when nothing but its step, the
+ * multiplications and the exit test use it: the test is then made on the
+ * reduced variable against the bound times the (positive, constant)
+ * multiplier instead (linear function test replacement), and dead_code()
+ * takes the counter out. Signed overflow being undefined, the product
+ * fits for every iteration the multiplication runs in; it has to run in
+ * all of them for that.
+ *
+ * Loops with calls are left alone, like in hoist_invariants().
+ */
+
+struct reduced {
+	int is_const;
+	long k;				/* the constant or the register */
+	long q;				/* the PHI */
+	long q_next;			/* its value around the back edge */
+};
+
+static struct cfg *cfg;
+static struct ir **defs;		/* by register, in SSA form */
+static int *def_block;			/* by register, -1 if none */
+static int *nr_uses;			/* by register */
+static int nr_scanned, max_regs;
+
+static struct loop *l;
+static struct ir *phi;			/* the basic induction variable */
+static long next;			/* phi plus step */
+static struct ir *step_ir;		/* which computes next */
+static long step;
+static int ip, il;			/* args of phi from preheader and latch */
+
+static struct reduced *red;		/* for the current phi */
+static int nr_red;
+
+/*
+ * defs, def_block and nr_uses, which go stale as the loops change. The
+ * registers made since are only ever in the PHIs and steps of reduced
+ * variables.
+ */
+static void
+scan(void)
+{
+	struct block *b;
+	struct ir *ir;
+	long *u[MAX_IR_USES];
+	int i, j, k, n;
+
+	n = nr_scanned = ir_nr_regs();
+	if (n > max_regs) {
+		max_regs = n;
+		if ((defs = realloc(defs, n * sizeof(struct ir *))) == NULL ||
+		    (def_block = realloc(def_block, n * sizeof(int))) == NULL ||
+		    (nr_uses = realloc(nr_uses, n * sizeof(int))) == NULL ||
+		    (red = realloc(red, n * sizeof(struct reduced))) == NULL)
+			err(1, "realloc");
+	}
+	memset(defs, 0, n * sizeof(struct ir *));
+	memset(nr_uses, 0, n * sizeof(int));
+	for (i = 0; i < n; i++)
+		def_block[i] = -1;
+	for (i = 0; i < cfg->nr_blocks; i++) {
+		b = &cfg->blocks[i];
+		if (b->dead || b->rpo == -1)
+			continue;
+		for (ir = b->head;; ir = ir->next) {
+			if (ir_defines(ir)) {
+				defs[ir->dst] = ir;
+				def_block[ir->dst] = i;
+			}
+			k = ir_uses(ir, u);
+			for (j = 0; j < k; j++)
+				nr_uses[*u[j]]++;
+			for (j = 0; j < ir->nr_args; j++)
+				nr_uses[ir->args[j]]++;
+			if (ir == b->tail)
+				break;
+		}
+	}
+}
+
+static int
+const_of(long r, long *c)
+{
+	if (r == RARP || r >= nr_scanned || defs[r] == NULL ||
+	    defs[r]->op != IR_LOADI)
+		return (0);
+	*c = defs[r]->o1;
+	return (1);
+}
+
+static int
+invariant(long r)
+{
+	long c;
+
+	if (r >= nr_scanned)
+		return (0);
+	return (def_block[r] == -1 || !l->body[def_block[r]] ||
+	    const_of(r, &c));
+}
+
+static int
+is_iv(long r)
+{
+	return (r == phi->dst || r == next);
+}
+
+/* The induction variable and the invariant of ir, a multiplication. */
+static int
+split_mul(struct ir *ir, long *x, long *k)
+{
+	if (ir->op != IR_MUL)
+		return (0);
+	if (is_iv(ir->o1) && invariant(ir->o2)) {
+		*x = ir->o1;
+		*k = ir->o2;
+	} else if (is_iv(ir->o2) && invariant(ir->o1)) {
+		*x = ir->o2;
+		*k = ir->o1;
+	} else
+		return (0);
+	return (1);
+}
+
+static int
+is_compare(int op)
+{
+	return (op >= IR_EQ && op <= IR_GE);
+}
+
+static int
+fits_mul(long a, long b)
+{
+	if (b <= 0)
+		return (0);
+	return (a <= LONG_MAX / b && a >= LONG_MIN / b);
+}
+
+static long
+wrap_mul(long a, long b)
+{
+	return ((long)((unsigned long)a * (unsigned long)b));
+}
+
+/* Whether the loop is one this pass can work on. */
+static int
+simple_loop(void)
+{
+	struct block *b;
+	struct ir *ir;
+	int i;
+
+	if (l->preheader == -1 || l->latch == -1 ||
+	    cfg->blocks[l->header].nr_preds != 2)
+		return (0);
+	for (i = 0; i < cfg->nr_blocks; i++) {
+		if (!l->body[i])
+			continue;
+		b = &cfg->blocks[i];
+		for (ir = b->head;; ir = ir->next) {
+			if (ir->op == IR_CALL)
+				return (0);
+			if (ir == b->tail)
+				break;
+		}
+	}
+	return (1);
+}
+
+/* Whether phi steps by a constant around the back edge. */
+static int
+basic_iv(struct ir *ir)
+{
+	struct block *h;
+	struct ir *d;
+	long c;
+
+	h = &cfg->blocks[l->header];
+	phi = ir;
+	ip = h->preds[0] == l->preheader ? 0 : 1;
+	il = 1 - ip;
+	next = ir->args[il];
+	if ((d = defs[next]) == NULL || !l->body[def_block[next]])
+		return (0);
+	if (d->op == IR_ADD && d->o1 == ir->dst && const_of(d->o2, &c))
+		step = c;
+	else if (d->op == IR_ADD && d->o2 == ir->dst && const_of(d->o1, &c))
+		step = c;
+	else if (d->op == IR_SUB && d->o1 == ir->dst && const_of(d->o2, &c))
+		step = -c;
+	else
+		return (0);
+	step_ir = d;
+	return (1);
+}
+
+static long
+put_pre(int op, long o1, long o2)
+{
+	long r;
+
+	r = ir_new_reg();
+	block_append(&cfg->blocks[l->preheader], ir_alloc(op, o1, o2, r));
+	return (r);
+}
+
+static struct reduced *
+find_reduced(long k)
+{
+	long c;
+	int i, is_const;
+
+	is_const = const_of(k, &c);
+	if (is_const)
+		k = c;
+	for (i = 0; i < nr_red; i++)
+		if (red[i].is_const == is_const && red[i].k == k)
+			return (&red[i]);
+	return (NULL);
+}
+
+/* A new induction variable for phi * k. */
+static struct reduced *
+new_reduced(long k)
+{
+	struct block *h;
+	struct ir *ir;
+	struct reduced *r;
+	long c, init, s, v;
+
+	r = &red[nr_red++];
+	r->is_const = const_of(k, &c);
+	r->k = r->is_const ? c : k;
+	init = phi->args[ip];
+	if (r->is_const) {
+		if (const_of(init, &v))
+			init = put_pre(IR_LOADI, wrap_mul(v, c), 0);
+		else
+			init = put_pre(IR_MUL, init, put_pre(IR_LOADI, c, 0));
+		s = put_pre(IR_LOADI, wrap_mul(step, c), 0);
+	} else {
+		if (const_of(init, &v) && v == 0)
+			init = put_pre(IR_LOADI, 0, 0);
+		else
+			init = put_pre(IR_MUL, init, k);
+		s = step == 1 ? k : put_pre(IR_MUL, k,
+		    put_pre(IR_LOADI, step, 0));
+	}
+
+	r->q = ir_new_reg();
+	r->q_next = ir_new_reg();
+	h = &cfg->blocks[l->header];
+	ir = ir_alloc(IR_PHI, r->q, 0, r->q);
+	ir->nr_args = 2;
+	ir->args = arena_alloc(&ir_arena, 2 * sizeof(long));
+	ir->args[ip] = init;
+	ir->args[il] = r->q_next;
+	ir->next = h->head->next;
+	h->head->next = ir;
+	if (h->tail == h->head)
+		h->tail = ir;
+
+	ir = ir_alloc(IR_ADD, r->q, s, r->q_next);
+	ir->next = step_ir->next;
+	step_ir->next = ir;
+	if (cfg->blocks[def_block[next]].tail == step_ir)
+		cfg->blocks[def_block[next]].tail = ir;
+	return (r);
+}
+
+/* Whether isel() can't do the multiplication in a single instruction. */
+static int
+costly(long k)
+{
+	long c;
+
+	return (!const_of(k, &c) || (c != 3 && c != 5 && c != 9));
+}
+
+/*
+ * The compare the exit test can be made on a reduced variable in, with
+ * the constant multiplier *kc to do it with, or NULL if the counter is
+ * needed for more than that.
+ */
+static struct ir *
+find_lftr(long *kc)
+{
+	struct block *b;
+	struct ir *ir, *cmp;
+	long c, k, m, x;
+	int i, n;
+
+	cmp = NULL;
+	n = 0;
+	*kc = 0;
+	for (i = 0; i < cfg->nr_blocks; i++) {
+		if (!l->body[i])
+			continue;
+		b = &cfg->blocks[i];
+		for (ir = b->head;; ir = ir->next) {
+			if (split_mul(ir, &x, &k)) {
+				n++;
+				if (*kc == 0 && const_of(k, &c) && c > 0 &&
+				    dominates(cfg, i, l->latch))
+					*kc = c;
+			} else if (is_compare(ir->op) && ((is_iv(ir->o1) &&
+			    invariant(ir->o2)) || (is_iv(ir->o2) &&
+			    invariant(ir->o1)))) {
+				if (cmp)
+					return (NULL);
+				cmp = ir;
+				n++;
+			}
+			if (ir == b->tail)
+				break;
+		}
+	}
+	/* Besides those, phi is used by the step and next by phi. */
+	if (cmp == NULL || *kc == 0 ||
+	    nr_uses[phi->dst] + nr_uses[next] != n + 2)
+		return (NULL);
+	m = is_iv(cmp->o1) ? cmp->o2 : cmp->o1;
+	if (const_of(m, &c) && !fits_mul(c, *kc))
+		return (NULL);
+	return (cmp);
+}
+
+static void
+replace_test(struct ir *cmp, long kc)
+{
+	struct reduced *r;
+	long *iv, *m, v;
+
+	for (r = red; r->is_const == 0 || r->k != kc; r++)
+		;
+	if (is_iv(cmp->o1)) {
+		iv = &cmp->o1;
+		m = &cmp->o2;
+	} else {
+		iv = &cmp->o2;
+		m = &cmp->o1;
+	}
+	if (const_of(*m, &v))
+		*m = put_pre(IR_LOADI, v * kc, 0);
+	else
+		*m = put_pre(IR_MUL, *m, put_pre(IR_LOADI, kc, 0));
+	*iv = *iv == phi->dst ? r->q : r->q_next;
+}
+
+/* Returns whether anything changed. */
+static int
+reduce_iv(void)
+{
+	struct block *b;
+	struct ir *cmp, *ir, *prev;
+	struct reduced *r;
+	long k, kc, x;
+	int i;
+
+	cmp = find_lftr(&kc);
+	nr_red = 0;
+	for (i = 0; i < cfg->nr_blocks; i++) {
+		if (!l->body[i])
+			continue;
+		b = &cfg->blocks[i];
+		for (prev = b->head; prev != b->tail; ) {
+			ir = prev->next;
+			if (!split_mul(ir, &x, &k) || (cmp == NULL &&
+			    !costly(k))) {
+				prev = ir;
+				continue;
+			}
+			if ((r = find_reduced(k)) == NULL)
+				r = new_reduced(k);
+			ssa_rename(cfg, ir->dst, x == phi->dst ? r->q :
+			    r->q_next);
+			/* The new step may have gone in right before ir. */
+			while (prev->next != ir)
+				prev = prev->next;
+			prev->next = ir->next;
+			if (b->tail == ir)
+				b->tail = prev;
+		}
+	}
+	if (cmp)
+		replace_test(cmp, kc);
+	return (nr_red > 0);
+}
+
+void
+reduce_induction(struct cfg *_cfg)
+{
+	struct loop *loops;
+	struct ir *ir, *next_phi;
+	int changed, i, nr_loops;
+
+	cfg = _cfg;
+	nr_loops = find_loops(cfg, &loops);
+	for (i = 0; i < nr_loops; i++) {
+		l = &loops[i];
+		if (!simple_loop())
+			continue;
+		/* Until the new variables have no multiplications left. */
+		do {
+			scan();
+			changed = 0;
+			for (ir = cfg->blocks[l->header].head->next;
+			    ir && ir->op == IR_PHI; ir = next_phi) {
+				next_phi = ir->next;
+				if (basic_iv(ir) && reduce_iv())
+					changed = 1;
+			}
+		} while (changed);
+	}
+}
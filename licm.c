@@ -0,0 +1,265 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <err.h>
+
+#include "rcc.h"
+
+/*
+ * Loop-invariant code motion on the SSA form. The natural loops are found
+ * from their back edges and visited inner ones first, so that what moves
+ * to the preheader of an inner loop can leave the outer one as well. An
+ * instruction is invariant if everything it reads comes from outside the
+ * loop or is invariant itself; it then moves to the end of the preheader
+ * cfg_add_preheaders() made.
+ *
+ * Only what can't trap is moved unless its block is sure to run whenever
+ * the loop is left: a division, or a load through anything but a fixed
+ * offset from the frame or a global. Loads only move out of loops without
+ * stores. Loops with calls are left alone, since every register live
+ * across a call is saved and restored around it. Arithmetic that only
+ * goes into addresses moves just for a load that moves, as isel() would
+ * otherwise have taken it into the addressing mode for free.
+ */
+
+static struct cfg *cfg;
+static struct ir **defs;		/* by register, in SSA form */
+static int *def_block;			/* by register, -1 if none */
+static char *addr_only;
+static char *in_loop;			/* by block */
+static char *invariant;			/* by register */
+static char *needed;			/* by register */
+static int *exits;
+
+static int
+outside(long r)
+{
+	return (def_block[r] == -1 || !in_loop[def_block[r]]);
+}
+
+/* A fixed offset from the frame or a global can always be read. */
+static int
+safe_address(long r)
+{
+	struct ir *d;
+
+	if (r == RARP)
+		return (1);
+	if ((d = defs[r]) == NULL)
+		return (0);
+	if (d->op == IR_LOADG)
+		return (1);
+	if (d->op != IR_ADD)
+		return (0);
+	if (defs[d->o2] && defs[d->o2]->op == IR_LOADI)
+		return (safe_address(d->o1));
+	if (defs[d->o1] && defs[d->o1]->op == IR_LOADI)
+		return (safe_address(d->o2));
+	return (0);
+}
+
+static int
+can_move(struct ir *ir, int always_runs, int stores)
+{
+	switch (ir->op) {
+	case IR_ADD:
+	case IR_SUB:
+	case IR_MUL:
+	case IR_MULH:
+	case IR_SHL:
+	case IR_SHR:
+	case IR_SAR:
+	case IR_NOT:
+	case IR_OR:
+	case IR_AND:
+	case IR_XOR:
+	case IR_EQ:
+	case IR_NE:
+	case IR_LT:
+	case IR_LE:
+	case IR_GT:
+	case IR_GE:
+	case IR_LOADI:
+	case IR_LOADG:
+		return (1);
+	case IR_DIV:
+	case IR_MOD:
+		return (always_runs);
+	case IR_LOAD:
+	case IR_LOAD32:
+	case IR_LOAD8:
+		return (!stores && (always_runs || safe_address(ir->o1)));
+	case IR_LOADO:
+	case IR_LOADO32:
+	case IR_LOADO8:
+		return (!stores && always_runs);
+	default:
+		return (0);
+	}
+}
+
+static void
+need(long r)
+{
+	long *u[MAX_IR_USES];
+	int i, k;
+
+	if (needed[r] || !invariant[r])
+		return;
+	needed[r] = 1;
+	k = ir_uses(defs[r], u);
+	for (i = 0; i < k; i++)
+		need(*u[i]);
+}
+
+/*
+ * The same constant or global address already in the preheader, which
+ * value_number() left alone as long as it could be computed again.
+ */
+static struct ir *
+find_cheap(struct block *b, struct ir *ir)
+{
+	struct ir *p;
+
+	if (ir->op != IR_LOADI && ir->op != IR_LOADG)
+		return (NULL);
+	for (p = b->head;; p = p->next) {
+		if (p->op == ir->op && p->o1 == ir->o1)
+			return (p);
+		if (p == b->tail)
+			return (NULL);
+	}
+}
+
+static void
+hoist(struct loop *l)
+{
+	struct block *b, *pre;
+	struct ir *ir, *prev, *same;
+	long *u[MAX_IR_USES];
+	int always, i, j, k, nr_exits, stores;
+
+	if (l->preheader == -1)
+		return;
+	in_loop = l->body;
+	pre = &cfg->blocks[l->preheader];
+	memset(invariant, 0, ir_nr_regs());
+	memset(needed, 0, ir_nr_regs());
+
+	nr_exits = stores = 0;
+	for (i = 0; i < cfg->nr_blocks; i++) {
+		if (!in_loop[i])
+			continue;
+		b = &cfg->blocks[i];
+		for (j = 0; j < b->nr_succs; j++)
+			if (!in_loop[b->succs[j]]) {
+				exits[nr_exits++] = i;
+				break;
+			}
+		for (ir = b->head;; ir = ir->next) {
+			if (ir->op == IR_CALL)
+				return;
+			if (ir->op == IR_STORE || ir->op == IR_STORE32 ||
+			    ir->op == IR_STORE8)
+				stores = 1;
+			if (ir == b->tail)
+				break;
+		}
+	}
+
+	/* In reverse postorder, which has definitions before their uses. */
+	for (i = 0; i < cfg->nr_rpo; i++) {
+		if (!in_loop[cfg->rpo[i]])
+			continue;
+		b = &cfg->blocks[cfg->rpo[i]];
+		for (always = nr_exits > 0, j = 0; j < nr_exits; j++)
+			if (!dominates(cfg, cfg->rpo[i], exits[j]))
+				always = 0;
+		for (ir = b->head;; ir = ir->next) {
+			if (can_move(ir, always, stores)) {
+				k = ir_uses(ir, u);
+				for (j = 0; j < k; j++)
+					if (!outside(*u[j]) && !invariant[*u[j]])
+						break;
+				if (j == k)
+					invariant[ir->dst] = 1;
+			}
+			if (ir == b->tail)
+				break;
+		}
+	}
+
+	/* Address arithmetic only goes along with a load that does. */
+	for (i = 0; i < cfg->nr_rpo; i++) {
+		if (!in_loop[cfg->rpo[i]])
+			continue;
+		b = &cfg->blocks[cfg->rpo[i]];
+		for (ir = b->head;; ir = ir->next) {
+			if (ir_defines(ir) && invariant[ir->dst] &&
+			    !addr_only[ir->dst])
+				need(ir->dst);
+			if (ir == b->tail)
+				break;
+		}
+	}
+
+	for (i = 0; i < cfg->nr_rpo; i++) {
+		if (!in_loop[cfg->rpo[i]])
+			continue;
+		b = &cfg->blocks[cfg->rpo[i]];
+		for (prev = NULL, ir = b->head;; ir = prev->next) {
+			if (prev && ir_defines(ir) && invariant[ir->dst] &&
+			    (!addr_only[ir->dst] || needed[ir->dst])) {
+				prev->next = ir->next;
+				if (b->tail == ir)
+					b->tail = prev;
+				if ((same = find_cheap(pre, ir)) != NULL)
+					ssa_rename(cfg, ir->dst, same->dst);
+				else {
+					block_append(pre, ir);
+					def_block[ir->dst] = l->preheader;
+				}
+			} else
+				prev = ir;
+			if (prev == b->tail)
+				break;
+		}
+	}
+}
+
+void
+hoist_invariants(struct cfg *_cfg)
+{
+	struct loop *loops;
+	struct block *b;
+	struct ir *ir;
+	int i, n, nr_loops;
+
+	cfg = _cfg;
+	n = ir_nr_regs();
+	defs = arena_alloc(&ir_arena, n * sizeof(struct ir *));
+	def_block = arena_alloc(&ir_arena, n * sizeof(int));
+	invariant = arena_alloc(&ir_arena, n);
+	needed = arena_alloc(&ir_arena, n);
+	exits = arena_alloc(&ir_arena, cfg->nr_blocks * sizeof(int));
+	addr_only = find_addresses(cfg);
+	nr_loops = find_loops(cfg, &loops);
+
+	for (i = 0; i < n; i++)
+		def_block[i] = -1;
+	for (i = 0; i < cfg->nr_blocks; i++) {
+		b = &cfg->blocks[i];
+		if (b->dead || b->rpo == -1)
+			continue;
+		for (ir = b->head;; ir = ir->next) {
+			if (ir_defines(ir)) {
+				defs[ir->dst] = ir;
+				def_block[ir->dst] = i;
+			}
+			if (ir == b->tail)
+				break;
+		}
+	}
+	for (i = 0; i < nr_loops; i++)
+		hoist(&loops[i]);
+}
@@ -0,0 +1,170 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <err.h>
+
+#include "rcc.h"
+
+/*
+ * Liveness over a laid out function. Every instruction gets a position
+ * in list order and each IR register lives from the first position it is
+ * mentioned or live at to the last one. A register live out of a block is
+ * counted live up to the start of the next, so that it covers a CALL that
+ * happens to end the block. The ARGs all live from the ENTER, as
+ * emit_params() does them at once and their registers mustn't be shared,
+ * even where a result goes unused. Jumps back in the layout mark the loops,
+ * which the allocator uses to weigh spill costs.
+ */
+
+typedef unsigned long word;
+
+#define	WORD_BITS (sizeof(word) * CHAR_BIT)
+#define	SET_BIT(s, i) ((s)[(i) / WORD_BITS] |= 1UL << ((i) % WORD_BITS))
+#define	HAS_BIT(s, i) ((s)[(i) / WORD_BITS] & (1UL << ((i) % WORD_BITS)))
+
+struct ir *
+strip_kills(struct ir *head)
+{
+	struct ir *ir, **p;
+
+	for (p = &head; (ir = *p); )
+		if (ir->op == IR_KILL)
+			*p = ir->next;
+		else
+			p = &ir->next;
+	return (head);
+}
+
+static void
+mention(struct live *l, long reg, int pos)
+{
+	if (reg == RARP)
+		return;
+	if (pos < l->first[reg])
+		l->first[reg] = pos;
+	if (pos > l->last[reg])
+		l->last[reg] = pos;
+}
+
+static void
+mention_set(struct live *l, word *set, int words, int pos)
+{
+	word w;
+	int i, j;
+
+	for (i = 0; i < words; i++)
+		for (w = set[i], j = 0; w; w >>= 1, j++)
+			if (w & 1)
+				mention(l, i * WORD_BITS + j, pos);
+}
+
+struct live *
+live_ranges(struct ir *head)
+{
+	struct block *b;
+	struct cfg *cfg;
+	struct live *l;
+	struct ir *ir;
+	word *in, *out, *use, *def, *t;
+	long *u[MAX_IR_USES];
+	int *start;
+	int changed, enter, i, j, k, n, pos, words;
+
+	cfg = cfg_build(head);
+	n = ir_nr_regs();
+	words = (n + WORD_BITS - 1) / WORD_BITS;
+	in = arena_alloc(&ir_arena, cfg->nr_blocks * words * sizeof(word));
+	out = arena_alloc(&ir_arena, cfg->nr_blocks * words * sizeof(word));
+	use = arena_alloc(&ir_arena, cfg->nr_blocks * words * sizeof(word));
+	def = arena_alloc(&ir_arena, cfg->nr_blocks * words * sizeof(word));
+	t = arena_alloc(&ir_arena, words * sizeof(word));
+	start = arena_alloc(&ir_arena, (cfg->nr_blocks + 1) * sizeof(int));
+
+	l = arena_alloc(&ir_arena, sizeof(struct live));
+	for (i = 0; i < cfg->nr_blocks; i++) {
+		b = &cfg->blocks[i];
+		start[i] = l->nr_pos;
+		for (ir = b->head;; ir = ir->next) {
+			l->nr_pos++;
+			k = ir_uses(ir, u);
+			for (j = 0; j < k; j++)
+				if (!HAS_BIT(def + i * words, *u[j]))
+					SET_BIT(use + i * words, *u[j]);
+			for (j = 0; j < ir->nr_args; j++)
+				if (!HAS_BIT(def + i * words, ir->args[j]))
+					SET_BIT(use + i * words, ir->args[j]);
+			if (ir_defines(ir))
+				SET_BIT(def + i * words, ir->dst);
+			if (ir == b->tail)
+				break;
+		}
+	}
+	start[cfg->nr_blocks] = l->nr_pos;
+
+	do {
+		changed = 0;
+		for (i = cfg->nr_blocks - 1; i >= 0; i--) {
+			b = &cfg->blocks[i];
+			memset(t, 0, words * sizeof(word));
+			for (k = 0; k < b->nr_succs; k++)
+				for (j = 0; j < words; j++)
+					t[j] |= in[b->succs[k] * words + j];
+			memcpy(out + i * words, t, words * sizeof(word));
+			for (j = 0; j < words; j++) {
+				t[j] = use[i * words + j] | (t[j] &
+				    ~def[i * words + j]);
+				if (t[j] != in[i * words + j]) {
+					in[i * words + j] = t[j];
+					changed = 1;
+				}
+			}
+		}
+	} while (changed);
+
+	l->first = arena_alloc(&ir_arena, n * sizeof(int));
+	l->last = arena_alloc(&ir_arena, n * sizeof(int));
+	l->at = arena_alloc(&ir_arena, l->nr_pos * sizeof(struct ir *));
+	l->depth = arena_alloc(&ir_arena, (l->nr_pos + 1) * sizeof(int));
+	for (i = 0; i < n; i++) {
+		l->first[i] = INT_MAX;
+		l->last[i] = -1;
+	}
+
+	pos = enter = 0;
+	for (i = 0; i < cfg->nr_blocks; i++) {
+		b = &cfg->blocks[i];
+		mention_set(l, in + i * words, words, pos);
+		for (ir = b->head;; ir = ir->next) {
+			l->at[pos] = ir;
+			if (ir->op == IR_ENTER)
+				enter = pos;
+			else if (ir->op == IR_ARG)
+				mention(l, ir->dst, enter);
+			k = ir_uses(ir, u);
+			for (j = 0; j < k; j++)
+				mention(l, *u[j], pos);
+			for (j = 0; j < ir->nr_args; j++)
+				mention(l, ir->args[j], pos);
+			if (ir_defines(ir))
+				mention(l, ir->dst, pos);
+			pos++;
+			if (ir == b->tail)
+				break;
+		}
+		if (pos < l->nr_pos)
+			mention_set(l, out + i * words, words, pos);
+		else
+			mention_set(l, out + i * words, words, pos - 1);
+
+		/* An edge back to an earlier block closes a loop. */
+		for (k = 0; k < b->nr_succs; k++)
+			if (b->succs[k] <= i) {
+				l->depth[start[b->succs[k]]]++;
+				l->depth[start[i + 1]]--;
+			}
+	}
+	for (pos = 1; pos < l->nr_pos; pos++)
+		l->depth[pos] += l->depth[pos - 1];
+	return (l);
+}
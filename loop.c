@@ -0,0 +1,100 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <err.h>
+
+#include "rcc.h"
+
+/*
+ * Natural loops of a CFG, one for each header that some of its own
+ * dominated blocks branch back to. The body of a loop is everything that
+ * reaches one of those back edges without going through the header. They
+ * are returned inner ones first (by size), which is the order the loop
+ * passes want to visit them in.
+ */
+
+static int
+cmp_size(const void *a, const void *b)
+{
+	const struct loop *x = a, *y = b;
+
+	return (x->size - y->size);
+}
+
+static void
+find_body(struct cfg *cfg, struct loop *l, int *stack)
+{
+	struct block *b;
+	int i, p, sp;
+
+	l->body = arena_alloc(&ir_arena, cfg->nr_blocks);
+	l->body[l->header] = 1;
+	l->size = 1;
+	l->preheader = l->latch = -1;
+	sp = 0;
+	b = &cfg->blocks[l->header];
+	for (i = 0; i < b->nr_preds; i++) {
+		p = b->preds[i];
+		if (!back_edge(cfg, p, l->header))
+			continue;
+		l->latch = l->latch == -1 ? p : -2;
+		if (!l->body[p]) {
+			l->body[p] = 1;
+			stack[sp++] = p;
+			l->size++;
+		}
+	}
+	while (sp) {
+		b = &cfg->blocks[stack[--sp]];
+		for (i = 0; i < b->nr_preds; i++) {
+			p = b->preds[i];
+			if (!l->body[p]) {
+				l->body[p] = 1;
+				stack[sp++] = p;
+				l->size++;
+			}
+		}
+	}
+	if (l->latch == -2)
+		l->latch = -1;
+
+	b = &cfg->blocks[l->header];
+	for (i = 0; i < b->nr_preds; i++) {
+		p = b->preds[i];
+		if (l->body[p])
+			continue;
+		if (l->preheader != -1 || cfg->blocks[p].nr_succs != 1) {
+			l->preheader = -1;
+			break;
+		}
+		l->preheader = p;
+	}
+}
+
+/* Computes the dominators as well. */
+int
+find_loops(struct cfg *cfg, struct loop **loops)
+{
+	struct block *b;
+	int *stack;
+	int i, j, n;
+
+	cfg_dominators(cfg);
+	*loops = arena_alloc(&ir_arena, cfg->nr_blocks * sizeof(struct loop));
+	stack = arena_alloc(&ir_arena, cfg->nr_blocks * sizeof(int));
+	n = 0;
+	for (i = 0; i < cfg->nr_blocks; i++) {
+		b = &cfg->blocks[i];
+		if (b->dead || b->rpo == -1)
+			continue;
+		for (j = 0; j < b->nr_preds; j++)
+			if (back_edge(cfg, b->preds[j], i))
+				break;
+		if (j == b->nr_preds)
+			continue;
+		(*loops)[n].header = i;
+		find_body(cfg, &(*loops)[n++], stack);
+	}
+	qsort(*loops, n, sizeof(struct loop), cmp_size);
+	return (n);
+}
@@ -0,0 +1,50 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <err.h>
+
+#include "rcc.h"
+
+/*
+ * The optimiser works on the IR of one function between gen_ir() and
+ * emission: the list is taken into SSA form, the passes run over its CFG
+ * and it is laid out again for the register allocator. With -fdce-report
+ * what dead code elimination took out of each function is printed;
+ * -fno-vectorize leaves the loops vectorize() would take alone.
+ */
+
+int opt_level;
+int dce_report;
+int vector_loops = 1;
+
+void
+opt_func(struct symbol *s)
+{
+	struct cfg *cfg;
+	struct ir *head;
+	int i, nr_blocks, nr_insts;
+
+	head = cfg_split_edges(cfg_add_preheaders(strip_kills(s->ir)));
+	cfg = cfg_build(head);
+	ssa_build(cfg);
+	sccp(cfg);
+	strength_reduce(cfg);
+	value_number(cfg);
+	hoist_invariants(cfg);
+	nr_insts = dead_code(cfg);
+	/*
+	 * The loop passes count uses, so what is dead goes first; the
+	 * counters reduce_induction() replaces are left behind.
+	 */
+	if (vector_loops)
+		vectorize(cfg);
+	reduce_induction(cfg);
+	nr_insts += dead_code(cfg);
+	ssa_destroy(cfg);
+	if (dce_report) {
+		for (i = nr_blocks = 0; i < cfg->nr_blocks; i++)
+			nr_blocks += cfg->blocks[i].dead;
+		fprintf(stderr, "%s: %d dead instructions, %d unreachable "
+		    "blocks\n", s->name, nr_insts, nr_blocks);
+	}
+	s->ir = cfg_linearize(cfg, NULL, 0);
+}
@@ -0,0 +1,158 @@
+#include <sys/wait.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <err.h>
+
+#include "rcc.h"
+
+/*
+ * Assembly output. Lines are formatted straight into one large buffer
+ * that is handed to write(2) when it fills up, so emitting an instruction
+ * never goes through stdio. The sink is a file, stdout or the stdin of a
+ * command started with popen(3).
+ */
+
+#define	OUT_BUF_SIZE (256 * 1024)
+
+static char out_buf[OUT_BUF_SIZE];
+static size_t out_len;
+static int out_fd = -1;
+static FILE *out_pipe;
+static char *out_name;
+
+static void
+out_sink(const char *p, size_t len)
+{
+	ssize_t n;
+
+	for (; len > 0; p += n, len -= n)
+		if ((n = write(out_fd, p, len)) == -1)
+			err(1, "write %s", out_name);
+}
+
+static void
+out_flush(void)
+{
+	out_sink(out_buf, out_len);
+	out_len = 0;
+}
+
+/*
+ * "-" is stdout and "|cmd" pipes the assembly into cmd, anything else is
+ * a file name.
+ */
+void
+out_open(char *path)
+{
+	out_name = path;
+	out_len = 0;
+	if (!strcmp(path, "-"))
+		out_fd = STDOUT_FILENO;
+	else if (path[0] == '|') {
+		if ((out_pipe = popen(path + 1, "w")) == NULL)
+			err(1, "popen %s", path + 1);
+		out_fd = fileno(out_pipe);
+	} else if ((out_fd = open(path, O_WRONLY | O_CREAT | O_TRUNC,
+	    0666)) == -1)
+		err(1, "open %s", path);
+}
+
+void
+out_close(void)
+{
+	int status;
+
+	out_flush();
+	if (out_pipe) {
+		if ((status = pclose(out_pipe)) == -1)
+			err(1, "pclose");
+		if (!WIFEXITED(status) || WEXITSTATUS(status))
+			errx(1, "%s failed", out_name + 1);
+		out_pipe = NULL;
+	} else if (out_fd != STDOUT_FILENO && close(out_fd))
+		err(1, "close %s", out_name);
+	out_fd = -1;
+}
+
+void
+out_write(const char *s, size_t len)
+{
+	if (out_len + len > OUT_BUF_SIZE) {
+		out_flush();
+		if (len >= OUT_BUF_SIZE) {
+			out_sink(s, len);
+			return;
+		}
+	}
+	memcpy(out_buf + out_len, s, len);
+	out_len += len;
+}
+
+void
+out_char(int c)
+{
+	if (out_len == OUT_BUF_SIZE)
+		out_flush();
+	out_buf[out_len++] = c;
+}
+
+void
+out_str(const char *s)
+{
+	out_write(s, strlen(s));
+}
+
+void
+out_long(long v)
+{
+	char tmp[24], *p;
+	unsigned long u;
+
+	p = tmp + sizeof(tmp);
+	u = v < 0 ? -(unsigned long)v : v;
+	do {
+		*--p = '0' + u % 10;
+		u /= 10;
+	} while (u);
+	if (v < 0)
+		*--p = '-';
+	out_write(p, tmp + sizeof(tmp) - p);
+}
+
+/* Only the conversions the code generator uses: %s, %d, %ld and %%. */
+void
+out_vfmt(const char *fmt, va_list ap)
+{
+	const char *p;
+
+	for (;;) {
+		for (p = fmt; *p && *p != '%'; p++)
+			;
+		out_write(fmt, p - fmt);
+		if (*p == '\0')
+			return;
+		switch (*++p) {
+		case 's':
+			out_str(va_arg(ap, char *));
+			break;
+		case 'd':
+			out_long(va_arg(ap, int));
+			break;
+		case 'l':
+			if (*++p != 'd')
+				errx(1, "Bad output format %s", fmt);
+			out_long(va_arg(ap, long));
+			break;
+		case '%':
+			out_char('%');
+			break;
+		default:
+			errx(1, "Bad output format %s", fmt);
+		}
+		fmt = p + 1;
+	}
+}
@@ -20,8 +20,7 @@ new_node(enum node_op op, struct node *l, struct node *r, void *v,
 {
 	struct node *n;
 
-	n = malloc(sizeof(struct node));
-	memset(n, 0, sizeof(struct node));
+	n = arena_alloc(&ast_arena, sizeof(struct node));
 	n->op = op;
 	n->l = l;
 	n->r = r;
@@ -36,7 +35,7 @@ next(void)
 {
 	if (tok->tok == TOK_EOF)
 		errx(1, "Unexpected EOF at line %d\n", tok->line);
-	tok = tok->next;
+	lex_next();
 }
 
 static void
@@ -58,19 +57,6 @@ maybe_match(enum tokens t)
 	return (0);
 }
 
-struct type *
-new_type(int size)
-{
-	struct type *t;
-
-	t = malloc(sizeof(struct type));
-	memset(t, 0, sizeof(struct type));
-	t->size = size;
-	t->stacksize = size;
-
-	return (t);
-}
-
 static int
 is_type(struct token *tok) {
 	switch (tok->tok) {
@@ -108,7 +94,7 @@ find_field(struct struct_field *head, char *name)
 	struct struct_field *f;
 
 	for (f = head; f; f = f->next)
-		if (!strcmp(f->name, name))
+		if (f->name == name)
 			return (f);
 	return (NULL);
 }
@@ -120,8 +106,7 @@ struct_field(int *off)
 
 	head = last = NULL;
 	while (!maybe_match('}')) {
-		f = malloc(sizeof(struct struct_field));
-		memset(f, 0, sizeof(struct struct_field));
+		f = arena_alloc(&ast_arena, sizeof(struct struct_field));
 
 		f->type = type();
 		if (tok->tok != TOK_ID)
@@ -152,6 +137,7 @@ _struct(void)
 	char *name;
 	int off;
 
+	off = 0;
 	name = NULL;
 	_st = NULL;
 	match(TOK_STRUCT);
@@ -167,8 +153,7 @@ _struct(void)
 		_st = add_struct(name);
 		_st->name = name;
 		_st->fields = struct_field(&off);
-		_st->type = new_type(off);
-		_st->type->_struct = _st;
+		_st->type = type_struct(_st, off);
 	}
 	if (!_st)
 		errx(1, "Unknown struct %s at line %d", name, tok->line);
@@ -178,7 +163,7 @@ _struct(void)
 static struct type *
 type(void)
 {
-	struct type *_type, *ptr;
+	struct type *_type;
 
 	if (!is_type(tok))
 		errx(1, "Syntax error at line %d: Expected type got %d\n",
@@ -187,15 +172,12 @@ type(void)
 	if (tok->tok == TOK_STRUCT)
 		_type = _struct();
 	else {
-		_type = new_type(typesize(tok));
+		_type = type_base(typesize(tok));
 		next();
 	}
 
-	while (maybe_match('*')) {
-		ptr = new_type(8);
-		ptr->ptr = _type;
-		_type = ptr;
-	}
+	while (maybe_match('*'))
+		_type = type_ptr(_type);
 
 	return (_type);
 }
@@ -208,7 +190,7 @@ constant(void)
 
 	v = tok->val;
 	match(TOK_CONSTANT);
-	_type = new_type(4);
+	_type = type_base(4);
 	return (new_node(N_CONSTANT, NULL, NULL, (void *)v, _type));
 }
 
@@ -263,8 +245,7 @@ argument_expr_list(void)
 
 	p_head = p_last = NULL;
 	while (!maybe_match(')')) {
-		p = malloc(sizeof(struct param));
-		memset(p, 0, sizeof(struct param));
+		p = arena_alloc(&ast_arena, sizeof(struct param));
 		p->n = assign_expr();
 		if (!p_head)
 			p_head = p;
@@ -325,7 +306,7 @@ postfix_expr(void)
 			n = new_node(N_FIELD, n, (void *)f, NULL, f->type);
 		} else if (tok->tok == TOK_INCR || tok->tok == TOK_DECR) {
 			r = new_node(N_CONSTANT, NULL, NULL, (void *)1,
-			    new_type(4));
+			    type_base(4));
 			r = new_node(tok->tok == TOK_INCR ? N_ADD : N_SUB, l, r,
 			    NULL, l->type);
 			r = new_node(N_ASSIGN, l, r, NULL, l->type);
@@ -353,29 +334,29 @@ unary_expr(void)
 		return (new_node(N_DEREF, n, NULL, 0, n->type->ptr));
 	} else if (maybe_match('&')) {
 		n = unary_expr();
-		_type = new_type(8);
-		_type->ptr = n->type;
-		return (new_node(N_ADDR, n, NULL, 0, _type));
+		if (n->op == N_SYM)
+			n->sym->addr_taken = 1;
+		return (new_node(N_ADDR, n, NULL, 0, type_ptr(n->type)));
 	} else if (maybe_match('!')) {
 		n = unary_expr();
 		return (new_node(N_NOT, n, NULL, 0, n->type));
 	} else if (maybe_match('~')) {
 		r = unary_expr();
-		_type = new_type(4);
+		_type = type_base(4);
 		n = new_node(N_CONSTANT, NULL, NULL, (void *)0, _type);
 		n = new_node(N_SUB, n, r, NULL, r->type);
 		r = new_node(N_CONSTANT, NULL, NULL, (void *)1, _type);
 		return (new_node(N_SUB, n, r, NULL, r->type));
 	} else if (maybe_match('-')) {
 		r = unary_expr();
-		_type = new_type(4);
+		_type = type_base(4);
 		n = new_node(N_CONSTANT, NULL, NULL, (void *)0, _type);
 		return (new_node(N_SUB, n, r, NULL, r->type));
 	} else if (tok->tok == TOK_INCR || tok->tok == TOK_DECR) {
 		t = tok->tok;
 		next();
 		r = unary_expr();
-		n = new_node(N_CONSTANT, NULL, NULL, (void *)1, new_type(4));
+		n = new_node(N_CONSTANT, NULL, NULL, (void *)1, type_base(4));
 		n = new_node(t == TOK_INCR ? N_ADD : N_SUB, r, n, NULL,
 		    r->type);
 		return (new_node(N_ASSIGN, r, n, NULL, r->type));
@@ -390,11 +371,12 @@ multiplicative_expr(void)
 	enum tokens t;
 
 	l = unary_expr();
-	while (tok->tok == '*' || tok->tok == '/') {
+	while (tok->tok == '*' || tok->tok == '/' || tok->tok == '%') {
 		t = tok->tok;
 		next();
 		r = unary_expr();
-		l = new_node(t == '*' ? N_MUL : N_DIV, l, r, 0, l->type);
+		l = new_node(t == '*' ? N_MUL : t == '/' ? N_DIV : N_MOD, l, r,
+		    0, l->type);
 	}
 
 	return (l);
@@ -533,7 +515,8 @@ assign_expr(void)
 
 	l = lor_expr();
 	while (tok->tok == '=' || tok->tok == TOK_ASSADD || tok->tok ==
-	    TOK_ASSSUB || tok->tok == TOK_ASSMUL || tok->tok == TOK_ASSDIV) {
+	    TOK_ASSSUB || tok->tok == TOK_ASSMUL || tok->tok == TOK_ASSDIV ||
+	    tok->tok == TOK_ASSMOD) {
 		t = tok->tok;
 		next();
 		r = assign_expr();
@@ -545,6 +528,8 @@ assign_expr(void)
 			r = new_node(N_MUL, l, r, 0, l->type);
 		else if (t == TOK_ASSDIV)
 			r = new_node(N_DIV, l, r, 0, l->type);
+		else if (t == TOK_ASSMOD)
+			r = new_node(N_MOD, l, r, 0, l->type);
 		l = new_node(N_ASSIGN, l, r, 0, l->type);
 	}
 	return (l);
@@ -567,10 +552,8 @@ static struct type *
 array(struct type *t)
 {
 	struct node *n, *last;
-	struct type *_type;
 
 	n = last = NULL;
-	_type = t;
 	while (maybe_match('[')) {
 		n = primary_expr();
 		if (n->op != N_CONSTANT)
@@ -581,11 +564,7 @@ array(struct type *t)
 		match(']');
 	}
 	while (n) {
-		_type = new_type(n->val);
-		_type->stacksize =  n->val * t->stacksize;
-		_type->ptr = t;
-		_type->array = 1;
-		t = _type;
+		t = type_array(t, n->val);
 		n = n->next;
 	}
 	return (t);
@@ -596,18 +575,15 @@ _decl(struct type *__type)
 {
 	struct node *l, *last, *head, *n, *r;
 	struct symbol *s;
-	struct type *_type, *ptr;
+	struct type *_type;
 	char *name;
 
 	last = head = NULL;
 	while (1) {
 		n = NULL;
 		_type = __type;
-		while (maybe_match('*')) {
-			ptr = new_type(8);
-			ptr->ptr = _type;
-			_type = ptr;
-		}
+		while (maybe_match('*'))
+			_type = type_ptr(_type);
 
 		if (tok->tok != TOK_ID)
 			errx(1, "Syntax error at line %d: Expected identifier,"
@@ -848,6 +824,7 @@ func(struct type *_type)
 		errx(1, "'%s' redeclared at line %d", tok->str,
 		    tok->line);
 	s = add_sym(tok->str, _type);
+	phase_start(PHASE_PARSE, s);
 	next();
 	new_symtab();
 	s->func = 1;
@@ -856,8 +833,7 @@ func(struct type *_type)
 
 	head_p = last_p = NULL;
 	while (!maybe_match(')')) {
-		p = malloc(sizeof(struct param));
-		memset(p, 0, sizeof(struct param));
+		p = arena_alloc(&ast_arena, sizeof(struct param));
 		if (!head_p)
 			head_p = p;
 		if (last_p)
@@ -872,6 +848,7 @@ func(struct type *_type)
 			errx(1, "'%s' redeclared at line %d", tok->str,
 			    tok->line);
 		p->sym = add_sym(tok->str, _type);
+		p->sym->param = 1;
 		next();
 		if (!maybe_match(',')) {
 			match(')');
@@ -885,6 +862,7 @@ func(struct type *_type)
 
 	s->body = n;
 	s->params = head_p;
+	phase_end(PHASE_PARSE);
 }
 
 static void
@@ -902,7 +880,7 @@ external_decl(void)
 		errx(1, "Syntax error at line %d, Expected symbol, got %d",
 		    tok->line, tok->tok);
 
-	if (tok->next->tok == '(')
+	if (lex_peek()->tok == '(')
 		func(_type);
 	else
 		_decl(_type);
@@ -0,0 +1,286 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <err.h>
+
+#include "rcc.h"
+
+/*
+ * Peephole optimisation of the machine instructions of a function, as
+ * as_record() held them back. Each rule looks at a window of instructions
+ * from one position on, comments and what was already deleted left out,
+ * and may rewrite or delete them; the rules are tried everywhere until
+ * none fires anymore. With -fpeephole-report how often each one fired is
+ * printed at the end.
+ */
+
+#define	MAX_WINDOW 4
+
+int peep_report;
+
+static char *referenced;		/* by label - min_label */
+static int min_label;
+
+static int
+is_mov(struct minst *mi, int kind, int size)
+{
+	return (mi->kind == kind && mi->op == AS_MOV && mi->size == size);
+}
+
+/* Whether mi writes all of register r without reading it or the flags. */
+static int
+overwrites(struct minst *mi, int r)
+{
+	switch (mi->kind) {
+	case MI_RR:
+		return (mi->dst == r && mi->src != r && mi->op == AS_MOV &&
+		    mi->size >= 4);
+	case MI_RI:
+		return (mi->dst == r && mi->op == AS_MOV && mi->size >= 4);
+	case MI_LOAD:
+		return (mi->dst == r && mi->base != r && mi->index != r &&
+		    (mi->op != AS_MOV || mi->size >= 4));
+	case MI_SYM:
+		return (mi->dst == r && mi->op == AS_LEA);
+	default:
+		return (0);
+	}
+}
+
+static enum as_op
+invert(enum as_op op)
+{
+	switch (op) {
+	case AS_JE:
+		return (AS_JNE);
+	case AS_JNE:
+		return (AS_JE);
+	case AS_JL:
+		return (AS_JGE);
+	case AS_JGE:
+		return (AS_JL);
+	case AS_JLE:
+		return (AS_JG);
+	case AS_JB:
+		return (AS_JAE);
+	case AS_JAE:
+		return (AS_JB);
+	default:
+		return (AS_JLE);
+	}
+}
+
+/* movq %r, %r */
+static int
+self_move(struct minst **w, int n)
+{
+	if (!is_mov(w[0], MI_RR, 8) || w[0]->src != w[0]->dst)
+		return (0);
+	w[0]->kind = MI_DEAD;
+	return (1);
+}
+
+/* movq %a, %b; movq %b, %a: the second one, as after a call. */
+static int
+move_back(struct minst **w, int n)
+{
+	if (n < 2 || !is_mov(w[0], MI_RR, 8) || !is_mov(w[1], MI_RR, 8) ||
+	    w[0]->src != w[1]->dst || w[0]->dst != w[1]->src)
+		return (0);
+	w[1]->kind = MI_DEAD;
+	return (1);
+}
+
+/* A copy, load or constant into a register written again right after. */
+static int
+dead_move(struct minst **w, int n)
+{
+	if (n < 2 || !overwrites(w[0], w[0]->dst) ||
+	    !overwrites(w[1], w[0]->dst))
+		return (0);
+	w[0]->kind = MI_DEAD;
+	return (1);
+}
+
+/* pushq %a; popq %b */
+static int
+push_pop(struct minst **w, int n)
+{
+	if (n < 2 || w[0]->kind != MI_R || w[0]->op != AS_PUSH ||
+	    w[1]->kind != MI_R || w[1]->op != AS_POP)
+		return (0);
+	if (w[0]->dst == w[1]->dst)
+		w[0]->kind = MI_DEAD;
+	else {
+		w[0]->kind = MI_RR;
+		w[0]->op = AS_MOV;
+		w[0]->size = 8;
+		w[0]->src = w[0]->dst;
+		w[0]->dst = w[1]->dst;
+	}
+	w[1]->kind = MI_DEAD;
+	return (1);
+}
+
+/* A load of what was just stored is a copy of the stored register. */
+static int
+store_load(struct minst **w, int n)
+{
+	struct minst *s, *l;
+
+	s = w[0];
+	l = w[1];
+	if (n < 2 || s->kind != MI_STORE || (s->size != 4 && s->size != 8) ||
+	    !is_mov(l, MI_LOAD, s->size) || s->index != -1 ||
+	    l->index != -1 || s->base != l->base || s->disp != l->disp)
+		return (0);
+	l->kind = MI_RR;
+	l->src = s->src;
+	return (1);
+}
+
+/* leaq (%a), %b */
+static int
+lea_move(struct minst **w, int n)
+{
+	if (w[0]->kind != MI_LOAD || w[0]->op != AS_LEA ||
+	    w[0]->index != -1 || w[0]->disp != 0)
+		return (0);
+	w[0]->kind = MI_RR;
+	w[0]->op = AS_MOV;
+	w[0]->src = w[0]->base;
+	return (1);
+}
+
+/* A jump, taken or not, to where it would get anyway. */
+static int
+jump_next(struct minst **w, int n)
+{
+	int i;
+
+	if (w[0]->kind != MI_JMP)
+		return (0);
+	for (i = 1; i < n && w[i]->kind == MI_LABEL; i++)
+		if (w[i]->imm == w[0]->imm) {
+			w[0]->kind = MI_DEAD;
+			return (1);
+		}
+	return (0);
+}
+
+/* jcc 1f; jmp 2f; 1: becomes jncc 2f; 1: */
+static int
+jcc_over_jmp(struct minst **w, int n)
+{
+	if (n < 3 || w[0]->kind != MI_JMP || w[0]->op == AS_JMP ||
+	    w[1]->kind != MI_JMP || w[1]->op != AS_JMP ||
+	    w[2]->kind != MI_LABEL || w[2]->imm != w[0]->imm)
+		return (0);
+	w[0]->op = invert(w[0]->op);
+	w[0]->imm = w[1]->imm;
+	w[1]->kind = MI_DEAD;
+	return (1);
+}
+
+/* Nothing gets past a jmp or ret but to a label. */
+static int
+unreachable(struct minst **w, int n)
+{
+	if (n < 2 || w[1]->kind == MI_LABEL ||
+	    !((w[0]->kind == MI_JMP && w[0]->op == AS_JMP) ||
+	    (w[0]->kind == MI_OP && w[0]->op == AS_RET)))
+		return (0);
+	w[1]->kind = MI_DEAD;
+	return (1);
+}
+
+/* A label nothing jumps to, which would only keep the rules apart. */
+static int
+unused_label(struct minst **w, int n)
+{
+	if (w[0]->kind != MI_LABEL || referenced[w[0]->imm - min_label])
+		return (0);
+	w[0]->kind = MI_DEAD;
+	return (1);
+}
+
+static struct rule {
+	char *name;
+	int (*fn)(struct minst **w, int n);
+	long fired;
+} rules[] = {
+	{ "self-move",		self_move },
+	{ "move-back",		move_back },
+	{ "dead-move",		dead_move },
+	{ "push-pop",		push_pop },
+	{ "store-load",		store_load },
+	{ "lea-move",		lea_move },
+	{ "jump-next",		jump_next },
+	{ "jcc-over-jmp",	jcc_over_jmp },
+	{ "unreachable",	unreachable },
+	{ "unused-label",	unused_label },
+};
+
+#define	NR_RULES (sizeof(rules) / sizeof(rules[0]))
+
+/* The instructions from i on, at most MAX_WINDOW of them. */
+static int
+window(struct minst *mi, int nr, int i, struct minst **w)
+{
+	int n;
+
+	for (n = 0; i < nr && n < MAX_WINDOW; i++)
+		if (mi[i].kind != MI_DEAD && mi[i].kind != MI_COMMENT)
+			w[n++] = &mi[i];
+	return (n);
+}
+
+static void
+find_referenced(struct minst *mi, int nr)
+{
+	int i, max_label;
+
+	min_label = max_label = -1;
+	for (i = 0; i < nr; i++)
+		if (mi[i].kind == MI_LABEL || mi[i].kind == MI_JMP) {
+			if (min_label == -1 || mi[i].imm < min_label)
+				min_label = mi[i].imm;
+			if (mi[i].imm > max_label)
+				max_label = mi[i].imm;
+		}
+	referenced = arena_alloc(&ir_arena, max_label - min_label + 1);
+	for (i = 0; i < nr; i++)
+		if (mi[i].kind == MI_JMP)
+			referenced[mi[i].imm - min_label] = 1;
+}
+
+void
+peephole(struct minst *mi, int nr)
+{
+	struct minst *w[MAX_WINDOW];
+	int changed, i, j, n;
+
+	do {
+		find_referenced(mi, nr);
+		changed = 0;
+		for (i = 0; i < nr; i++)
+			for (j = 0; j < NR_RULES; j++) {
+				if (mi[i].kind == MI_DEAD ||
+				    mi[i].kind == MI_COMMENT)
+					break;
+				n = window(mi, nr, i, w);
+				if (rules[j].fn(w, n)) {
+					rules[j].fired++;
+					changed = 1;
+				}
+			}
+	} while (changed);
+}
+
+void
+peephole_stats(void)
+{
+	int i;
+
+	for (i = 0; i < NR_RULES; i++)
+		fprintf(stderr, "%-16s %8ld\n", rules[i].name, rules[i].fired);
+}
@@ -1,5 +1,8 @@
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include <fcntl.h>
+#include <unistd.h>
 #include <err.h>
 
 #include "rcc.h"
@@ -9,27 +12,140 @@ add_special_funcs(void)
 {
 	struct symbol *s;
 
-	s = add_sym("printf", NULL);
+	s = add_sym(intern("printf", 6), NULL);
 	s->func = 1;
 }
 
+static void
+compile(char *out_path, int object)
+{
+	struct symbol *s;
+
+	phase_start(PHASE_EMIT, NULL);
+	out_open(out_path);
+	as_open(object);
+	emit_x86_data();
+	phase_end(PHASE_EMIT);
+	for (s = globals; s; s = s->next) {
+		if (s->body) {
+			if (opt_level) {
+				phase_start(PHASE_OPT, s);
+				fold_func(s);
+				phase_end(PHASE_OPT);
+			}
+			phase_start(PHASE_IRGEN, s);
+			gen_ir(s, opt_level > 0);
+			if (!opt_level)
+				s->ir = cfg_linearize(cfg_build(s->ir), NULL, 0);
+			phase_end(PHASE_IRGEN);
+			if (opt_level) {
+				phase_start(PHASE_OPT, s);
+				opt_func(s);
+				phase_end(PHASE_OPT);
+			}
+			phase_start(PHASE_EMIT, s);
+			emit_x86_func(s);
+			phase_end(PHASE_EMIT);
+			s->ir = NULL;
+			arena_free(&ir_arena);
+		}
+	}
+	phase_start(PHASE_EMIT, NULL);
+	as_close();
+	out_close();
+	phase_end(PHASE_EMIT);
+}
+
+static void
+usage(char *prog)
+{
+	errx(1, "Usage: %s [-S] [-Olevel] [-fdce-report] [-fflex] "
+	    "[-finline-report] [-fno-inline] [-fno-ir-comments] "
+	    "[-fno-vectorize] [-fpeephole-report] [-ftime-report] "
+	    "[-ftrace=file] [-mavx2] [-o output] <file>",
+	    prog);
+}
+
 int
 main(int argc, char **argv)
 {
 	FILE *f;
+	char *out_path, *trace_path;
+	int ch, object, time_report, use_flex;
 
-	if (argc != 2)
-		errx(1, "Usage: %s <file>", argv[0]);
+	out_path = NULL;
+	trace_path = NULL;
+	time_report = use_flex = 0;
+	object = 1;
+	while ((ch = getopt(argc, argv, "O:Sf:m:o:")) != -1) {
+		switch (ch) {
+		case 'O':
+			opt_level = atoi(optarg);
+			break;
+		case 'S':
+			object = 0;
+			break;
+		case 'f':
+			if (!strcmp(optarg, "flex"))
+				use_flex = 1;
+			else if (!strcmp(optarg, "no-ir-comments"))
+				ir_comments = 0;
+			else if (!strcmp(optarg, "no-vectorize"))
+				vector_loops = 0;
+			else if (!strcmp(optarg, "no-inline"))
+				inline_funcs = 0;
+			else if (!strcmp(optarg, "inline-report"))
+				inline_report = 1;
+			else if (!strcmp(optarg, "dce-report"))
+				dce_report = 1;
+			else if (!strcmp(optarg, "peephole-report"))
+				peep_report = 1;
+			else if (!strcmp(optarg, "time-report"))
+				time_report = 1;
+			else if (!strncmp(optarg, "trace=", 6))
+				trace_path = optarg + 6;
+			else
+				usage(argv[0]);
+			break;
+		case 'm':
+			if (strcmp(optarg, "avx2"))
+				usage(argv[0]);
+			x86_avx2 = 1;
+			break;
+		case 'o':
+			out_path = optarg;
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+	if (argc - optind != 1)
+		usage(argv[0]);
+	if (out_path == NULL)
+		out_path = object ? "out.o" : "out.S";
 
-	if ((f = fopen(argv[1], "r")) == NULL)
+	if ((f = fopen(argv[optind], "r")) == NULL)
 		err(1, "fopen");
 
-	lex(f);
+	stats_init(time_report, trace_path);
+
+	if (use_flex) {
+		flex_open(f);
+		lex(flex_token);
+	} else {
+		scan_open(f);
+		lex(scan_token);
+	}
 
 	add_special_funcs();
+	phase_start(PHASE_PARSE, NULL);
 	parse();
-	gen_ir();
-	emit_x86();
+	phase_end(PHASE_PARSE);
+	compile(out_path, object);
+	if (peep_report)
+		peephole_stats();
+	arena_free(&ast_arena);
+	stats_finish();
 
 	return (0);
 }
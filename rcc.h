@@ -4,7 +4,6 @@
 extern struct token *tok;
 
 struct token {
-	struct token *next;
 	int tok;
 	int line;
 	union {
@@ -105,6 +104,7 @@ enum node_op {
 	N_SUB,
 	N_MUL,
 	N_DIV,
+	N_MOD,
 	N_OR,
 	N_AND,
 	N_XOR,
@@ -136,13 +136,90 @@ enum node_op {
 
 extern struct ir *head_ir;
 
-/* OP l,r -> dst */
+/*
+ * OP l,r -> dst; PHI and CALL take their operands from args. Operands
+ * isel() folded into the instruction are -1; a memory operand is o1 plus
+ * o2 times scale plus imm.
+ */
 struct ir {
 	struct ir *next;
 	int op;
 	long o1;
 	long o2;
 	long dst;
+	long *args;
+	int nr_args;
+	int pat;			/* pattern picked by isel() */
+	long imm;
+	int scale;
+	unsigned int live;		/* colors live across, from regalloc() */
+};
+
+#define	MAX_IR_USES 3
+
+/* IR register 0 is the pointer to the AR. */
+#define	RARP 0
+
+struct block {
+	struct ir *head;
+	struct ir *tail;
+	int label;			/* -1 if it doesn't start with one */
+	int *succs;
+	int nr_succs;
+	int *preds;
+	int nr_preds;
+	int rpo;			/* -1 if unreachable */
+	int idom;
+	int dead;
+};
+
+struct cfg {
+	struct block *blocks;
+	int nr_blocks;
+	int *edges;			/* succs and preds slices */
+	int nr_edges;
+	int *label_blocks;		/* block of each label - min_label */
+	int min_label;
+	int max_label;
+	int *rpo;			/* reachable blocks, reverse postorder */
+	int nr_rpo;
+	int *dom_kids;			/* dominator tree, slices by block */
+	int *dom_kids_start;
+};
+
+struct loop {
+	int header;
+	int preheader;			/* -1 if there isn't a single one */
+	int latch;			/* -1 if there are several */
+	char *body;			/* by block */
+	int size;
+};
+
+/*
+ * One step of the body of a vector loop, on the vector of each earlier
+ * step: a load or store at disp from the base register in args a, a
+ * broadcast of the register in args a (IR_MOV), or an ADD, SUB, AND, OR
+ * or XOR of the vectors of steps a and b. A store stores step b.
+ */
+struct vop {
+	int op;
+	int a;
+	int b;
+	long disp;
+};
+
+/*
+ * The body of an IR_VLOOP, whose args are the start and the bound of the
+ * counter and the registers the steps read, and whose o1 points here.
+ * It runs the loop over elements of size elem as many vectors at a time
+ * as it safely can and leaves the counter where it stopped in dst; the
+ * scalar loop does the rest.
+ */
+struct vloop {
+	int elem;
+	int cmp;			/* IR_LT or IR_LE */
+	struct vop *ops;
+	int nr_ops;
 };
 
 enum ir_op {
@@ -150,6 +227,11 @@ enum ir_op {
 	IR_SUB,
 	IR_MUL,
 	IR_DIV,
+	IR_MOD,
+	IR_MULH,			/* high 64 bits of the signed product */
+	IR_SHL,				/* shifts by a constant o2 */
+	IR_SHR,
+	IR_SAR,
 	IR_NOT,
 	IR_OR,
 	IR_AND,
@@ -167,6 +249,7 @@ enum ir_op {
 	IR_STORE8,
 	IR_KILL,
 	IR_ENTER,
+	IR_ARG,				/* parameter o1 as it came in */
 	IR_RET,
 	IR_MOV,
 	IR_EQ,
@@ -179,35 +262,40 @@ enum ir_op {
 	IR_JUMP,
 	IR_LABEL,
 	IR_CALL,
+	IR_PHI,
+	IR_VLOOP,			/* see struct vloop */
 	NR_IR_OPS,
 };
 
-#define	SYMTAB_SIZE 1021
-
 extern struct symtab *symtab;
+extern struct symbol *globals;
 extern struct symbol *strings;
 
 struct symbol {
-	struct symbol *next;
+	struct symbol *next;		/* globals or strings list */
 	char *name;
 	int loc;
 	int assigned;
 	int func;
 	int global;
+	int param;
+	int addr_taken;
+	int reg;			/* IR register, if promoted */
+	int reg_gen;
 	struct type *type;
 	struct node *body;
 	struct ir *ir;
 	struct param *params;
 	struct symtab *tab;
 	char *str;
+	struct func_stats *stats;
 };
 
 struct symtab {
-	struct symbol *tab[SYMTAB_SIZE];
-	struct _struct *structs[SYMTAB_SIZE];
 	struct symtab *prev;
 	int level;
 	int ar_offset;
+	unsigned int undo;
 };
 
 struct param {
@@ -216,7 +304,6 @@ struct param {
 		struct node *n;
 		struct symbol *sym;
 	};
-	int val;
 };
 
 struct type {
@@ -235,28 +322,330 @@ struct struct_field {
 };
 
 struct _struct {
-	struct _struct *next;
 	char *name;
 	struct type *type;
 	struct struct_field *fields;
 };
 
-void lex(FILE *f);
+struct arena {
+	struct arena_chunk *chunks;
+	char *cur;
+	char *end;
+};
+
+extern struct arena ast_arena;
+extern struct arena ir_arena;
+extern unsigned long arena_allocs;
+extern unsigned long arena_bytes;
+
+void *arena_alloc(struct arena *a, size_t size);
+void arena_free(struct arena *a);
+
+/* Interned identifiers: the string is preceded by its hash and length. */
+struct atom {
+	unsigned int hash;
+	unsigned int len;
+	char str[];
+};
+
+#define	atom_hash(s) (((struct atom *)(s) - 1)->hash)
+
+char *intern(const char *s, size_t len);
+
+enum phase {
+	PHASE_PARSE,
+	PHASE_IRGEN,
+	PHASE_OPT,
+	PHASE_EMIT,
+	NR_PHASES,
+};
+
+void stats_init(int report, char *trace_path);
+void phase_start(enum phase phase, struct symbol *fn);
+void phase_end(enum phase phase);
+void stats_finish(void);
+
+extern unsigned long lex_tokens;
+extern int lex_lines;
+
+void lex(int (*scan)(struct token *));
+void lex_next(void);
+struct token *lex_peek(void);
+void flex_open(FILE *f);
+int flex_token(struct token *t);
+void scan_open(FILE *f);
+int scan_token(struct token *t);
+
+struct type *type_base(int size);
+struct type *type_ptr(struct type *t);
+struct type *type_array(struct type *t, int n);
+struct type *type_struct(struct _struct *_st, int size);
 
-struct type *new_type(int size);
 void parse(void);
 
+char *ir_op_name(int op);
 void dump_ir_op(FILE *f, struct ir *ir);
 void dump_ir(void);
-void gen_ir(void);
+void gen_ir(struct symbol *s, int opt);
+struct ir *ir_alloc(int op, long o1, long o2, long dst);
+int ir_new_reg(void);
+int ir_nr_regs(void);
+int ir_uses(struct ir *ir, long **uses);
+int ir_defines(struct ir *ir);
+
+struct cfg *cfg_build(struct ir *head);
+struct ir *cfg_linearize(struct cfg *cfg, int *order, int nr_order);
+struct ir *block_last(struct block *b);
+void dump_cfg(struct cfg *cfg);
+struct ir *cfg_split_edges(struct ir *head);
+struct ir *cfg_add_preheaders(struct ir *head);
+void cfg_dominators(struct cfg *cfg);
+int dominates(struct cfg *cfg, int a, int b);
+int back_edge(struct cfg *cfg, int from, int to);
+void block_append(struct block *b, struct ir *ir);
+void cfg_remove_edge(struct cfg *cfg, int from, int to);
+
+void ssa_build(struct cfg *cfg);
+void ssa_destroy(struct cfg *cfg);
+void ssa_rename(struct cfg *cfg, long from, long to);
+void sccp(struct cfg *cfg);
+void strength_reduce(struct cfg *cfg);
+char *find_addresses(struct cfg *cfg);
+void value_number(struct cfg *cfg);
+int find_loops(struct cfg *cfg, struct loop **loops);
+void hoist_invariants(struct cfg *cfg);
+void vectorize(struct cfg *cfg);
+void reduce_induction(struct cfg *cfg);
+int dead_code(struct cfg *cfg);
+struct ir *strip_kills(struct ir *head);
+
+/* Live ranges over positions in list order, see live.c. */
+struct live {
+	struct ir **at;			/* instruction at each position */
+	int nr_pos;
+	int *first;			/* per IR register, INT_MAX if dead */
+	int *last;			/* -1 if dead */
+	int *depth;			/* loop nesting at each position */
+};
+
+struct live *live_ranges(struct ir *head);
+int *regalloc(struct ir *head, int nr_colors);
+
+/* Operand shapes in instruction selection patterns. */
+enum pat_shape {
+	P_NONE,				/* not a register operand */
+	P_REG,				/* left in a register */
+	P_IMM,				/* constant that fits in 32 bits */
+	P_MEM,				/* base + index * scale + disp */
+	P_FLAGS,			/* compare just before, its op in imm */
+};
+
+/* The first pattern for an op whose operands have the shapes wins. */
+struct pattern {
+	int op;
+	int o1;
+	int o2;
+	int dst;
+	void (*emit)(struct ir *ir);
+};
+
+struct ir *isel(struct ir *head, struct pattern *table, int nr_pats);
+
+extern int opt_level;
+extern int dce_report;
+extern int vector_loops;
+extern int inline_funcs;
+extern int inline_report;
+
+void fold_func(struct symbol *s);
+void opt_func(struct symbol *s);
+void inline_begin(struct symbol *s);
+int inline_call(struct node *call, int *lo, int *hi);
+void inline_end(void);
+
+extern int ir_comments;
+extern int x86_avx2;
+
+/* Registers regalloc() hands out; r10 and r11 are kept for reloads. */
+#define	NR_X86_ALLOC_REGS 10
+
+void emit_x86_data(void);
+void emit_x86_func(struct symbol *s);
+
+/* Hardware register numbers, as they are encoded. */
+enum x86_hw_reg {
+	X86_RAX,
+	X86_RCX,
+	X86_RDX,
+	X86_RBX,
+	X86_RSP,
+	X86_RBP,
+	X86_RSI,
+	X86_RDI,
+	X86_R8,
+	X86_R9,
+	X86_R10,
+	X86_R11,
+	X86_R12,
+	X86_R13,
+	X86_R14,
+	X86_R15,
+	NR_X86_HW_REGS,
+};
+
+enum as_op {
+	AS_ADD,
+	AS_SUB,
+	AS_AND,
+	AS_OR,
+	AS_XOR,
+	AS_CMP,
+	AS_TEST,
+	AS_MOV,
+	AS_XCHG,
+	AS_IMUL,
+	AS_SHL,
+	AS_SHR,
+	AS_SAR,
+	AS_MOVZB,
+	AS_LEA,
+	AS_NEG,
+	AS_IDIV,
+	AS_PUSH,
+	AS_POP,
+	AS_SETE,
+	AS_SETNE,
+	AS_SETL,
+	AS_SETLE,
+	AS_SETG,
+	AS_SETGE,
+	AS_JMP,
+	AS_JE,
+	AS_JNE,
+	AS_JL,
+	AS_JLE,
+	AS_JG,
+	AS_JGE,
+	AS_JB,
+	AS_JAE,
+	AS_CALL,
+	AS_LEAVE,
+	AS_RET,
+	AS_CQTO,
+	AS_MOVDQU,
+	AS_MOVDQA,
+	AS_MOVQ,
+	AS_PADDB,
+	AS_PADDD,
+	AS_PADDQ,
+	AS_PSUBB,
+	AS_PSUBD,
+	AS_PSUBQ,
+	AS_PAND,
+	AS_POR,
+	AS_PXOR,
+	AS_PUNPCKLBW,
+	AS_PUNPCKLWD,
+	AS_PUNPCKLQDQ,
+	AS_PSHUFD,			/* with $0 */
+	AS_PBROADCASTB,
+	AS_PBROADCASTD,
+	AS_PBROADCASTQ,
+	AS_VZEROUPPER,
+	NR_AS_OPS,
+};
+
+enum as_section {
+	AS_TEXT,
+	AS_DATA,
+	AS_RODATA,
+	NR_AS_SECTIONS,
+};
+
+void as_open(int object);
+void as_close(void);
+void as_comment(char *fmt, ...);
+void as_section(enum as_section sect);
+void as_global(char *name);
+void as_symbol(char *name);
+void as_skip(int n);
+void as_asciz(char *s);
+void as_label(int l);
+void as_rr(enum as_op op, int size, int src, int dst);
+void as_ri(enum as_op op, int size, long imm, int dst);
+void as_r(enum as_op op, int size, int r);
+void as_rri(enum as_op op, int size, long imm, int src, int dst);
+void as_load(enum as_op op, int size, int base, int index, int scale,
+    int disp, int dst);
+void as_store(int size, int src, int base, int index, int scale, int disp);
+void as_sym(enum as_op op, char *sym, int dst);
+void as_jmp(enum as_op op, int label);
+void as_op(enum as_op op);
+void as_vload(int size, int base, int index, int scale, int disp, int dst);
+void as_vstore(int size, int src, int base, int index, int scale, int disp);
+void as_vrr(enum as_op op, int size, int src, int src2, int dst);
+void as_record(void);
+void as_replay(int peep);
+
+/* An instruction as_record() held back, named after the as_ call. */
+enum mi_kind {
+	MI_DEAD,
+	MI_COMMENT,
+	MI_LABEL,
+	MI_RR,
+	MI_RI,
+	MI_R,
+	MI_RRI,
+	MI_LOAD,
+	MI_STORE,
+	MI_SYM,
+	MI_JMP,
+	MI_OP,
+	MI_VLOAD,
+	MI_VSTORE,
+	MI_VRR,
+};
+
+struct minst {
+	int kind;
+	enum as_op op;
+	int size;
+	int src;
+	int src2;
+	int dst;			/* also the register of MI_R */
+	int base;
+	int index;
+	int scale;
+	int disp;
+	long imm;			/* also the label of MI_LABEL, MI_JMP */
+	char *sym;			/* also the text of MI_COMMENT */
+};
+
+extern int peep_report;
+
+void peephole(struct minst *mi, int n);
+void peephole_stats(void);
+
+void elf_bytes(enum as_section sect, const void *p, size_t len);
+unsigned long elf_offset(enum as_section sect);
+void elf_patch32(enum as_section sect, unsigned long off, int v);
+void elf_symbol(char *name, enum as_section sect);
+void elf_global(char *name);
+void elf_reloc(unsigned long off, char *name, int type, long addend);
+void elf_write(void);
 
-void emit_x86(void);
+void out_open(char *path);
+void out_close(void);
+void out_write(const char *s, size_t len);
+void out_char(int c);
+void out_str(const char *s);
+void out_long(long v);
+void out_vfmt(const char *fmt, va_list ap);
 
 struct symbol *add_sym(char *name, struct type *type);
 struct symbol *add_string(char *str);
 struct _struct *add_struct(char *name);
 struct symbol *find_sym(char *name);
-struct symbol *find_global_sym(char *name);
 struct _struct *find_struct(char *name);
 void new_symtab(void);
 void del_symtab(void);
@@ -0,0 +1,200 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <err.h>
+
+#include "rcc.h"
+
+/*
+ * Linear scan register allocation (Poletto and Sarkar) over the live
+ * ranges of a laid out function. The ranges are visited by start; when
+ * all colors are taken, the range with the lowest spill cost per position
+ * it covers goes to a stack slot for its whole life. Uses and definitions
+ * inside loops count 8 times as much per level of nesting, which keeps
+ * loop counters and accumulators in registers.
+ *
+ * The result is indexed by IR register: a color from 1 to nr_colors, or
+ * -1 - slot for a register that was spilled. Spill slots are 8 bytes each
+ * and added to the frame size in the ENTER. Every instruction gets the
+ * mask of colors live across it, for what has to be saved around calls
+ * and divisions.
+ */
+
+#define	MAX_DEPTH 5
+
+struct interval {
+	int reg;
+	int start;
+	int end;
+	long cost;
+};
+
+static int *locs;
+static int *slot_end;
+static int nr_slots, max_slots;
+
+static int
+cmp_start(const void *a, const void *b)
+{
+	const struct interval *x = a, *y = b;
+
+	if (x->start != y->start)
+		return (x->start - y->start);
+	return (x->reg - y->reg);
+}
+
+/* Whether a is cheaper to keep in memory than b. */
+static int
+cheaper(struct interval *a, struct interval *b)
+{
+	long la, lb;
+
+	la = a->end - a->start + 1;
+	lb = b->end - b->start + 1;
+	if (a->cost * lb != b->cost * la)
+		return (a->cost * lb < b->cost * la);
+	return (a->end > b->end);
+}
+
+static void
+spill(struct interval *iv)
+{
+	int i;
+
+	for (i = 0; i < nr_slots; i++)
+		if (slot_end[i] < iv->start)
+			break;
+	if (i == nr_slots) {
+		if (nr_slots == max_slots) {
+			max_slots = max_slots ? max_slots * 2 : 16;
+			if ((slot_end = realloc(slot_end, max_slots *
+			    sizeof(int))) == NULL)
+				err(1, "realloc");
+		}
+		nr_slots++;
+	}
+	slot_end[i] = iv->end;
+	locs[iv->reg] = -1 - i;
+}
+
+/* Add iv to the active ranges, which are kept sorted by end. */
+static void
+activate(struct interval **active, int *nr_active, struct interval *iv)
+{
+	int i;
+
+	for (i = *nr_active; i > 0 && active[i - 1]->end > iv->end; i--)
+		active[i] = active[i - 1];
+	active[i] = iv;
+	(*nr_active)++;
+}
+
+static void
+scan(struct interval *ivs, int nr_ivs, int nr_colors)
+{
+	struct interval **active, *iv, *victim;
+	unsigned int free;
+	int i, j, nr_active, v;
+
+	active = arena_alloc(&ir_arena, (nr_colors + 1) *
+	    sizeof(struct interval *));
+	nr_active = 0;
+	free = ((1U << nr_colors) - 1) << 1;
+	for (i = 0; i < nr_ivs; i++) {
+		iv = &ivs[i];
+		for (j = 0; j < nr_active && active[j]->end < iv->start; j++)
+			free |= 1U << locs[active[j]->reg];
+		memmove(active, active + j, (nr_active - j) *
+		    sizeof(struct interval *));
+		nr_active -= j;
+
+		if (free) {
+			locs[iv->reg] = ffs(free) - 1;
+			free &= ~(1U << locs[iv->reg]);
+			activate(active, &nr_active, iv);
+			continue;
+		}
+		victim = iv;
+		for (j = 0, v = -1; j < nr_active; j++)
+			if (cheaper(active[j], victim)) {
+				victim = active[j];
+				v = j;
+			}
+		if (victim == iv) {
+			spill(iv);
+			continue;
+		}
+		locs[iv->reg] = locs[victim->reg];
+		memmove(active + v, active + v + 1, (nr_active - v - 1) *
+		    sizeof(struct interval *));
+		nr_active--;
+		spill(victim);
+		activate(active, &nr_active, iv);
+	}
+}
+
+int *
+regalloc(struct ir *head, int nr_colors)
+{
+	struct interval *ivs;
+	struct live *l;
+	struct ir *ir;
+	unsigned int *across;
+	long *u[MAX_IR_USES], w;
+	int i, j, k, n, nr_ivs, pos;
+
+	l = live_ranges(head);
+	n = ir_nr_regs();
+	locs = arena_alloc(&ir_arena, n * sizeof(int));
+	ivs = arena_alloc(&ir_arena, n * sizeof(struct interval));
+	nr_ivs = 0;
+	for (i = 1; i < n; i++) {
+		if (l->last[i] == -1)
+			continue;
+		ivs[i].reg = i;
+		ivs[i].start = l->first[i];
+		ivs[i].end = l->last[i];
+	}
+
+	for (pos = 0; pos < l->nr_pos; pos++) {
+		ir = l->at[pos];
+		for (w = 1, j = 0; j < l->depth[pos] && j < MAX_DEPTH; j++)
+			w *= 8;
+		k = ir_uses(ir, u);
+		for (j = 0; j < k; j++)
+			ivs[*u[j]].cost += w;
+		for (j = 0; j < ir->nr_args; j++)
+			ivs[ir->args[j]].cost += w;
+		if (ir_defines(ir))
+			ivs[ir->dst].cost += w;
+	}
+	for (i = 1; i < n; i++)
+		if (l->last[i] != -1)
+			ivs[nr_ivs++] = ivs[i];
+	qsort(ivs, nr_ivs, sizeof(struct interval), cmp_start);
+
+	nr_slots = 0;
+	scan(ivs, nr_ivs, nr_colors);
+
+	/*
+	 * Colors are toggled on just after the start of a range and off at
+	 * its end; the ranges of one color don't overlap.
+	 */
+	across = arena_alloc(&ir_arena, (l->nr_pos + 1) *
+	    sizeof(unsigned int));
+	for (i = 0; i < nr_ivs; i++)
+		if (locs[ivs[i].reg] > 0 && ivs[i].end > ivs[i].start + 1) {
+			across[ivs[i].start + 1] ^= 1U << locs[ivs[i].reg];
+			across[ivs[i].end] ^= 1U << locs[ivs[i].reg];
+		}
+	for (pos = 0; pos < l->nr_pos; pos++) {
+		if (pos)
+			across[pos] ^= across[pos - 1];
+		ir = l->at[pos];
+		ir->live = across[pos];
+		if (ir->op == IR_ENTER)
+			ir->o1 += nr_slots * 8;
+	}
+	return (locs);
+}
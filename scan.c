@@ -0,0 +1,604 @@
+#include <sys/types.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <err.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "rcc.h"
+
+/*
+ * Hand-written scanner over a memory-mapped source file. It accepts
+ * exactly the language of lex.l and produces the same token stream.
+ *
+ * The mapping is followed by at least SCAN_PAD zero bytes so the vector
+ * loops below can load 16 bytes at any position up to the end of the
+ * input without bounds checks: NUL is in none of the character classes
+ * they skip over.
+ */
+#define	SCAN_PAD 64
+
+static char *buf;
+static size_t buf_len;
+static int buf_mapped;
+static const char *cur;
+static const char *end;
+static int lineno;
+static int scan_eof;
+
+/* Perfect hash over the keywords, see kw_hash(). */
+#define	KW_HASH_SIZE 64
+
+static const struct {
+	const char *name;
+	int tok;
+} keywords[KW_HASH_SIZE] = {
+	[1] = { "for", TOK_FOR },
+	[4] = { "case", TOK_CASE },
+	[8] = { "auto", TOK_AUTO },
+	[11] = { "unsigned", TOK_UNSIGNED },
+	[12] = { "continue", TOK_CONTINUE },
+	[14] = { "goto", TOK_GOTO },
+	[15] = { "struct", TOK_STRUCT },
+	[17] = { "long", TOK_LONG },
+	[18] = { "union", TOK_UNION },
+	[19] = { "while", TOK_WHILE },
+	[22] = { "inline", TOK_INLINE },
+	[23] = { "typedef", TOK_TYPEDEF },
+	[24] = { "const", TOK_CONST },
+	[25] = { "double", TOK_DOUBLE },
+	[27] = { "float", TOK_FLOAT },
+	[29] = { "default", TOK_DEFAULT },
+	[31] = { "do", TOK_DO },
+	[32] = { "enum", TOK_ENUM },
+	[34] = { "int", TOK_INT },
+	[35] = { "if", TOK_IF },
+	[36] = { "void", TOK_VOID },
+	[37] = { "signed", TOK_SIGNED },
+	[38] = { "short", TOK_SHORT },
+	[39] = { "sizeof", TOK_SIZEOF },
+	[40] = { "return", TOK_RETURN },
+	[41] = { "volatile", TOK_VOLATILE },
+	[42] = { "break", TOK_BREAK },
+	[45] = { "switch", TOK_SWITCH },
+	[46] = { "register", TOK_REGISTER },
+	[47] = { "extern", TOK_EXTERN },
+	[48] = { "restrict", TOK_RESTRICT },
+	[51] = { "char", TOK_CHAR },
+	[60] = { "else", TOK_ELSE },
+	[62] = { "static", TOK_STATIC },
+};
+
+#define	KW_MIN_LEN 2
+#define	KW_MAX_LEN 8
+
+static unsigned int
+kw_hash(const char *s, int len)
+{
+	return ((s[0] * 15 + s[1] * 14 + s[len - 1] + len) &
+	    (KW_HASH_SIZE - 1));
+}
+
+static int
+keyword(const char *s, int len)
+{
+	const char *name;
+	unsigned int h;
+
+	if (len < KW_MIN_LEN || len > KW_MAX_LEN)
+		return (0);
+	h = kw_hash(s, len);
+	name = keywords[h].name;
+	if (name && !strncmp(name, s, len) && name[len] == '\0')
+		return (keywords[h].tok);
+	return (0);
+}
+
+#ifdef __SSE2__
+static unsigned int
+ws_mask(__m128i v)
+{
+	__m128i m;
+
+	m = _mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8(' ')),
+	    _mm_cmpeq_epi8(v, _mm_set1_epi8('\t')));
+	m = _mm_or_si128(m, _mm_cmpeq_epi8(v, _mm_set1_epi8('\n')));
+	return (_mm_movemask_epi8(m));
+}
+
+static __m128i
+in_range(__m128i v, char lo, char hi)
+{
+	return (_mm_and_si128(_mm_cmpgt_epi8(v, _mm_set1_epi8(lo - 1)),
+	    _mm_cmplt_epi8(v, _mm_set1_epi8(hi + 1))));
+}
+
+static unsigned int
+id_mask(__m128i v)
+{
+	__m128i m;
+
+	/* Setting bit 5 folds 'A'-'Z' onto 'a'-'z' and keeps digits. */
+	m = in_range(_mm_or_si128(v, _mm_set1_epi8(0x20)), 'a', 'z');
+	m = _mm_or_si128(m, in_range(v, '0', '9'));
+	m = _mm_or_si128(m, _mm_cmpeq_epi8(v, _mm_set1_epi8('_')));
+	return (_mm_movemask_epi8(m));
+}
+
+static unsigned int
+hex_mask(__m128i v)
+{
+	__m128i m;
+
+	m = in_range(_mm_or_si128(v, _mm_set1_epi8(0x20)), 'a', 'f');
+	m = _mm_or_si128(m, in_range(v, '0', '9'));
+	return (_mm_movemask_epi8(m));
+}
+
+static unsigned int
+digit_mask(__m128i v)
+{
+	return (_mm_movemask_epi8(in_range(v, '0', '9')));
+}
+
+/* Return the first position at or after p whose byte is not in class. */
+static const char *
+skip_class(const char *p, unsigned int (*class)(__m128i))
+{
+	unsigned int m;
+
+	for (;;) {
+		m = class(_mm_loadu_si128((const __m128i *)p)) ^ 0xffff;
+		if (m)
+			return (p + __builtin_ctz(m));
+		p += 16;
+	}
+}
+
+/* Skip blanks and newlines, counting the latter. */
+static const char *
+skip_ws(const char *p)
+{
+	__m128i v;
+	unsigned int m, nl;
+	int n;
+
+	for (;;) {
+		v = _mm_loadu_si128((const __m128i *)p);
+		m = ws_mask(v) ^ 0xffff;
+		nl = _mm_movemask_epi8(_mm_cmpeq_epi8(v, _mm_set1_epi8('\n')));
+		if (m) {
+			n = __builtin_ctz(m);
+			lineno += __builtin_popcount(nl & ((1U << n) - 1));
+			return (p + n);
+		}
+		lineno += __builtin_popcount(nl);
+		p += 16;
+	}
+}
+
+/* Return the first position at or after p holding c1, c2 or NUL. */
+static const char *
+find2(const char *p, char c1, char c2)
+{
+	__m128i v;
+	unsigned int m;
+
+	for (;;) {
+		v = _mm_loadu_si128((const __m128i *)p);
+		m = _mm_movemask_epi8(_mm_or_si128(_mm_or_si128(
+		    _mm_cmpeq_epi8(v, _mm_set1_epi8(c1)),
+		    _mm_cmpeq_epi8(v, _mm_set1_epi8(c2))),
+		    _mm_cmpeq_epi8(v, _mm_setzero_si128())));
+		if (m)
+			return (p + __builtin_ctz(m));
+		p += 16;
+	}
+}
+#else
+static int
+is_id(int c)
+{
+	return ((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') ||
+	    (c >= '0' && c <= '9') || c == '_');
+}
+
+static int
+is_hex(int c)
+{
+	return ((c >= 'a' && c <= 'f') || (c >= 'A' && c <= 'F') ||
+	    (c >= '0' && c <= '9'));
+}
+
+static int
+is_digit(int c)
+{
+	return (c >= '0' && c <= '9');
+}
+
+static const char *
+skip_class(const char *p, int (*class)(int))
+{
+	while (class(*p))
+		p++;
+	return (p);
+}
+
+static const char *
+skip_ws(const char *p)
+{
+	while (*p == ' ' || *p == '\t' || *p == '\n')
+		if (*p++ == '\n')
+			lineno++;
+	return (p);
+}
+
+static const char *
+find2(const char *p, char c1, char c2)
+{
+	while (*p && *p != c1 && *p != c2)
+		p++;
+	return (p);
+}
+
+#define	id_mask is_id
+#define	hex_mask is_hex
+#define	digit_mask is_digit
+#endif
+
+static int
+scan_error(const char *p, int len)
+{
+	printf("syntax error at line %d \"%.*s\"\n", lineno, len, p);
+	scan_eof = 1;
+	return (TOK_EOF);
+}
+
+/* Skip a comment whose opening slash-star is at p. */
+static const char *
+skip_comment(const char *p)
+{
+	p += 2;
+	for (;;) {
+		p = find2(p, '*', '\n');
+		if (p >= end)
+			return (end);
+		if (*p++ == '\n')
+			lineno++;
+		else if (*p == '/')
+			return (p + 1);
+	}
+}
+
+/* Skip the preprocessor lines lex.l ignores; return NULL on others. */
+static const char *
+skip_cpp(const char *p)
+{
+	static const struct {
+		const char *s;
+		int rest;
+	} cpp[] = {
+		{ "#define", 1 },
+		{ "#include", 1 },
+		{ "#ifdef", 1 },
+		{ "#ifndef", 1 },
+		{ "#endif", 0 },
+		{ "#else", 0 },
+	};
+	size_t i, len;
+
+	if (p != buf && p[-1] != '\n')
+		return (NULL);
+	if (!strncmp(p, "#if", 3) && (p[3] == ' ' || p[3] == '\t') &&
+	    p[4] && p[4] != '\n')
+		return (find2(p + 4, '\n', '\n'));
+	for (i = 0; i < sizeof(cpp) / sizeof(cpp[0]); i++) {
+		len = strlen(cpp[i].s);
+		if (strncmp(p, cpp[i].s, len))
+			continue;
+		if (!cpp[i].rest)
+			return (p + len);
+		if (p[len] && p[len] != '\n')
+			return (find2(p + len, '\n', '\n'));
+	}
+	return (NULL);
+}
+
+static int
+char_constant(struct token *t, const char *p, int len)
+{
+	long v;
+
+	if (p[1] != '\\') {
+		t->val = p[1];
+		return (TOK_CONSTANT);
+	}
+	switch (p[2]) {
+	case 'a':
+		v = '\a';
+		break;
+	case 'b':
+		v = '\b';
+		break;
+	case 'f':
+		v = '\f';
+		break;
+	case 'n':
+		v = '\n';
+		break;
+	case 'r':
+		v = '\r';
+		break;
+	case 't':
+		v = '\t';
+		break;
+	case 'v':
+		v = '\v';
+		break;
+	case '\'':
+		v = '\'';
+		break;
+	case '\"':
+		v = '\"';
+		break;
+	case '\?':
+		v = '\"';
+		break;
+	case '\\':
+		v = '\\';
+		break;
+	case '0':
+	case '1':
+	case '2':
+	case '3':
+	case '4':
+	case '5':
+	case '6':
+	case '7':
+		v = strtol(p + 2, NULL, 8);
+		break;
+	case 'x':
+		v = strtol(p + 3, NULL, 16);
+		break;
+	default:
+		printf("syntax error at line %d %.*s\n", lineno, len, p);
+		scan_eof = 1;
+		return (TOK_EOF);
+	}
+	t->val = v;
+	return (TOK_CONSTANT);
+}
+
+static int
+punct(const char *p, int *len)
+{
+	*len = 1;
+	switch (p[0]) {
+	case '[':
+	case ']':
+	case '(':
+	case ')':
+	case '{':
+	case '}':
+	case '~':
+	case '?':
+	case ':':
+	case ';':
+	case ',':
+		return (p[0]);
+	case '.':
+		if (p[1] == '.' && p[2] == '.') {
+			*len = 3;
+			return (TOK_ELL);
+		}
+		return ('.');
+	case '-':
+		*len = 2;
+		if (p[1] == '>')
+			return (TOK_PTR);
+		if (p[1] == '-')
+			return (TOK_DECR);
+		if (p[1] == '=')
+			return (TOK_ASSSUB);
+		*len = 1;
+		return ('-');
+	case '+':
+		*len = 2;
+		if (p[1] == '+')
+			return (TOK_INCR);
+		if (p[1] == '=')
+			return (TOK_ASSADD);
+		*len = 1;
+		return ('+');
+	case '&':
+		*len = 2;
+		if (p[1] == '&')
+			return (TOK_AND);
+		if (p[1] == '=')
+			return (TOK_ASSAND);
+		*len = 1;
+		return ('&');
+	case '|':
+		*len = 2;
+		if (p[1] == '|')
+			return (TOK_OR);
+		if (p[1] == '=')
+			return (TOK_ASSOR);
+		*len = 1;
+		return ('|');
+	case '<':
+	case '>':
+		if (p[1] == p[0]) {
+			*len = p[2] == '=' ? 3 : 2;
+			if (p[0] == '<')
+				return (*len == 3 ? TOK_ASSSL : TOK_SL);
+			return (*len == 3 ? TOK_ASSSR : TOK_SR);
+		}
+		if (p[1] == '=') {
+			*len = 2;
+			return (p[0] == '<' ? TOK_LE : TOK_GE);
+		}
+		return (p[0] == '<' ? TOK_LT : TOK_GT);
+	case '*':
+	case '/':
+	case '%':
+	case '^':
+	case '=':
+	case '!':
+		if (p[1] != '=')
+			return (p[0]);
+		*len = 2;
+		switch (p[0]) {
+		case '*':
+			return (TOK_ASSMUL);
+		case '/':
+			return (TOK_ASSDIV);
+		case '%':
+			return (TOK_ASSMOD);
+		case '^':
+			return (TOK_ASSXOR);
+		case '=':
+			return (TOK_EQ);
+		default:
+			return (TOK_NE);
+		}
+	default:
+		return (0);
+	}
+}
+
+int
+scan_token(struct token *t)
+{
+	const char *p, *q;
+	int len, _tok;
+
+	if (scan_eof)
+		return (t->tok = TOK_EOF);
+
+	p = cur;
+	for (;;) {
+		p = skip_ws(p);
+		if (p[0] == '/' && p[1] == '/')
+			p = find2(p, '\n', '\n');
+		else if (p[0] == '/' && p[1] == '*')
+			p = skip_comment(p);
+		else if (p[0] == '#' && (q = skip_cpp(p)) != NULL)
+			p = q;
+		else
+			break;
+	}
+
+	t->line = lineno;
+	if (p >= end) {
+		cur = end;
+		return (t->tok = TOK_EOF);
+	}
+
+	if ((p[0] >= 'a' && p[0] <= 'z') || (p[0] >= 'A' && p[0] <= 'Z') ||
+	    p[0] == '_') {
+		q = skip_class(p + 1, id_mask);
+		len = q - p;
+		if ((_tok = keyword(p, len)) == 0) {
+			_tok = TOK_ID;
+			t->str = intern(p, len);
+		}
+	} else if (p[0] >= '0' && p[0] <= '9') {
+		if (p[0] == '0' && (p[1] == 'x' || p[1] == 'X') &&
+		    ((p[2] >= '0' && p[2] <= '9') ||
+		    ((p[2] | 0x20) >= 'a' && (p[2] | 0x20) <= 'f')))
+			q = skip_class(p + 2, hex_mask);
+		else
+			q = skip_class(p, digit_mask);
+		_tok = TOK_CONSTANT;
+		t->val = strtol(p, NULL, 0);
+	} else if (p[0] == '"') {
+		q = find2(p + 1, '"', '\n');
+		if (*q != '"' || q == p + 1)
+			return (scan_error(p, 1));
+		len = q - p - 1;
+		t->str = arena_alloc(&ast_arena, len + 1);
+		memcpy(t->str, p + 1, len);
+		_tok = TOK_STRING;
+		q++;
+	} else if (p[0] == '\'') {
+		q = find2(p + 1, '\'', '\n');
+		if (*q != '\'' || q == p + 1)
+			return (scan_error(p, 1));
+		q++;
+		_tok = char_constant(t, p, q - p);
+	} else {
+		if ((_tok = punct(p, &len)) == 0)
+			return (scan_error(p, 1));
+		q = p + len;
+	}
+
+	cur = q;
+	return (t->tok = _tok);
+}
+
+void
+scan_open(FILE *f)
+{
+	struct stat st;
+	size_t len, n, pgsz;
+	char *p;
+	int fd;
+
+	if (buf_mapped)
+		munmap(buf, buf_len);
+	else
+		free(buf);
+	buf = NULL;
+	lineno = 1;
+	scan_eof = 0;
+
+	fd = fileno(f);
+	if (fstat(fd, &st) == -1)
+		err(1, "fstat");
+
+	if (S_ISREG(st.st_mode) && st.st_size > 0) {
+		/*
+		 * Reserve room for the padding first, then map the file over
+		 * the start of it: both the tail of the file's last page and
+		 * the anonymous pages after it read as zeros.
+		 */
+		pgsz = getpagesize();
+		len = (st.st_size + SCAN_PAD + pgsz - 1) & ~(pgsz - 1);
+		p = mmap(NULL, len, PROT_READ, MAP_PRIVATE | MAP_ANON, -1, 0);
+		if (p == MAP_FAILED)
+			err(1, "mmap");
+		if (mmap(p, st.st_size, PROT_READ, MAP_PRIVATE | MAP_FIXED, fd,
+		    0) == MAP_FAILED)
+			err(1, "mmap");
+		madvise(p, st.st_size, MADV_SEQUENTIAL);
+		buf = p;
+		buf_len = len;
+		buf_mapped = 1;
+		n = st.st_size;
+	} else {
+		/* Pipes and terminals can't be mapped, read them instead. */
+		len = 64 * 1024;
+		if ((buf = malloc(len + SCAN_PAD)) == NULL)
+			err(1, "malloc");
+		n = 0;
+		while ((n += fread(buf + n, 1, len - n, f)) == len) {
+			len *= 2;
+			if ((buf = realloc(buf, len + SCAN_PAD)) == NULL)
+				err(1, "realloc");
+		}
+		if (ferror(f))
+			err(1, "fread");
+		memset(buf + n, 0, SCAN_PAD);
+		buf_len = len + SCAN_PAD;
+		buf_mapped = 0;
+	}
+
+	cur = buf;
+	end = buf + n;
+}
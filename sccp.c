@@ -0,0 +1,452 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <err.h>
+
+#include "rcc.h"
+
+/*
+ * Sparse conditional constant propagation (Wegman and Zadeck) over the
+ * SSA form. Values start out unknown and only ever move down to a
+ * constant and then to varying; instructions are only evaluated once
+ * their block has been found reachable, so a branch on a constant keeps
+ * the code it skips from spoiling anything. Afterwards constant results
+ * are loaded as immediates, constant branches become jumps and the blocks
+ * that were never reached are dropped.
+ */
+
+enum {
+	VAL_TOP,
+	VAL_CONST,
+	VAL_BOTTOM,
+};
+
+struct val {
+	int state;
+	long c;
+};
+
+struct use {
+	struct ir *ir;
+	int b;
+};
+
+struct edge {
+	int from;
+	int to;
+};
+
+static struct cfg *cfg;
+static struct val *vals;
+static char *exec_blocks;
+static char *exec_edges;		/* parallel to cfg->edges succs */
+static struct use *uses, **use_start;
+
+static struct edge *flow_work;
+static int nr_flow_work, max_flow_work;
+static struct use *ssa_work;
+static int nr_ssa_work, max_ssa_work;
+
+static void
+push_flow(int from, int to)
+{
+	if (nr_flow_work == max_flow_work) {
+		max_flow_work = max_flow_work ? max_flow_work * 2 : 256;
+		if ((flow_work = realloc(flow_work, max_flow_work *
+		    sizeof(struct edge))) == NULL)
+			err(1, "realloc");
+	}
+	flow_work[nr_flow_work].from = from;
+	flow_work[nr_flow_work++].to = to;
+}
+
+static void
+push_ssa(struct use *u)
+{
+	if (nr_ssa_work == max_ssa_work) {
+		max_ssa_work = max_ssa_work ? max_ssa_work * 2 : 256;
+		if ((ssa_work = realloc(ssa_work, max_ssa_work *
+		    sizeof(struct use))) == NULL)
+			err(1, "realloc");
+	}
+	ssa_work[nr_ssa_work++] = *u;
+}
+
+static int
+edge_index(int from, int to)
+{
+	struct block *b;
+	int i;
+
+	b = &cfg->blocks[from];
+	for (i = 0; b->succs[i] != to; i++)
+		;
+	return (b->succs + i - cfg->edges);
+}
+
+/* Every instruction reading each register, as slices of one array. */
+static void
+build_uses(void)
+{
+	struct block *b;
+	struct ir *ir;
+	long *u[MAX_IR_USES];
+	int *count;
+	int i, j, k, n;
+
+	n = ir_nr_regs();
+	count = arena_alloc(&ir_arena, (n + 1) * sizeof(int));
+	for (i = 0; i < cfg->nr_blocks; i++) {
+		b = &cfg->blocks[i];
+		if (b->dead)
+			continue;
+		for (ir = b->head;; ir = ir->next) {
+			k = ir_uses(ir, u);
+			for (j = 0; j < k; j++)
+				count[*u[j] + 1]++;
+			for (j = 0; j < ir->nr_args; j++)
+				count[ir->args[j] + 1]++;
+			if (ir == b->tail)
+				break;
+		}
+	}
+	for (i = 0; i < n; i++)
+		count[i + 1] += count[i];
+	uses = arena_alloc(&ir_arena, (count[n] + 1) * sizeof(struct use));
+	use_start = arena_alloc(&ir_arena, (n + 1) * sizeof(struct use *));
+	for (i = 0; i <= n; i++)
+		use_start[i] = uses + count[i];
+	for (i = 0; i < cfg->nr_blocks; i++) {
+		b = &cfg->blocks[i];
+		if (b->dead)
+			continue;
+		for (ir = b->head;; ir = ir->next) {
+			k = ir_uses(ir, u);
+			for (j = 0; j < k; j++) {
+				uses[count[*u[j]]].ir = ir;
+				uses[count[*u[j]]++].b = i;
+			}
+			for (j = 0; j < ir->nr_args; j++) {
+				uses[count[ir->args[j]]].ir = ir;
+				uses[count[ir->args[j]]++].b = i;
+			}
+			if (ir == b->tail)
+				break;
+		}
+	}
+}
+
+static void
+lower(long reg, struct val *v)
+{
+	struct val *old;
+	struct use *u;
+
+	old = &vals[reg];
+	if (old->state == VAL_BOTTOM || v->state == VAL_TOP ||
+	    (old->state == v->state && old->c == v->c))
+		return;
+	if (old->state == VAL_CONST && v->state == VAL_CONST)
+		old->state = VAL_BOTTOM;
+	else
+		*old = *v;
+	for (u = use_start[reg]; u < use_start[reg + 1]; u++)
+		push_ssa(u);
+}
+
+static long
+zext(long c, int size)
+{
+	if (size == 1)
+		return (c & 0xff);
+	if (size == 4)
+		return (c & 0xffffffffL);
+	return (c);
+}
+
+/* Fold a binary operation on two constants; 0 if it can't be. */
+static int
+fold(int op, long a, long b, long *c)
+{
+	unsigned long ua, ub;
+
+	ua = a;
+	ub = b;
+	switch (op) {
+	case IR_ADD:
+		*c = ua + ub;
+		break;
+	case IR_SUB:
+		*c = ua - ub;
+		break;
+	case IR_MUL:
+		*c = ua * ub;
+		break;
+	case IR_DIV:
+		if (b == 0 || (a == LONG_MIN && b == -1))
+			return (0);
+		*c = a / b;
+		break;
+	case IR_MOD:
+		if (b == 0 || (a == LONG_MIN && b == -1))
+			return (0);
+		*c = a % b;
+		break;
+	case IR_OR:
+		*c = a | b;
+		break;
+	case IR_AND:
+		*c = a & b;
+		break;
+	case IR_XOR:
+		*c = a ^ b;
+		break;
+	case IR_EQ:
+		*c = a == b;
+		break;
+	case IR_NE:
+		*c = a != b;
+		break;
+	case IR_LT:
+		*c = a < b;
+		break;
+	case IR_LE:
+		*c = a <= b;
+		break;
+	case IR_GT:
+		*c = a > b;
+		break;
+	case IR_GE:
+		*c = a >= b;
+		break;
+	default:
+		return (0);
+	}
+	return (1);
+}
+
+static void
+eval_phi(struct ir *ir, int i)
+{
+	struct block *b;
+	struct val v, *a;
+	int j;
+
+	b = &cfg->blocks[i];
+	v.state = VAL_TOP;
+	v.c = 0;
+	for (j = 0; j < b->nr_preds && v.state != VAL_BOTTOM; j++) {
+		if (!exec_edges[edge_index(b->preds[j], i)])
+			continue;
+		a = &vals[ir->args[j]];
+		if (a->state == VAL_TOP)
+			continue;
+		if (a->state == VAL_BOTTOM || (v.state == VAL_CONST &&
+		    v.c != a->c))
+			v.state = VAL_BOTTOM;
+		else
+			v = *a;
+	}
+	lower(ir->dst, &v);
+}
+
+static void
+eval_branch(struct ir *ir, int i)
+{
+	struct block *b, *s;
+	struct val *c;
+	int k;
+
+	b = &cfg->blocks[i];
+	c = &vals[ir->o1];
+	if (c->state == VAL_TOP)
+		return;
+	for (k = 0; k < b->nr_succs; k++) {
+		s = &cfg->blocks[b->succs[k]];
+		if (c->state == VAL_BOTTOM ||
+		    s->label == (c->c ? ir->o2 : ir->dst))
+			push_flow(i, b->succs[k]);
+	}
+}
+
+static void
+eval(struct ir *ir, int i)
+{
+	struct val v, *a, *b;
+
+	if (ir->op == IR_PHI) {
+		eval_phi(ir, i);
+		return;
+	}
+	if (ir->op == IR_CBR) {
+		eval_branch(ir, i);
+		return;
+	}
+	if (!ir_defines(ir))
+		return;
+
+	v.state = VAL_BOTTOM;
+	v.c = 0;
+	switch (ir->op) {
+	case IR_LOADI:
+		v.state = VAL_CONST;
+		v.c = ir->o1;
+		break;
+	case IR_MOV:
+	case IR_NOT:
+		a = &vals[ir->o1];
+		v = *a;
+		if (a->state == VAL_CONST)
+			v.c = ir->op == IR_NOT ? !a->c : zext(a->c, ir->o2);
+		break;
+	case IR_ADD:
+	case IR_SUB:
+	case IR_MUL:
+	case IR_DIV:
+	case IR_MOD:
+	case IR_OR:
+	case IR_AND:
+	case IR_XOR:
+	case IR_EQ:
+	case IR_NE:
+	case IR_LT:
+	case IR_LE:
+	case IR_GT:
+	case IR_GE:
+		a = &vals[ir->o1];
+		b = &vals[ir->o2];
+		if (a->state == VAL_TOP || b->state == VAL_TOP)
+			v.state = VAL_TOP;
+		else if (a->state == VAL_CONST && b->state == VAL_CONST &&
+		    fold(ir->op, a->c, b->c, &v.c))
+			v.state = VAL_CONST;
+		break;
+	}
+	lower(ir->dst, &v);
+}
+
+static void
+visit_block(int i)
+{
+	struct block *b;
+	struct ir *ir;
+	int k;
+
+	b = &cfg->blocks[i];
+	for (ir = b->head;; ir = ir->next) {
+		eval(ir, i);
+		if (ir == b->tail)
+			break;
+	}
+	ir = b->tail;
+	if (ir->op != IR_CBR && ir->op != IR_RET)
+		for (k = 0; k < b->nr_succs; k++)
+			push_flow(i, b->succs[k]);
+}
+
+static void
+visit_phis(int i)
+{
+	struct block *b;
+	struct ir *ir;
+
+	b = &cfg->blocks[i];
+	for (ir = b->head;; ir = ir->next) {
+		if (ir->op == IR_PHI)
+			eval_phi(ir, i);
+		if (ir == b->tail)
+			break;
+	}
+}
+
+static void
+propagate(void)
+{
+	struct edge e;
+	struct use u;
+	int k;
+
+	exec_blocks[0] = 1;
+	visit_block(0);
+	while (nr_flow_work || nr_ssa_work) {
+		while (nr_flow_work) {
+			e = flow_work[--nr_flow_work];
+			k = edge_index(e.from, e.to);
+			if (exec_edges[k])
+				continue;
+			exec_edges[k] = 1;
+			if (exec_blocks[e.to])
+				visit_phis(e.to);
+			else {
+				exec_blocks[e.to] = 1;
+				visit_block(e.to);
+			}
+		}
+		while (nr_ssa_work) {
+			u = ssa_work[--nr_ssa_work];
+			if (exec_blocks[u.b])
+				eval(u.ir, u.b);
+		}
+	}
+}
+
+static void
+rewrite(void)
+{
+	struct block *b;
+	struct ir *ir;
+	struct val *v;
+	int i, k, taken;
+
+	for (i = 0; i < cfg->nr_blocks; i++) {
+		b = &cfg->blocks[i];
+		if (b->dead || exec_blocks[i])
+			continue;
+		b->dead = 1;
+		while (b->nr_succs)
+			cfg_remove_edge(cfg, i, b->succs[0]);
+	}
+
+	for (i = 0; i < cfg->nr_blocks; i++) {
+		b = &cfg->blocks[i];
+		if (b->dead)
+			continue;
+		for (ir = b->head;; ir = ir->next) {
+			if (ir->op == IR_CBR && vals[ir->o1].state == VAL_CONST) {
+				taken = vals[ir->o1].c ? ir->o2 : ir->dst;
+				for (k = 0; k < b->nr_succs; k++)
+					if (cfg->blocks[b->succs[k]].label != taken)
+						cfg_remove_edge(cfg, i,
+						    b->succs[k--]);
+				ir->op = IR_JUMP;
+				ir->o1 = ir->o2 = 0;
+				ir->dst = taken;
+			} else if (ir_defines(ir) && ir->op != IR_LOADI &&
+			    ir->op != IR_CALL &&
+			    (v = &vals[ir->dst])->state == VAL_CONST) {
+				ir->op = IR_LOADI;
+				ir->o1 = v->c;
+				ir->o2 = 0;
+				ir->args = NULL;
+				ir->nr_args = 0;
+			}
+			if (ir == b->tail)
+				break;
+		}
+	}
+}
+
+void
+sccp(struct cfg *_cfg)
+{
+	cfg = _cfg;
+	vals = arena_alloc(&ir_arena, ir_nr_regs() * sizeof(struct val));
+	vals[RARP].state = VAL_BOTTOM;
+	exec_blocks = arena_alloc(&ir_arena, cfg->nr_blocks);
+	exec_edges = arena_alloc(&ir_arena, cfg->nr_edges + 1);
+	build_uses();
+	nr_flow_work = nr_ssa_work = 0;
+	propagate();
+	rewrite();
+}
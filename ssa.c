@@ -0,0 +1,471 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <err.h>
+
+#include "rcc.h"
+
+/*
+ * SSA form for the IR of one function. Registers that are written more
+ * than once, promoted locals and the results of && and || mostly, get a
+ * new name for every definition, with PHIs placed on the iterated
+ * dominance frontier of their definitions wherever they are live into a
+ * block (semi-pruned form). Plain copies are folded while renaming. The
+ * args of a PHI follow the order of the block's preds.
+ *
+ * The CFG has to come from cfg_split_edges() output, without KILLs: going
+ * back out of SSA puts the copies for a PHI at the end of each
+ * predecessor, which then always has a single successor.
+ */
+
+struct df {
+	struct df *next;
+	int b;
+};
+
+struct undo {
+	long reg;
+	long name;
+};
+
+static struct cfg *cfg;
+static struct df **dfs;
+static char *renamed;
+static long *cur_name;
+static long *undef_name;
+static struct ir *undefs;
+static int nr_orig_regs;
+
+static struct undo *undo_log;
+static int nr_undo, max_undo;
+
+/* Blocks that can't be reached from the entry are gone for good. */
+static void
+remove_unreachable(void)
+{
+	struct block *b;
+	int i;
+
+	for (i = 0; i < cfg->nr_blocks; i++) {
+		b = &cfg->blocks[i];
+		if (b->rpo != -1)
+			continue;
+		b->dead = 1;
+		while (b->nr_succs)
+			cfg_remove_edge(cfg, i, b->succs[0]);
+	}
+}
+
+static void
+dominance_frontiers(void)
+{
+	struct block *b;
+	struct df *df;
+	int *stamp;
+	int i, j, runner;
+
+	dfs = arena_alloc(&ir_arena, cfg->nr_blocks * sizeof(struct df *));
+	stamp = arena_alloc(&ir_arena, cfg->nr_blocks * sizeof(int));
+	for (i = 0; i < cfg->nr_blocks; i++) {
+		b = &cfg->blocks[i];
+		if (b->dead || b->nr_preds < 2)
+			continue;
+		for (j = 0; j < b->nr_preds; j++) {
+			for (runner = b->preds[j]; runner != b->idom;
+			    runner = cfg->blocks[runner].idom) {
+				if (stamp[runner] == i + 1)
+					break;
+				stamp[runner] = i + 1;
+				df = arena_alloc(&ir_arena, sizeof(struct df));
+				df->b = i;
+				df->next = dfs[runner];
+				dfs[runner] = df;
+			}
+		}
+	}
+}
+
+static void
+insert_phi(struct block *b, long reg)
+{
+	struct ir *ir;
+	int i;
+
+	if (b->head->op != IR_LABEL)
+		errx(1, "Join without a label");
+	ir = ir_alloc(IR_PHI, reg, 0, reg);
+	ir->nr_args = b->nr_preds;
+	ir->args = arena_alloc(&ir_arena, b->nr_preds * sizeof(long));
+	for (i = 0; i < b->nr_preds; i++)
+		ir->args[i] = reg;
+	ir->next = b->head->next;
+	b->head->next = ir;
+	if (b->tail == b->head)
+		b->tail = ir;
+}
+
+/*
+ * Count the definitions of every register and find the ones that are
+ * read in some block before being written there; only those can need a
+ * PHI. Then place PHIs for them on the iterated dominance frontier of the
+ * blocks that define them.
+ */
+static void
+place_phis(void)
+{
+	struct block *b;
+	struct ir *ir;
+	long *uses[MAX_IR_USES];
+	int *defs, *def_start, *def_blocks, *killed, *has_phi, *queued, *work;
+	char *global;
+	int i, j, k, n, nr_work, r;
+	struct df *df;
+
+	n = nr_orig_regs;
+	defs = arena_alloc(&ir_arena, n * sizeof(int));
+	def_start = arena_alloc(&ir_arena, (n + 1) * sizeof(int));
+	killed = arena_alloc(&ir_arena, n * sizeof(int));
+	global = arena_alloc(&ir_arena, n);
+
+	for (i = 0; i < cfg->nr_blocks; i++) {
+		b = &cfg->blocks[i];
+		if (b->dead)
+			continue;
+		for (ir = b->head;; ir = ir->next) {
+			k = ir_uses(ir, uses);
+			for (j = 0; j < k; j++)
+				if (killed[*uses[j]] != i + 1)
+					global[*uses[j]] = 1;
+			for (j = 0; j < ir->nr_args; j++)
+				if (killed[ir->args[j]] != i + 1)
+					global[ir->args[j]] = 1;
+			if (ir_defines(ir)) {
+				defs[ir->dst]++;
+				killed[ir->dst] = i + 1;
+			}
+			if (ir == b->tail)
+				break;
+		}
+	}
+
+	/* Registers written more than once get new names. */
+	renamed = arena_alloc(&ir_arena, n);
+	for (r = 1; r < n; r++)
+		if (defs[r] > 1)
+			renamed[r] = 1;
+
+	/* The blocks defining each register, as slices of def_blocks. */
+	for (r = 0; r < n; r++)
+		def_start[r + 1] = def_start[r] + defs[r];
+	def_blocks = arena_alloc(&ir_arena, (def_start[n] + 1) * sizeof(int));
+	memset(defs, 0, n * sizeof(int));
+	for (i = 0; i < cfg->nr_blocks; i++) {
+		b = &cfg->blocks[i];
+		if (b->dead)
+			continue;
+		for (ir = b->head;; ir = ir->next) {
+			if (ir_defines(ir))
+				def_blocks[def_start[ir->dst] + defs[ir->dst]++] = i;
+			if (ir == b->tail)
+				break;
+		}
+	}
+
+	has_phi = arena_alloc(&ir_arena, cfg->nr_blocks * sizeof(int));
+	queued = arena_alloc(&ir_arena, cfg->nr_blocks * sizeof(int));
+	work = arena_alloc(&ir_arena, cfg->nr_blocks * sizeof(int));
+	for (r = 1; r < n; r++) {
+		if (!global[r] || !defs[r])
+			continue;
+		nr_work = 0;
+		for (j = def_start[r]; j < def_start[r + 1]; j++) {
+			i = def_blocks[j];
+			if (queued[i] != r) {
+				queued[i] = r;
+				work[nr_work++] = i;
+			}
+		}
+		while (nr_work) {
+			i = work[--nr_work];
+			for (df = dfs[i]; df; df = df->next) {
+				if (has_phi[df->b] == r)
+					continue;
+				has_phi[df->b] = r;
+				insert_phi(&cfg->blocks[df->b], r);
+				renamed[r] = 1;
+				if (queued[df->b] != r) {
+					queued[df->b] = r;
+					work[nr_work++] = df->b;
+				}
+			}
+		}
+	}
+}
+
+static void
+push_name(long reg, long name)
+{
+	if (nr_undo == max_undo) {
+		max_undo = max_undo ? max_undo * 2 : 1024;
+		if ((undo_log = realloc(undo_log, max_undo *
+		    sizeof(struct undo))) == NULL)
+			err(1, "realloc");
+	}
+	undo_log[nr_undo].reg = reg;
+	undo_log[nr_undo++].name = cur_name[reg];
+	cur_name[reg] = name;
+}
+
+/* Reads with no definition on some path get a zero from the entry. */
+static long
+name_of(long reg)
+{
+	struct ir *ir;
+
+	if (reg >= nr_orig_regs || !renamed[reg])
+		return (reg);
+	if (cur_name[reg] != -1)
+		return (cur_name[reg]);
+	if (undef_name[reg] == -1) {
+		undef_name[reg] = ir_new_reg();
+		ir = ir_alloc(IR_LOADI, 0, 0, undef_name[reg]);
+		ir->next = undefs;
+		undefs = ir;
+	}
+	return (undef_name[reg]);
+}
+
+static void
+rename_block(int i)
+{
+	struct block *b, *s;
+	struct ir *ir, *prev;
+	long *uses[MAX_IR_USES];
+	int j, k, mark;
+
+	b = &cfg->blocks[i];
+	mark = nr_undo;
+	prev = NULL;
+	for (ir = b->head;; prev = ir, ir = ir->next) {
+		if (ir->op != IR_PHI) {
+			k = ir_uses(ir, uses);
+			for (j = 0; j < k; j++)
+				*uses[j] = name_of(*uses[j]);
+			for (j = 0; j < ir->nr_args; j++)
+				ir->args[j] = name_of(ir->args[j]);
+		}
+		if (ir_defines(ir) && ir->dst < nr_orig_regs &&
+		    renamed[ir->dst]) {
+			if (ir->op == IR_MOV && ir->o2 == 0) {
+				/* A copy just makes dst another name. */
+				push_name(ir->dst, ir->o1);
+				prev->next = ir->next;
+				if (ir == b->tail) {
+					b->tail = prev;
+					break;
+				}
+				ir = prev;
+				continue;
+			}
+			push_name(ir->dst, ir_new_reg());
+			ir->dst = cur_name[ir->dst];
+		}
+		if (ir == b->tail)
+			break;
+	}
+
+	for (j = 0; j < b->nr_succs; j++) {
+		s = &cfg->blocks[b->succs[j]];
+		for (k = 0; s->preds[k] != i; k++)
+			;
+		for (ir = s->head;; ir = ir->next) {
+			if (ir->op == IR_PHI)
+				ir->args[k] = name_of(ir->o1);
+			if (ir == s->tail)
+				break;
+		}
+	}
+
+	for (j = cfg->dom_kids_start[i]; j < cfg->dom_kids_start[i + 1]; j++)
+		rename_block(cfg->dom_kids[j]);
+
+	while (nr_undo > mark) {
+		nr_undo--;
+		cur_name[undo_log[nr_undo].reg] = undo_log[nr_undo].name;
+	}
+}
+
+/* PHIs that nothing but other dead PHIs read. */
+static void
+remove_dead_phis(void)
+{
+	struct block *b;
+	struct ir *ir, *prev, **phi_of, **work;
+	long *uses[MAX_IR_USES];
+	int *nr_uses;
+	int i, j, k, n, nr_work;
+
+	n = ir_nr_regs();
+	nr_uses = arena_alloc(&ir_arena, n * sizeof(int));
+	phi_of = arena_alloc(&ir_arena, n * sizeof(struct ir *));
+	nr_work = 0;
+	for (i = 0; i < cfg->nr_blocks; i++) {
+		b = &cfg->blocks[i];
+		if (b->dead)
+			continue;
+		for (ir = b->head;; ir = ir->next) {
+			k = ir_uses(ir, uses);
+			for (j = 0; j < k; j++)
+				nr_uses[*uses[j]]++;
+			for (j = 0; j < ir->nr_args; j++)
+				nr_uses[ir->args[j]]++;
+			if (ir->op == IR_PHI) {
+				phi_of[ir->dst] = ir;
+				nr_work++;
+			}
+			if (ir == b->tail)
+				break;
+		}
+	}
+
+	work = arena_alloc(&ir_arena, (nr_work + 1) * sizeof(struct ir *));
+	nr_work = 0;
+	for (i = 0; i < n; i++)
+		if (phi_of[i] && !nr_uses[i])
+			work[nr_work++] = phi_of[i];
+	while (nr_work) {
+		ir = work[--nr_work];
+		ir->op = IR_KILL;
+		for (j = 0; j < ir->nr_args; j++) {
+			k = ir->args[j];
+			if (--nr_uses[k] == 0 && phi_of[k] &&
+			    phi_of[k]->op == IR_PHI)
+				work[nr_work++] = phi_of[k];
+		}
+	}
+
+	/* Dead PHIs were turned into KILLs above; unlink them. */
+	for (i = 0; i < cfg->nr_blocks; i++) {
+		b = &cfg->blocks[i];
+		if (b->dead)
+			continue;
+		for (prev = b->head, ir = prev->next; prev != b->tail;
+		    ir = prev->next) {
+			if (ir->op == IR_KILL && ir->nr_args) {
+				prev->next = ir->next;
+				if (ir == b->tail)
+					b->tail = prev;
+			} else
+				prev = ir;
+		}
+	}
+}
+
+void
+ssa_build(struct cfg *_cfg)
+{
+	struct block *b;
+	struct ir *at, *ir;
+	int i;
+
+	cfg = _cfg;
+	nr_orig_regs = ir_nr_regs();
+	cfg_dominators(cfg);
+	remove_unreachable();
+	dominance_frontiers();
+	place_phis();
+
+	cur_name = arena_alloc(&ir_arena, nr_orig_regs * sizeof(long));
+	undef_name = arena_alloc(&ir_arena, nr_orig_regs * sizeof(long));
+	for (i = 0; i < nr_orig_regs; i++)
+		cur_name[i] = undef_name[i] = -1;
+	undefs = NULL;
+	nr_undo = 0;
+	rename_block(0);
+
+	/*
+	 * The zeroes for undefined reads go right after ENTER and the ARGs,
+	 * which have to read the parameters before anything else runs.
+	 */
+	b = &cfg->blocks[0];
+	for (at = b->head; at != b->tail && at->next->op == IR_ARG;
+	    at = at->next)
+		;
+	while (undefs) {
+		ir = undefs;
+		undefs = ir->next;
+		ir->next = at->next;
+		at->next = ir;
+		if (b->tail == at)
+			b->tail = ir;
+	}
+
+	remove_dead_phis();
+}
+
+/* Replace every use of register from by to. */
+void
+ssa_rename(struct cfg *_cfg, long from, long to)
+{
+	struct block *b;
+	struct ir *ir;
+	long *u[MAX_IR_USES];
+	int i, j, k;
+
+	for (i = 0; i < _cfg->nr_blocks; i++) {
+		b = &_cfg->blocks[i];
+		if (b->dead)
+			continue;
+		for (ir = b->head;; ir = ir->next) {
+			k = ir_uses(ir, u);
+			for (j = 0; j < k; j++)
+				if (*u[j] == from)
+					*u[j] = to;
+			for (j = 0; j < ir->nr_args; j++)
+				if (ir->args[j] == from)
+					ir->args[j] = to;
+			if (ir == b->tail)
+				break;
+		}
+	}
+}
+
+/*
+ * Every PHI becomes a copy from a fresh register, which each predecessor
+ * sets last thing before it leaves. The extra copy keeps the PHIs of a
+ * block parallel without having to order or break cycles of moves.
+ */
+void
+ssa_destroy(struct cfg *_cfg)
+{
+	struct block *b;
+	struct ir *ir;
+	int i, j;
+	long t;
+
+	cfg = _cfg;
+	for (i = 0; i < cfg->nr_blocks; i++) {
+		b = &cfg->blocks[i];
+		if (b->dead)
+			continue;
+		for (ir = b->head;; ir = ir->next) {
+			if (ir->op == IR_PHI) {
+				if (b->nr_preds == 1)
+					t = ir->args[0];
+				else {
+					t = ir_new_reg();
+					for (j = 0; j < b->nr_preds; j++)
+						block_append(&cfg->blocks[b->preds[j]],
+						    ir_alloc(IR_MOV, ir->args[j], 0, t));
+				}
+				ir->op = IR_MOV;
+				ir->o1 = t;
+				ir->o2 = 0;
+				ir->args = NULL;
+				ir->nr_args = 0;
+			}
+			if (ir == b->tail)
+				break;
+		}
+	}
+}
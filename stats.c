@@ -0,0 +1,281 @@
+#include <sys/time.h>
+#include <sys/resource.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <err.h>
+
+#include "rcc.h"
+
+/*
+ * Compile-time instrumentation. Phases are bracketed with phase_start()
+ * and phase_end(); when -ftime-report or -ftrace is given each span
+ * records wall and CPU time, arena allocations and peak RSS, both for the
+ * phase as a whole and for the function it works on.
+ */
+
+static char *phase_names[NR_PHASES] = {
+    [PHASE_PARSE] = "parse",
+    [PHASE_IRGEN] = "irgen",
+    [PHASE_OPT] = "opt",
+    [PHASE_EMIT] = "emit",
+};
+
+struct phase_stats {
+	double wall;
+	double cpu;
+	unsigned long allocs;
+	unsigned long bytes;
+	long maxrss;
+	int calls;
+};
+
+struct func_stats {
+	struct func_stats *next;
+	char *name;
+	double wall[NR_PHASES];
+	double total;
+	unsigned long allocs;
+	unsigned long bytes;
+};
+
+struct span {
+	enum phase phase;
+	struct symbol *fn;
+	double wall;
+	double cpu;
+	unsigned long allocs;
+	unsigned long bytes;
+};
+
+#define	MAX_SPANS 16
+#define	REPORT_FUNCS 20
+
+static int stats_enabled;
+static int time_report;
+static FILE *trace;
+static int nr_trace_events;
+
+static struct span spans[MAX_SPANS];
+static int nr_spans;
+static struct phase_stats phases[NR_PHASES];
+static struct func_stats *funcs;
+static int nr_funcs;
+static double start_wall;
+static double start_cpu;
+
+static double
+clock_sec(clockid_t clock)
+{
+	struct timespec ts;
+
+	clock_gettime(clock, &ts);
+	return (ts.tv_sec + ts.tv_nsec / 1e9);
+}
+
+static long
+maxrss(void)
+{
+	struct rusage ru;
+
+	getrusage(RUSAGE_SELF, &ru);
+	return (ru.ru_maxrss);
+}
+
+static struct func_stats *
+func_stats(struct symbol *s)
+{
+	struct func_stats *f;
+
+	if (s->stats)
+		return (s->stats);
+	if ((f = calloc(1, sizeof(struct func_stats))) == NULL)
+		err(1, "calloc");
+	f->name = s->name;
+	f->next = funcs;
+	funcs = f;
+	nr_funcs++;
+	s->stats = f;
+
+	return (f);
+}
+
+static void
+trace_event(char *name, struct symbol *fn, double ts, double dur,
+    unsigned long allocs, unsigned long bytes)
+{
+	fprintf(trace, "%s\n{\"name\":\"%s\",\"cat\":\"%s\",\"ph\":\"X\","
+	    "\"ts\":%.3f,\"dur\":%.3f,\"pid\":1,\"tid\":1,\"args\":{",
+	    nr_trace_events++ ? "," : "", fn ? fn->name : name,
+	    fn ? name : "unit", (ts - start_wall) * 1e6, dur * 1e6);
+	if (fn)
+		fprintf(trace, "\"phase\":\"%s\",", name);
+	fprintf(trace, "\"allocs\":%lu,\"bytes\":%lu}}", allocs, bytes);
+}
+
+void
+stats_init(int report, char *trace_path)
+{
+	time_report = report;
+	if (trace_path) {
+		if ((trace = fopen(trace_path, "w")) == NULL)
+			err(1, "fopen %s", trace_path);
+		fprintf(trace, "{\"traceEvents\":[");
+	}
+	stats_enabled = time_report || trace;
+	start_wall = clock_sec(CLOCK_MONOTONIC);
+	start_cpu = clock_sec(CLOCK_PROCESS_CPUTIME_ID);
+}
+
+void
+phase_start(enum phase phase, struct symbol *fn)
+{
+	struct span *sp;
+
+	if (!stats_enabled)
+		return;
+	if (nr_spans == MAX_SPANS)
+		errx(1, "Phase spans nested too deeply");
+
+	sp = &spans[nr_spans++];
+	sp->phase = phase;
+	sp->fn = fn;
+	sp->allocs = arena_allocs;
+	sp->bytes = arena_bytes;
+	sp->cpu = clock_sec(CLOCK_PROCESS_CPUTIME_ID);
+	sp->wall = clock_sec(CLOCK_MONOTONIC);
+}
+
+void
+phase_end(enum phase phase)
+{
+	struct phase_stats *ps;
+	struct func_stats *f;
+	struct span *sp;
+	unsigned long allocs, bytes;
+	double wall, cpu;
+	int i, outer;
+
+	if (!stats_enabled)
+		return;
+
+	wall = clock_sec(CLOCK_MONOTONIC);
+	cpu = clock_sec(CLOCK_PROCESS_CPUTIME_ID);
+	sp = &spans[--nr_spans];
+	if (sp->phase != phase)
+		errx(1, "Phase %s ended inside %s", phase_names[phase],
+		    phase_names[sp->phase]);
+	allocs = arena_allocs - sp->allocs;
+	bytes = arena_bytes - sp->bytes;
+
+	/* Nested spans of the same phase are already in the outer one. */
+	outer = 1;
+	for (i = 0; i < nr_spans; i++)
+		if (spans[i].phase == phase)
+			outer = 0;
+	if (outer) {
+		ps = &phases[phase];
+		ps->wall += wall - sp->wall;
+		ps->cpu += cpu - sp->cpu;
+		ps->allocs += allocs;
+		ps->bytes += bytes;
+		ps->maxrss = maxrss();
+		ps->calls++;
+	}
+
+	if (sp->fn) {
+		f = func_stats(sp->fn);
+		f->wall[phase] += wall - sp->wall;
+		f->total += wall - sp->wall;
+		f->allocs += allocs;
+		f->bytes += bytes;
+	}
+
+	if (trace)
+		trace_event(phase_names[phase], sp->fn, sp->wall, wall -
+		    sp->wall, allocs, bytes);
+}
+
+static int
+func_cmp(const void *a, const void *b)
+{
+	const struct func_stats *fa, *fb;
+
+	fa = *(struct func_stats * const *)a;
+	fb = *(struct func_stats * const *)b;
+	if (fa->total != fb->total)
+		return (fa->total < fb->total ? 1 : -1);
+	return (0);
+}
+
+static void
+print_report(double wall, double cpu)
+{
+	struct func_stats **sorted, *f;
+	struct phase_stats *ps;
+	int i, n;
+
+	fprintf(stderr, "%-16s %10s %10s %10s %12s %10s\n", "phase",
+	    "wall ms", "cpu ms", "allocs", "bytes", "rss KB");
+	for (i = 0; i < NR_PHASES; i++) {
+		ps = &phases[i];
+		if (!ps->calls)
+			continue;
+		fprintf(stderr, "%-16s %10.3f %10.3f %10lu %12lu %10ld\n",
+		    phase_names[i], ps->wall * 1e3, ps->cpu * 1e3, ps->allocs,
+		    ps->bytes, ps->maxrss);
+	}
+	fprintf(stderr, "%-16s %10.3f %10.3f %10lu %12lu %10ld\n", "total",
+	    wall * 1e3, cpu * 1e3, arena_allocs, arena_bytes, maxrss());
+	fprintf(stderr, "\n%lu tokens, %d lines, %d functions: "
+	    "%.0f tokens/s, %.0f lines/s, %.0f functions/s\n", lex_tokens,
+	    lex_lines, nr_funcs, lex_tokens / wall, lex_lines / wall,
+	    nr_funcs / wall);
+
+	if (nr_funcs == 0)
+		return;
+	if ((sorted = calloc(nr_funcs, sizeof(struct func_stats *))) == NULL)
+		err(1, "calloc");
+	for (f = funcs, n = 0; f; f = f->next)
+		sorted[n++] = f;
+	qsort(sorted, n, sizeof(struct func_stats *), func_cmp);
+
+	fprintf(stderr, "\n%-24s", "function");
+	for (i = 0; i < NR_PHASES; i++)
+		fprintf(stderr, " %9s", phase_names[i]);
+	fprintf(stderr, " %10s %10s %12s\n", "total ms", "allocs", "bytes");
+	for (n = 0; n < nr_funcs && n < REPORT_FUNCS; n++) {
+		f = sorted[n];
+		fprintf(stderr, "%-24s", f->name);
+		for (i = 0; i < NR_PHASES; i++)
+			fprintf(stderr, " %9.3f", f->wall[i] * 1e3);
+		fprintf(stderr, " %10.3f %10lu %12lu\n", f->total * 1e3,
+		    f->allocs, f->bytes);
+	}
+	if (nr_funcs > REPORT_FUNCS)
+		fprintf(stderr, "(%d more functions)\n", nr_funcs -
+		    REPORT_FUNCS);
+	free(sorted);
+}
+
+void
+stats_finish(void)
+{
+	double wall, cpu;
+
+	if (!stats_enabled)
+		return;
+
+	wall = clock_sec(CLOCK_MONOTONIC);
+	cpu = clock_sec(CLOCK_PROCESS_CPUTIME_ID);
+	if (trace) {
+		trace_event("compile", NULL, start_wall, wall - start_wall,
+		    arena_allocs, arena_bytes);
+		fprintf(trace, "\n]}\n");
+		if (fclose(trace))
+			err(1, "fclose");
+	}
+	if (time_report)
+		print_report(wall - start_wall, cpu - start_cpu);
+}
@@ -0,0 +1,235 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <limits.h>
+#include <err.h>
+
+#include "rcc.h"
+
+/*
+ * Strength reduction of multiplications, divisions and remainders by
+ * constants on the SSA form, after constant propagation. A multiplication
+ * by a power of two becomes a shift; by 2, 4 and 8 isel() can still take
+ * the shift into an address. A division rounds towards zero, so a power
+ * of two has the sign of the dividend added in before the shift; any
+ * other divisor is a multiplication by its reciprocal in fixed point,
+ * keeping the high half (Granlund and Montgomery, as in Hacker's Delight
+ * 10-1). A remainder is what the quotient leaves, which doesn't depend on
+ * the sign of the divisor.
+ */
+
+static struct ir **defs;		/* by register, in SSA form */
+
+/*
+ * What reduce() puts goes in before the original instruction, which only
+ * becomes the last one, the one writing its register, at the end; until
+ * then it is still what defs[] has for that register. The registers put()
+ * makes are past the end of defs[], and nothing asks about them.
+ */
+static struct block *cur_b;
+static struct ir *orig;
+static struct ir *prev;			/* NULL if orig is the head */
+
+/* dst is a new register if -1. */
+static long
+put(int op, long o1, long o2, long dst)
+{
+	struct ir *ir;
+
+	if (dst == orig->dst) {
+		orig->op = op;
+		orig->o1 = o1;
+		orig->o2 = o2;
+		return (dst);
+	}
+	if (dst == -1)
+		dst = ir_new_reg();
+	ir = ir_alloc(op, o1, o2, dst);
+	ir->next = orig;
+	if (prev)
+		prev->next = ir;
+	else
+		cur_b->head = ir;
+	prev = ir;
+	return (dst);
+}
+
+static long
+put_const(long c)
+{
+	return (put(IR_LOADI, c, 0, -1));
+}
+
+static int
+const_of(long r, long *c)
+{
+	if (r == RARP || defs[r] == NULL || defs[r]->op != IR_LOADI)
+		return (0);
+	*c = defs[r]->o1;
+	return (1);
+}
+
+/* log2 of c if it is a power of two above 1, else 0. */
+static int
+log2_of(long c)
+{
+	int k;
+
+	if (c < 2 || (c & (c - 1)))
+		return (0);
+	for (k = 0; c > 1; k++)
+		c >>= 1;
+	return (k);
+}
+
+/* The multiplier m and shift s for a division by d >= 3. */
+static void
+magic(long d, long *m, int *s)
+{
+	unsigned long ad, anc, delta, q1, q2, r1, r2, t;
+	int p;
+
+	ad = d;
+	t = 1UL << 63;
+	anc = t - 1 - t % ad;
+	p = 63;
+	q1 = t / anc;
+	r1 = t - q1 * anc;
+	q2 = t / ad;
+	r2 = t - q2 * ad;
+	do {
+		p++;
+		q1 *= 2;
+		r1 *= 2;
+		if (r1 >= anc) {
+			q1++;
+			r1 -= anc;
+		}
+		q2 *= 2;
+		r2 *= 2;
+		if (r2 >= ad) {
+			q2++;
+			r2 -= ad;
+		}
+		delta = ad - r2;
+	} while (q1 < delta || (q1 == delta && r1 == 0));
+	*m = q2 + 1;
+	*s = p - 64;
+}
+
+/* x + (d - 1 if x is negative), for a division by d = 1 << k. */
+static long
+put_bias(long x, int k)
+{
+	long t;
+
+	t = put(IR_SAR, x, put_const(63), -1);
+	t = put(IR_SHR, t, put_const(64 - k), -1);
+	return (put(IR_ADD, x, t, -1));
+}
+
+/* x / d into dst for d >= 2, rounded towards zero. */
+static long
+put_quotient(long x, long d, long dst)
+{
+	long h, m, t;
+	int k, s;
+
+	if ((k = log2_of(d))) {
+		t = put_bias(x, k);
+		return (put(IR_SAR, t, put_const(k), dst));
+	}
+	magic(d, &m, &s);
+	h = put(IR_MULH, x, put_const(m), -1);
+	if (m < 0)
+		h = put(IR_ADD, h, x, -1);
+	if (s)
+		h = put(IR_SAR, h, put_const(s), -1);
+	t = put(IR_SHR, x, put_const(63), -1);
+	return (put(IR_ADD, h, t, dst));
+}
+
+static void
+reduce(struct ir *ir)
+{
+	long c, d, dst, q, x, z;
+	int k;
+
+	x = ir->o1;
+	dst = ir->dst;
+	orig = ir;
+	switch (ir->op) {
+	case IR_MUL:
+		if (const_of(ir->o2, &c))
+			;
+		else if (const_of(ir->o1, &c))
+			x = ir->o2;
+		else
+			break;
+		if (c == 1)
+			put(IR_MOV, x, 0, dst);
+		else if ((k = log2_of(c)))
+			put(IR_SHL, x, put_const(k), dst);
+		break;
+	case IR_DIV:
+		if (!const_of(ir->o2, &d) || d == LONG_MIN ||
+		    (d >= -1 && d <= 1))
+			break;
+		if (d > 0) {
+			put_quotient(x, d, dst);
+			break;
+		}
+		q = put_quotient(x, -d, -1);
+		z = put_const(0);
+		put(IR_SUB, z, q, dst);
+		break;
+	case IR_MOD:
+		if (!const_of(ir->o2, &d) || d == LONG_MIN ||
+		    (d >= -1 && d <= 1))
+			break;
+		if (d < 0)
+			d = -d;
+		if ((k = log2_of(d))) {
+			q = put_bias(x, k);
+			q = put(IR_AND, q, put_const(-d), -1);
+		} else {
+			q = put_quotient(x, d, -1);
+			q = put(IR_MUL, q, put_const(d), -1);
+		}
+		put(IR_SUB, x, q, dst);
+		break;
+	}
+}
+
+void
+strength_reduce(struct cfg *cfg)
+{
+	struct block *b;
+	struct ir *ir;
+	int i;
+
+	defs = arena_alloc(&ir_arena, ir_nr_regs() * sizeof(struct ir *));
+	for (i = 0; i < cfg->nr_blocks; i++) {
+		b = &cfg->blocks[i];
+		if (b->dead)
+			continue;
+		for (ir = b->head;; ir = ir->next) {
+			if (ir_defines(ir))
+				defs[ir->dst] = ir;
+			if (ir == b->tail)
+				break;
+		}
+	}
+
+	for (i = 0; i < cfg->nr_blocks; i++) {
+		cur_b = b = &cfg->blocks[i];
+		if (b->dead)
+			continue;
+		for (prev = NULL, ir = b->head;; prev = ir, ir = ir->next) {
+			if (ir->op == IR_MUL || ir->op == IR_DIV ||
+			    ir->op == IR_MOD)
+				reduce(ir);
+			if (ir == b->tail)
+				break;
+		}
+	}
+}
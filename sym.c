@@ -2,100 +2,147 @@
 #include <stdlib.h>
 #include <string.h>
 #include <assert.h>
+#include <err.h>
 
 #include "rcc.h"
 
 static struct symtab l0_symtab;
 struct symtab *symtab = &l0_symtab;
 
+struct symbol *globals;
+static struct symbol **globals_tail = &globals;
 struct symbol *strings;
 static int nr_strings;
 
 int labels;
 
-#define	HASHSTEP(x, c) (((x << 5) + x) + (c))
+/*
+ * All scopes share one open-addressing table that maps a name to its
+ * innermost symbol and struct tag. Binding a name inside a function saves
+ * the outer bindings on an undo log, and leaving the scope pops the log
+ * back to where it was when the scope was entered.
+ */
+struct binding {
+	char *name;
+	struct symbol *sym;
+	struct _struct *_struct;
+};
 
-static unsigned int
-hash_str(char *s)
-{
-	unsigned int hash;
+#define	BINDINGS_INIT_SIZE 1024
+
+static struct binding *bindings;
+static unsigned int bindings_size;
+static unsigned int nr_bindings;
 
-	hash = 0;
-	while (*s)
-		hash = HASHSTEP(hash, *s++);
+static struct binding *undo;
+static unsigned int undo_size;
+static unsigned int nr_undo;
 
-	return (hash % SYMTAB_SIZE);
+static struct binding *
+lookup(char *name)
+{
+	struct binding *b;
+	unsigned int i, mask;
+
+	if (bindings_size == 0)
+		return (NULL);
+	mask = bindings_size - 1;
+	for (i = atom_hash(name) & mask; (b = &bindings[i])->name;
+	    i = (i + 1) & mask)
+		if (b->name == name)
+			return (b);
+	return (NULL);
 }
 
-struct _struct *
-find_struct(char *name)
+static void
+grow_bindings(void)
 {
-	struct symtab *tab;
-	struct _struct *s;
-	unsigned int hash;
-
-	tab = symtab;
-	hash = hash_str(name);
-	while (tab) {
-		for (s = tab->structs[hash]; s; s = s->next)
-			if (!strcmp(s->name, name))
-				return (s);
-		tab = tab->prev;
+	struct binding *old;
+	unsigned int i, j, mask, old_size;
+
+	old = bindings;
+	old_size = bindings_size;
+	bindings_size = old_size ? old_size * 2 : BINDINGS_INIT_SIZE;
+	if ((bindings = calloc(bindings_size, sizeof(struct binding))) == NULL)
+		err(1, "calloc");
+
+	mask = bindings_size - 1;
+	for (i = 0; i < old_size; i++) {
+		if (old[i].name == NULL)
+			continue;
+		for (j = atom_hash(old[i].name) & mask; bindings[j].name;
+		    j = (j + 1) & mask)
+			;
+		bindings[j] = old[i];
 	}
-
-	return (NULL);
+	free(old);
 }
 
-static struct symbol *
-_find_sym(char *name, struct symtab *tab)
+/* Find or create the binding of name, saving it if in a nested scope. */
+static struct binding *
+bind(char *name)
 {
-	struct symbol *s;
-	unsigned int hash;
-
-	hash = hash_str(name);
-	while (tab) {
-		for (s = tab->tab[hash]; s; s = s->next)
-			if (!strcmp(s->name, name))
-				return (s);
-		tab = tab->prev;
+	struct binding *b;
+	unsigned int i, mask;
+
+	if ((b = lookup(name)) == NULL) {
+		if (2 * (nr_bindings + 1) > bindings_size)
+			grow_bindings();
+		mask = bindings_size - 1;
+		for (i = atom_hash(name) & mask; bindings[i].name;
+		    i = (i + 1) & mask)
+			;
+		b = &bindings[i];
+		b->name = name;
+		nr_bindings++;
 	}
-	return (NULL);
+
+	if (symtab->level > 0) {
+		if (nr_undo == undo_size) {
+			undo_size = undo_size ? undo_size * 2 : 64;
+			if ((undo = realloc(undo, undo_size *
+			    sizeof(struct binding))) == NULL)
+				err(1, "realloc");
+		}
+		undo[nr_undo++] = *b;
+	}
+
+	return (b);
 }
 
-struct symbol *
-find_sym(char *name)
+struct _struct *
+find_struct(char *name)
 {
-	return (_find_sym(name, symtab));
+	struct binding *b;
+
+	if ((b = lookup(name)) == NULL)
+		return (NULL);
+	return (b->_struct);
 }
 
 struct symbol *
-find_global_sym(char *name)
+find_sym(char *name)
 {
-	return (_find_sym(name, &l0_symtab));
+	struct binding *b;
+
+	if ((b = lookup(name)) == NULL)
+		return (NULL);
+	return (b->sym);
 }
 
 struct symbol *
 add_string(char *str)
 {
 	struct symbol *s;
-	struct type *_type, *ptr;
-	char *name;
+	char name[32];
 	int len;
 
-	len = strlen(str) + 1;
-
-	asprintf(&name, ".str%d", nr_strings++);
+	len = snprintf(name, sizeof(name), ".str%d", nr_strings++);
 
-	s = malloc(sizeof(struct symbol));
-	memset(s, 0, sizeof(struct symbol));
+	s = arena_alloc(&ast_arena, sizeof(struct symbol));
 
-	_type = new_type(1);
-	ptr = new_type(8);
-	ptr->ptr = _type;
-	ptr->array = 1;
-
-	s->type = ptr;
-	s->name = name;
+	s->type = type_array(type_base(1), 8);
+	s->name = intern(name, len);
 	s->global = 1;
 	s->tab = &l0_symtab;
 	s->next = strings;
@@ -109,16 +156,12 @@ struct _struct *
 add_struct(char *name)
 {
 	struct _struct *s;
-	unsigned int hash;
 
-	s = malloc(sizeof(struct _struct));
-	memset(s, 0, sizeof(struct _struct));
+	s = arena_alloc(&ast_arena, sizeof(struct _struct));
 
 	s->name = name;
-
-	hash = hash_str(name);
-	s->next = symtab->structs[hash];
-	symtab->structs[hash] = s;
+	if (name != NULL)
+		bind(name)->_struct = s;
 
 	return (s);
 }
@@ -127,25 +170,24 @@ struct symbol *
 add_sym(char *name, struct type *type)
 {
 	struct symbol *s;
-	unsigned int hash;
 
 	if ((s = find_sym(name)) != NULL)
 		return (s);
-	hash = hash_str(name);
 
-	s = malloc(sizeof(struct symbol));
-	memset(s, 0, sizeof(struct symbol));
+	s = arena_alloc(&ast_arena, sizeof(struct symbol));
 	s->name = name;
 	s->loc = symtab->ar_offset;
 	s->tab = symtab;
 	s->type = type;
-	if (symtab == &l0_symtab)
-		s->global = 1;
 	if (type)
 		symtab->ar_offset += type->stacksize;
+	if (symtab == &l0_symtab) {
+		s->global = 1;
+		*globals_tail = s;
+		globals_tail = &s->next;
+	}
 
-	s->next = symtab->tab[hash];
-	symtab->tab[hash] = s;
+	bind(name)->sym = s;
 
 	return (s);
 }
@@ -155,10 +197,10 @@ new_symtab(void)
 {
 	struct symtab *tab;
 
-	tab = malloc(sizeof(struct symtab));
-	memset(tab, 0, sizeof(struct symtab));
+	tab = arena_alloc(&ast_arena, sizeof(struct symtab));
 	tab->prev = symtab;
 	tab->level = symtab->level + 1;
+	tab->undo = nr_undo;
 	if (tab->level != 1)
 		tab->ar_offset = symtab->ar_offset;
 	symtab = tab;
@@ -167,8 +209,16 @@ new_symtab(void)
 void
 del_symtab(void)
 {
+	struct binding *b, *u;
+
 	assert(symtab->level > 0);
 
+	while (nr_undo > symtab->undo) {
+		u = &undo[--nr_undo];
+		b = lookup(u->name);
+		b->sym = u->sym;
+		b->_struct = u->_struct;
+	}
 	symtab = symtab->prev;
 }
 
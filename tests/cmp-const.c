@@ -0,0 +1,30 @@
+long gt(long n) {
+	if (5 > n)
+		return 1;
+	return 2;
+}
+long ge(long n) {
+	if (5 >= n)
+		return 1;
+	return 2;
+}
+long lt(long n) {
+	if (5 < n)
+		return 1;
+	return 2;
+}
+long le(long n) {
+	while (5 <= n)
+		return 1;
+	return 2;
+}
+long either(long p) {
+	return (1000 <= 8) || (2 >= p);
+}
+int main() {
+	long n;
+	for (n = 3; n < 8; n = n + 1)
+		printf("%ld %ld %ld %ld %ld\n", gt(n), ge(n), lt(n), le(n),
+		    either(n - 2));
+	return 0;
+}
@@ -0,0 +1,19 @@
+long id(long x) {
+	return x;
+}
+int main() {
+	int y;
+	char c;
+	long z;
+	y = id(4294967296 + 7);
+	z = y;
+	printf("%ld\n", z);
+	c = id(321);
+	z = c;
+	printf("%ld\n", z);
+	y = id(4294967296 + 321);
+	c = id(y);
+	z = c + y;
+	printf("%ld\n", z);
+	return 0;
+}
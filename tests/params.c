@@ -0,0 +1,14 @@
+long last2(long a, long b, long c, long d) {
+	return c * 10 + d;
+}
+long mid(long a, long b, long c, long d, long e, long f) {
+	return b * 100 + e;
+}
+long swap(long a, long b, long c) {
+	return c - a;
+}
+int main() {
+	printf("%ld %ld %ld\n", last2(1, 2, 3, 4), mid(1, 2, 3, 4, 5, 6),
+	    swap(7, 8, 9));
+	return 0;
+}
@@ -0,0 +1,27 @@
+long mul2(long a, long b) {
+	return (a * 2) * b;
+}
+long mul1(long a, long b) {
+	return (a * 1) * b;
+}
+long div4(long a, long b) {
+	return (a / 4) * b;
+}
+long div7(long a, long b) {
+	return (a / 7) * b + (a / -7);
+}
+long mod8(long a, long b) {
+	return (a % 8) * b;
+}
+long mod10(long a, long b) {
+	return (a % 10) * b;
+}
+int main() {
+	long a;
+	for (a = -23; a < 30; a = a + 13)
+	{
+		printf("%ld %ld %ld\n", mul2(a, 7), mul1(a, 7), div4(a, 7));
+		printf("%ld %ld %ld\n", div7(a, 3), mod8(a, 5), mod10(a, 3));
+	}
+	return 0;
+}
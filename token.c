@@ -0,0 +1,67 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "rcc.h"
+
+/*
+ * Tokens are produced on demand into a small ring buffer: tok is the
+ * current token and the parser may look at most LEX_RING_SIZE - 1 tokens
+ * ahead with lex_peek().
+ */
+#define	LEX_RING_SIZE 4
+
+struct token *tok;
+unsigned long lex_tokens;
+int lex_lines;
+
+static struct token ring[LEX_RING_SIZE];
+static unsigned int ring_head, ring_tail;
+static int (*lex_scan)(struct token *);
+static int lex_eof;
+
+static void
+lex_fill(void)
+{
+	struct token *t;
+
+	t = &ring[ring_tail % LEX_RING_SIZE];
+	memset(t, 0, sizeof(struct token));
+	if (lex_eof) {
+		t->tok = TOK_EOF;
+		t->line = ring[(ring_tail - 1) % LEX_RING_SIZE].line;
+	} else {
+		if (lex_scan(t) == TOK_EOF)
+			lex_eof = 1;
+		else
+			lex_tokens++;
+		lex_lines = t->line;
+	}
+	ring_tail++;
+}
+
+void
+lex_next(void)
+{
+	ring_head++;
+	if (ring_head == ring_tail)
+		lex_fill();
+	tok = &ring[ring_head % LEX_RING_SIZE];
+}
+
+struct token *
+lex_peek(void)
+{
+	if (ring_head + 1 == ring_tail)
+		lex_fill();
+	return (&ring[(ring_head + 1) % LEX_RING_SIZE]);
+}
+
+void
+lex(int (*scan)(struct token *))
+{
+	lex_scan = scan;
+	lex_eof = 0;
+	ring_head = ring_tail = 0;
+	lex_fill();
+	tok = &ring[0];
+}
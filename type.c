@@ -0,0 +1,106 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <err.h>
+
+#include "rcc.h"
+
+/*
+ * Types are hash-consed: each distinct type is built once, so two types
+ * are the same exactly when their pointers are equal, and everything
+ * derived from a type (its size) is computed when it is first built.
+ */
+
+#define	TYPES_INIT_SIZE 256
+
+static struct arena type_arena;
+static struct type **types;
+static unsigned int types_size;
+static unsigned int nr_types;
+
+static unsigned int
+type_hash(int size, int array, struct type *ptr, struct _struct *_st)
+{
+	unsigned long h;
+
+	h = (unsigned long)size * 31 + array;
+	h = h * 31 + ((unsigned long)ptr >> 4);
+	h = h * 31 + ((unsigned long)_st >> 4);
+	return (h ^ (h >> 16));
+}
+
+static void
+types_grow(void)
+{
+	struct type **old, *t;
+	unsigned int i, j, mask, old_size;
+
+	old = types;
+	old_size = types_size;
+	types_size = old_size ? old_size * 2 : TYPES_INIT_SIZE;
+	if ((types = calloc(types_size, sizeof(struct type *))) == NULL)
+		err(1, "calloc");
+
+	mask = types_size - 1;
+	for (i = 0; i < old_size; i++) {
+		if ((t = old[i]) == NULL)
+			continue;
+		for (j = type_hash(t->size, t->array, t->ptr, t->_struct) &
+		    mask; types[j]; j = (j + 1) & mask)
+			;
+		types[j] = t;
+	}
+	free(old);
+}
+
+static struct type *
+intern_type(int size, int stacksize, int array, struct type *ptr,
+    struct _struct *_st)
+{
+	struct type *t;
+	unsigned int i, mask;
+
+	if (2 * (nr_types + 1) > types_size)
+		types_grow();
+
+	mask = types_size - 1;
+	for (i = type_hash(size, array, ptr, _st) & mask; (t = types[i]);
+	    i = (i + 1) & mask)
+		if (t->size == size && t->array == array && t->ptr == ptr &&
+		    t->_struct == _st)
+			return (t);
+
+	t = arena_alloc(&type_arena, sizeof(struct type));
+	t->size = size;
+	t->stacksize = stacksize;
+	t->array = array;
+	t->ptr = ptr;
+	t->_struct = _st;
+	types[i] = t;
+	nr_types++;
+
+	return (t);
+}
+
+struct type *
+type_base(int size)
+{
+	return (intern_type(size, size, 0, NULL, NULL));
+}
+
+struct type *
+type_ptr(struct type *t)
+{
+	return (intern_type(8, 8, 0, t, NULL));
+}
+
+struct type *
+type_array(struct type *t, int n)
+{
+	return (intern_type(n, n * t->stacksize, 1, t, NULL));
+}
+
+struct type *
+type_struct(struct _struct *_st, int size)
+{
+	return (intern_type(size, size, 0, NULL, _st));
+}
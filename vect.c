@@ -0,0 +1,505 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <limits.h>
+#include <string.h>
+#include <err.h>
+
+#include "rcc.h"
+
+/*
+ * Vectorisation of simple counted loops on the SSA form. A loop qualifies
+ * if its header only tests a counter that steps by one against a bound the
+ * loop doesn't change, the rest of it is a straight line, and every load
+ * and its one store are of elements of the same size at the counter
+ * scaled by that size from a base the loop doesn't change either. Between
+ * them there may only be additions, subtractions and bitwise operations
+ * of what was loaded and of loop invariants, whose low bits don't depend
+ * on the high ones, so that they can be done on the elements as they are.
+ *
+ * Such a loop gets an IR_VLOOP at the end of its preheader, which runs as
+ * many of its iterations as it can a vector at a time and starts the
+ * scalar loop where it stopped. The code for it checks at run time that
+ * the store doesn't write what a load is about to read within a vector.
+ */
+
+#define	MAX_VOPS 16			/* vector registers */
+#define	MAX_VARGS 32
+
+/* An address as base registers, a displacement and a scaled counter. */
+struct lin {
+	long base[2];
+	int nr_base;
+	long disp;
+	long scale;
+};
+
+static struct cfg *cfg;
+static struct ir **defs;		/* by register, in SSA form */
+static int *def_block;			/* by register, -1 if none */
+static int *nr_uses;			/* by register */
+static int nr_scanned;
+static char *in_addr;			/* by register */
+static int *vop_of;			/* by register, -1 if none */
+
+static struct loop *l;
+static struct ir *phi;			/* the counter */
+static struct ir *step_ir;		/* which adds one to it */
+static int ip, il;			/* args of phi from preheader and latch */
+static int *chain;			/* the blocks after the header, in order */
+static int nr_chain;
+
+static struct vop vops[MAX_VOPS];
+static int nr_vops;
+static long vargs[MAX_VARGS];
+static int nr_vargs;
+static long bases[MAX_VARGS][2];	/* what the base in vargs adds up */
+static int elem;
+
+static void
+scan(void)
+{
+	struct block *b;
+	struct ir *ir;
+	long *u[MAX_IR_USES];
+	int i, j, k, n;
+
+	n = nr_scanned = ir_nr_regs();
+	defs = arena_alloc(&ir_arena, n * sizeof(struct ir *));
+	def_block = arena_alloc(&ir_arena, n * sizeof(int));
+	nr_uses = arena_alloc(&ir_arena, n * sizeof(int));
+	in_addr = arena_alloc(&ir_arena, n);
+	vop_of = arena_alloc(&ir_arena, n * sizeof(int));
+	for (i = 0; i < n; i++)
+		def_block[i] = -1;
+	for (i = 0; i < cfg->nr_blocks; i++) {
+		b = &cfg->blocks[i];
+		if (b->dead || b->rpo == -1)
+			continue;
+		for (ir = b->head;; ir = ir->next) {
+			if (ir_defines(ir)) {
+				defs[ir->dst] = ir;
+				def_block[ir->dst] = i;
+			}
+			k = ir_uses(ir, u);
+			for (j = 0; j < k; j++)
+				nr_uses[*u[j]]++;
+			for (j = 0; j < ir->nr_args; j++)
+				nr_uses[ir->args[j]]++;
+			if (ir == b->tail)
+				break;
+		}
+	}
+}
+
+static int
+const_of(long r, long *c)
+{
+	if (r == RARP || defs[r] == NULL || defs[r]->op != IR_LOADI)
+		return (0);
+	*c = defs[r]->o1;
+	return (1);
+}
+
+static int
+outside(long r)
+{
+	return (def_block[r] == -1 || !l->body[def_block[r]]);
+}
+
+/* Whether r has the same value all through the loop. */
+static int
+invariant(long r)
+{
+	if (r == RARP)
+		return (0);
+	if (outside(r))
+		return (1);
+	return (defs[r]->op == IR_LOADI || defs[r]->op == IR_LOADG);
+}
+
+static long
+put_pre(int op, long o1, long o2)
+{
+	long r;
+
+	r = ir_new_reg();
+	block_append(&cfg->blocks[l->preheader], ir_alloc(op, o1, o2, r));
+	return (r);
+}
+
+/* An invariant r as a register the preheader has. */
+static long
+pre_value(long r)
+{
+	if (outside(r))
+		return (r);
+	return (put_pre(defs[r]->op, defs[r]->o1, 0));
+}
+
+static int
+fits(long c)
+{
+	return (c >= INT_MIN && c <= INT_MAX);
+}
+
+/* Take the address in r apart, adding it to x. */
+static int
+linear(long r, struct lin *x)
+{
+	struct ir *d;
+	struct lin y;
+	long c;
+
+	if (r == phi->dst) {
+		x->scale++;
+		return (1);
+	}
+	if (const_of(r, &c) && fits(c)) {
+		x->disp += c;
+		return (1);
+	}
+	if (r == RARP || outside(r) || defs[r]->op == IR_LOADG) {
+		if (x->nr_base == 2)
+			return (0);
+		x->base[x->nr_base++] = r;
+		return (1);
+	}
+	d = defs[r];
+	in_addr[r] = 1;
+	switch (d->op) {
+	case IR_ADD:
+		return (linear(d->o1, x) && linear(d->o2, x));
+	case IR_SUB:
+		if (!const_of(d->o2, &c) || !fits(c))
+			return (0);
+		x->disp -= c;
+		return (linear(d->o1, x));
+	case IR_SHL:
+	case IR_MUL:
+		if (!const_of(d->o2, &c) || (d->op == IR_SHL && (c < 0 ||
+		    c > 3)) || (d->op == IR_MUL && (c < 1 || c > 8)))
+			return (0);
+		if (d->op == IR_SHL)
+			c = 1 << c;
+		memset(&y, 0, sizeof(y));
+		if (!linear(d->o1, &y) || y.nr_base || !fits(y.disp))
+			return (0);
+		x->scale += y.scale * c;
+		x->disp += y.disp * c;
+		return (1);
+	default:
+		return (0);
+	}
+}
+
+static int
+add_varg(long r)
+{
+	if (nr_vargs == MAX_VARGS)
+		return (-1);
+	vargs[nr_vargs] = r;
+	bases[nr_vargs][0] = bases[nr_vargs][1] = -1;
+	return (nr_vargs++);
+}
+
+/*
+ * The varg of the base of an address, made in the preheader, and the same
+ * one for every address with the same base registers.
+ */
+static int
+find_base(struct lin *x)
+{
+	long b0, b1, r;
+	int i;
+
+	b0 = x->base[0];
+	b1 = x->nr_base == 2 ? x->base[1] : -1;
+	if (b1 != -1 && b1 < b0) {
+		r = b0;
+		b0 = b1;
+		b1 = r;
+	}
+	for (i = 2; i < nr_vargs; i++)
+		if (bases[i][0] == b0 && bases[i][1] == b1)
+			return (i);
+	if (b1 == -1 && b0 != RARP)
+		r = pre_value(b0);
+	else if (b1 == -1)
+		r = put_pre(IR_ADD, RARP, put_pre(IR_LOADI, 0, 0));
+	else
+		r = put_pre(IR_ADD, b0 == RARP ? RARP : pre_value(b0),
+		    pre_value(b1));
+	if ((i = add_varg(r)) == -1)
+		return (-1);
+	bases[i][0] = b0;
+	bases[i][1] = b1;
+	return (i);
+}
+
+static int
+add_vop(int op, int a, int b, long disp)
+{
+	if (nr_vops == MAX_VOPS)
+		return (-1);
+	vops[nr_vops].op = op;
+	vops[nr_vops].a = a;
+	vops[nr_vops].b = b;
+	vops[nr_vops].disp = disp;
+	return (nr_vops++);
+}
+
+static int
+mem_elem(int op)
+{
+	switch (op) {
+	case IR_LOAD:
+	case IR_STORE:
+		return (8);
+	case IR_LOAD32:
+	case IR_STORE32:
+		return (4);
+	case IR_LOAD8:
+	case IR_STORE8:
+		return (1);
+	default:
+		return (0);
+	}
+}
+
+static int
+is_load(int op)
+{
+	return (op == IR_LOAD || op == IR_LOAD32 || op == IR_LOAD8);
+}
+
+/* A load or store at the address in r, or -1. */
+static int
+access(int op, long r, int b)
+{
+	struct lin x;
+	int a;
+
+	memset(&x, 0, sizeof(x));
+	if (!linear(r, &x) || x.scale != elem || x.nr_base == 0 ||
+	    !fits(x.disp) || (a = find_base(&x)) == -1)
+		return (-1);
+	return (add_vop(op, a, b, x.disp));
+}
+
+/* The vop of r, a broadcast if it is invariant, or -1. */
+static int
+operand(long r)
+{
+	int a, v;
+
+	if (r < nr_scanned && vop_of[r] != -1)
+		return (vop_of[r]);
+	if (r >= nr_scanned || !invariant(r))
+		return (-1);
+	if ((a = add_varg(pre_value(r))) == -1 ||
+	    (v = add_vop(IR_MOV, a, 0, 0)) == -1)
+		return (-1);
+	vop_of[r] = v;
+	return (v);
+}
+
+/* Whether the blocks after the header are a straight line back to it. */
+static int
+find_chain(struct ir *cbr)
+{
+	struct block *b, *h;
+	int i, s;
+
+	h = &cfg->blocks[l->header];
+	if (h->nr_preds != 2 || h->nr_succs != 2)
+		return (0);
+	s = l->body[h->succs[0]] ? h->succs[0] : h->succs[1];
+	if (cfg->blocks[s].label != cbr->o2)
+		return (0);
+	for (nr_chain = 0; s != l->header; s = b->succs[0]) {
+		b = &cfg->blocks[s];
+		if (!l->body[s] || b->nr_preds != 1 || b->nr_succs != 1 ||
+		    nr_chain == l->size)
+			return (0);
+		chain[nr_chain++] = s;
+	}
+	if (nr_chain + 1 != l->size || chain[nr_chain - 1] != l->latch)
+		return (0);
+	for (i = 0; i < nr_chain; i++)
+		if (def_block[step_ir->dst] == chain[i])
+			return (1);
+	return (0);
+}
+
+/*
+ * Whether the header is the counter, its test against an invariant bound
+ * and the branch on it, returning the bound and the test as < or <=.
+ */
+static int
+counted(long *bound, int *cmp)
+{
+	struct block *h;
+	struct ir *c, *cbr, *d;
+	long k;
+
+	h = &cfg->blocks[l->header];
+	phi = h->head->next;
+	if (phi == NULL || phi->op != IR_PHI || (c = phi->next) == h->tail ||
+	    (cbr = c->next) != h->tail || cbr->op != IR_CBR ||
+	    cbr->o1 != c->dst || nr_uses[c->dst] != 1)
+		return (0);
+	if ((c->op == IR_LT || c->op == IR_LE) && c->o1 == phi->dst &&
+	    invariant(c->o2)) {
+		*bound = c->o2;
+		*cmp = c->op;
+	} else if ((c->op == IR_GT || c->op == IR_GE) && c->o2 == phi->dst &&
+	    invariant(c->o1)) {
+		*bound = c->o1;
+		*cmp = c->op == IR_GT ? IR_LT : IR_LE;
+	} else
+		return (0);
+
+	ip = h->preds[0] == l->preheader ? 0 : 1;
+	il = 1 - ip;
+	if ((d = defs[phi->args[il]]) == NULL || d->op != IR_ADD)
+		return (0);
+	if (!(d->o1 == phi->dst && const_of(d->o2, &k) && k == 1) &&
+	    !(d->o2 == phi->dst && const_of(d->o1, &k) && k == 1))
+		return (0);
+	step_ir = d;
+	return (find_chain(cbr));
+}
+
+/* Build the steps of the body; 0 if it can't be done a vector at a time. */
+static int
+build(void)
+{
+	struct block *b;
+	struct ir *ir;
+	struct lin x;
+	int a, i, stored, v;
+
+	/* The element size, and what only goes into addresses. */
+	for (elem = 0, i = 0; i < nr_chain; i++) {
+		b = &cfg->blocks[chain[i]];
+		for (ir = b->head;; ir = ir->next) {
+			if ((v = mem_elem(ir->op))) {
+				if (elem && v != elem)
+					return (0);
+				elem = v;
+				memset(&x, 0, sizeof(x));
+				if (!linear(is_load(ir->op) ? ir->o1 : ir->dst,
+				    &x))
+					return (0);
+			}
+			if (ir == b->tail)
+				break;
+		}
+	}
+	if (elem == 0)
+		return (0);
+
+	stored = 0;
+	for (i = 0; i < nr_chain; i++) {
+		b = &cfg->blocks[chain[i]];
+		for (ir = b->head;; ir = ir->next) {
+			switch (ir->op) {
+			case IR_LABEL:
+			case IR_JUMP:
+			case IR_LOADI:
+			case IR_LOADG:
+				break;
+			case IR_LOAD:
+			case IR_LOAD32:
+			case IR_LOAD8:
+				if (stored || (v = access(IR_LOAD, ir->o1,
+				    0)) == -1)
+					return (0);
+				vop_of[ir->dst] = v;
+				break;
+			case IR_STORE:
+			case IR_STORE32:
+			case IR_STORE8:
+				if (stored++ || (v = operand(ir->o1)) == -1 ||
+				    access(IR_STORE, ir->dst, v) == -1)
+					return (0);
+				break;
+			case IR_ADD:
+			case IR_SUB:
+			case IR_AND:
+			case IR_OR:
+			case IR_XOR:
+			case IR_SHL:
+			case IR_MUL:
+				if (ir == step_ir || in_addr[ir->dst])
+					break;
+				if (ir->op == IR_SHL || ir->op == IR_MUL ||
+				    (a = operand(ir->o1)) == -1 ||
+				    (v = operand(ir->o2)) == -1 ||
+				    (v = add_vop(ir->op, a, v, 0)) == -1)
+					return (0);
+				vop_of[ir->dst] = v;
+				break;
+			default:
+				return (0);
+			}
+			if (ir == b->tail)
+				break;
+		}
+	}
+	return (stored);
+}
+
+static void
+vectorize_loop(void)
+{
+	struct vloop *vl;
+	struct ir *ir;
+	long bound, dst;
+	int cmp, i;
+
+	if (l->preheader == -1 || l->latch == -1 || !counted(&bound, &cmp))
+		return;
+	memset(in_addr, 0, nr_scanned);
+	for (i = 0; i < nr_scanned; i++)
+		vop_of[i] = -1;
+	nr_vops = 0;
+	nr_vargs = 0;
+	add_varg(phi->args[ip]);
+	add_varg(bound);
+
+	/* What build() leaves in the preheader is dead if it gives up. */
+	if (!build())
+		return;
+	vargs[1] = pre_value(bound);
+
+	vl = arena_alloc(&ir_arena, sizeof(struct vloop));
+	vl->elem = elem;
+	vl->cmp = cmp;
+	vl->nr_ops = nr_vops;
+	vl->ops = arena_alloc(&ir_arena, nr_vops * sizeof(struct vop));
+	memcpy(vl->ops, vops, nr_vops * sizeof(struct vop));
+	dst = ir_new_reg();
+	ir = ir_alloc(IR_VLOOP, (long)vl, 0, dst);
+	ir->nr_args = nr_vargs;
+	ir->args = arena_alloc(&ir_arena, nr_vargs * sizeof(long));
+	memcpy(ir->args, vargs, nr_vargs * sizeof(long));
+	block_append(&cfg->blocks[l->preheader], ir);
+	phi->args[ip] = dst;
+}
+
+void
+vectorize(struct cfg *_cfg)
+{
+	struct loop *loops;
+	int i, nr_loops;
+
+	cfg = _cfg;
+	nr_loops = find_loops(cfg, &loops);
+	scan();
+	chain = arena_alloc(&ir_arena, cfg->nr_blocks * sizeof(int));
+	for (i = 0; i < nr_loops; i++) {
+		l = &loops[i];
+		vectorize_loop();
+	}
+}
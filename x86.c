@@ -1,239 +1,726 @@
 #include <stdio.h>
 #include <stdlib.h>
-#include <stdarg.h>
+#include <string.h>
+#include <limits.h>
 #include <err.h>
 
 #include "rcc.h"
 
-static FILE *out;
+int ir_comments = 1;
+int x86_avx2;
 
-static void
-emit_no_nl(char *s, ...)
+static int *ir_locs;
+static int x86_regs_hw[NR_X86_ALLOC_REGS + 1] = { X86_RSP, X86_RAX, X86_RBX,
+    X86_RCX, X86_RDX, X86_R8, X86_R9, X86_R12, X86_R13, X86_R14, X86_R15 };
+
+/* Spilled registers of the current instruction and where they were put. */
+static long reload_iregs[3];
+static int reload_hw[3];
+static int nr_reloads;
+
+#define	NR_FUNC_PARAM_REGS 6
+static int param_regs[NR_FUNC_PARAM_REGS] = { X86_RDI, X86_RSI, X86_RDX,
+    X86_RCX, X86_R8, X86_R9 };
+
+static int
+spilled(long ireg)
 {
-	va_list ap;
+	return (ireg != RARP && ir_locs[ireg] < 0);
+}
 
-	va_start(ap, s);
-	vfprintf(out, s, ap);
-	va_end(ap);
+/* Spill slots are below the frame pointer, which pushes don't move. */
+static int
+spill_off(long ireg)
+{
+	return (ir_locs[ireg] * 8);
+}
+
+static int
+x86_reg(long ireg)
+{
+	int i;
+
+	if (ireg == RARP)
+		return (X86_RSP);
+	if (!spilled(ireg))
+		return (x86_regs_hw[ir_locs[ireg]]);
+	for (i = 0; i < nr_reloads; i++)
+		if (reload_iregs[i] == ireg)
+			return (reload_hw[i]);
+	errx(1, "IR register %ld is not in a register", ireg);
 }
 
 static void
-emit(char *s, ...)
+reload(long ireg, int hw, int load)
 {
-	va_list ap;
+	int i;
 
-	va_start(ap, s);
-	vfprintf(out, s, ap);
-	va_end(ap);
+	for (i = 0; i < nr_reloads; i++)
+		if (reload_iregs[i] == ireg)
+			return;
+	reload_iregs[nr_reloads] = ireg;
+	reload_hw[nr_reloads++] = hw;
+	if (load)
+		as_load(AS_MOV, 8, X86_RBP, -1, 1, spill_off(ireg), hw);
+}
+
+/* dst = o1 op o2 for the two-address ALU operations; nothing is clobbered. */
+static void
+emit_alu(enum as_op op, int commutative, struct ir *ir)
+{
+	int dst, o1, o2;
 
-	fputs("\n", out);
+	o1 = x86_reg(ir->o1);
+	o2 = x86_reg(ir->o2);
+	dst = x86_reg(ir->dst);
+	if (dst == o2 && dst != o1) {
+		if (commutative)
+			as_rr(op, 8, o1, dst);
+		else {
+			as_r(AS_NEG, 8, dst);
+			as_rr(AS_ADD, 8, o1, dst);
+		}
+		return;
+	}
+	if (dst != o1)
+		as_rr(AS_MOV, 8, o1, dst);
+	as_rr(op, 8, o2, dst);
 }
 
-#define	MAX_IR_REGS 1024
-static int ir_regs[MAX_IR_REGS];
-#define	NR_X86_REGS 13
-static int x86_regs[NR_X86_REGS];
-static char *x86_regs_names[NR_X86_REGS] = { "rsp", "rax", "rbx", "rcx",
-    "rdx", "r8", "r9", "r10", "r11", "r12", "r13", "r14", "r15" };
-static char *x86_32_regs_names[NR_X86_REGS] = { "XXX", "eax", "ebx", "ecx",
-    "edx", "r8d", "r9d", "r10d", "r11d", "r12d", "r13d", "r14d", "r15d" };
-static char *x86_16_regs_names[NR_X86_REGS] = { "XXX", "ax", "bx", "cx", "dx",
-    "r8w", "r9w", "r10w", "r11w", "r12w", "r13w", "r14w", "r15w" };
-static char *x86_8_regs_names[NR_X86_REGS] = { "XXX", "al", "bl", "cl", "dl",
-    "r8b", "r9b", "r10b", "r11b", "r12b", "r13b", "r14b", "r15b" };
+/* Whether hardware register hw holds a value that lives across ir. */
+static int
+live_across(struct ir *ir, int hw)
+{
+	int i;
+
+	for (i = 1; i <= NR_X86_ALLOC_REGS; i++)
+		if (x86_regs_hw[i] == hw)
+			return ((ir->live & (1 << i)) != 0);
+	return (0);
+}
 
-#define	NR_FUNC_PARAM_REGS 6
-static char *param_regs[NR_FUNC_PARAM_REGS] = { "rdi", "rsi", "rdx", "rcx",
-    "r8", "r9" };
-static char *param_32_regs[NR_FUNC_PARAM_REGS] = { "edi", "esi", "edx", "ecx",
-    "r8d", "r9d" };
-static char *param_16_regs[NR_FUNC_PARAM_REGS] = { "di", "si", "dx", "cx",
-    "r8w", "r9w" };
-static char *param_8_regs[NR_FUNC_PARAM_REGS] = { "dil", "sil", "dl", "cl",
-    "r8b", "r9b" };
-
-#define	RAX 1
-
-static char *
-func_param_reg(int r, int size)
+/*
+ * idiv divides rdx:rax and leaves the quotient in rax and the remainder
+ * in rdx; the one operand imul leaves the high half of the product in
+ * rdx. Only what lives across is saved; a divisor in rax or rdx is moved
+ * to r11, which isn't a reload register for the divisor then.
+ */
+static void
+emit_div(struct ir *ir)
 {
-	if (size == 1)
-		return (param_8_regs[r]);
-	else if (size == 2)
-		return (param_16_regs[r]);
-	else if (size == 4)
-		return (param_32_regs[r]);
-	else
-		return (param_regs[r]);
+	int d, dst, n, res, save_rax, save_rdx;
+
+	n = x86_reg(ir->o1);
+	d = x86_reg(ir->o2);
+	dst = x86_reg(ir->dst);
+	res = ir->op == IR_DIV ? X86_RAX : X86_RDX;
+	save_rax = dst != X86_RAX && live_across(ir, X86_RAX);
+	save_rdx = dst != X86_RDX && live_across(ir, X86_RDX);
+	if (save_rax)
+		as_r(AS_PUSH, 8, X86_RAX);
+	if (save_rdx)
+		as_r(AS_PUSH, 8, X86_RDX);
+	if (d == X86_RAX || d == X86_RDX) {
+		as_rr(AS_MOV, 8, d, X86_R11);
+		d = X86_R11;
+	}
+	if (n != X86_RAX)
+		as_rr(AS_MOV, 8, n, X86_RAX);
+	if (ir->op == IR_MULH)
+		as_r(AS_IMUL, 8, d);
+	else {
+		as_op(AS_CQTO);
+		as_r(AS_IDIV, 8, d);
+	}
+	if (dst != res)
+		as_rr(AS_MOV, 8, res, dst);
+	if (save_rdx)
+		as_r(AS_POP, 8, X86_RDX);
+	if (save_rax)
+		as_r(AS_POP, 8, X86_RAX);
 }
 
+/* Put an argument or a call's result where it goes, spilled or not. */
 static int
-next_x86_reg(void)
+arg_reg(long ireg, int scratch)
 {
-	int i;
+	if (!spilled(ireg))
+		return (x86_reg(ireg));
+	as_load(AS_MOV, 8, X86_RBP, -1, 1, spill_off(ireg),
+	    scratch);
+	return (scratch);
+}
+
+static void
+emit_call(struct ir *ir)
+{
+	int i, n;
+
+	for (i = 1; i <= NR_X86_ALLOC_REGS; i++)
+		if (ir->live & (1 << i))
+			as_r(AS_PUSH, 8, x86_regs_hw[i]);
+	/* XXX more than 6 params */
+	n = ir->nr_args < NR_FUNC_PARAM_REGS ? ir->nr_args :
+	    NR_FUNC_PARAM_REGS;
+	if (n > 2) {
+		/* Past rsi the arguments can live in parameter registers. */
+		for (i = 0; i < n; i++)
+			as_r(AS_PUSH, 8, arg_reg(ir->args[i], X86_R10));
+		for (i = n - 1; i >= 0; i--)
+			as_r(AS_POP, 8, param_regs[i]);
+	} else
+		for (i = 0; i < n; i++)
+			if (spilled(ir->args[i]))
+				arg_reg(ir->args[i], param_regs[i]);
+			else
+				as_rr(AS_MOV, 8, x86_reg(ir->args[i]),
+				    param_regs[i]);
+	as_rr(AS_XOR, 4, X86_RAX, X86_RAX);
+	as_sym(AS_CALL, ((struct symbol *)ir->o1)->name, 0);
+	if (spilled(ir->dst))
+		as_store(8, X86_RAX, X86_RBP, -1, 1, spill_off(ir->dst));
+	else if (x86_reg(ir->dst) != X86_RAX)
+		as_rr(AS_MOV, 8, X86_RAX, x86_reg(ir->dst));
+	for (i = NR_X86_ALLOC_REGS; i >= 1; i--)
+		if (ir->live & (1 << i))
+			as_r(AS_POP, 8, x86_regs_hw[i]);
+}
+
+static enum as_op
+vec_op(int op, int elem)
+{
+	switch (op) {
+	case IR_ADD:
+		return (elem == 1 ? AS_PADDB : elem == 4 ? AS_PADDD : AS_PADDQ);
+	case IR_SUB:
+		return (elem == 1 ? AS_PSUBB : elem == 4 ? AS_PSUBD : AS_PSUBQ);
+	case IR_AND:
+		return (AS_PAND);
+	case IR_OR:
+		return (AS_POR);
+	default:
+		return (AS_PXOR);
+	}
+}
+
+/* The low element of vector register v in all of it. */
+static void
+emit_broadcast(int v, int elem, int width)
+{
+	if (width == 32) {
+		as_vrr(elem == 1 ? AS_PBROADCASTB : elem == 4 ?
+		    AS_PBROADCASTD : AS_PBROADCASTQ, 32, v, 0, v);
+		return;
+	}
+	if (elem == 8) {
+		as_vrr(AS_PUNPCKLQDQ, 16, v, v, v);
+		return;
+	}
+	if (elem == 1) {
+		as_vrr(AS_PUNPCKLBW, 16, v, v, v);
+		as_vrr(AS_PUNPCKLWD, 16, v, v, v);
+	}
+	as_vrr(AS_PSHUFD, 16, v, 0, v);
+}
+
+/*
+ * The vector part of a loop vectorize() took, with the counter in r10
+ * and where the vectors stop in r11, and step k of the vloop in vector
+ * register k. A load whose elements a store of the same vector would
+ * write first, found from the distance of their addresses, leaves it all
+ * to the scalar loop, as does a spilled base: nothing else is free to
+ * reload it into for the loop. The bound and the broadcasts only need r11
+ * before it is taken.
+ */
+static void
+emit_vloop(struct ir *ir)
+{
+	struct vloop *vl;
+	struct vop *s, *v;
+	long d;
+	int done, elem, i, lanes, r, top, width;
+
+	vl = (struct vloop *)ir->o1;
+	elem = vl->elem;
+	width = x86_avx2 ? 32 : 16;
+	lanes = width / elem;
+	if ((r = arg_reg(ir->args[0], X86_R10)) != X86_R10)
+		as_rr(AS_MOV, 8, r, X86_R10);
+	for (s = NULL, i = 0; i < vl->nr_ops; i++)
+		if (vl->ops[i].op == IR_STORE)
+			s = &vl->ops[i];
+	for (i = 0; i < vl->nr_ops; i++) {
+		v = &vl->ops[i];
+		d = s->disp - v->disp - 1;
+		if ((v->op == IR_LOAD || v->op == IR_STORE) &&
+		    spilled(ir->args[v->a]))
+			goto scalar;
+		if (v->op == IR_LOAD && (v->a == s->a ? d >= 0 &&
+		    d < width - 1 : d != (int)d))
+			goto scalar;
+	}
 
-	for (i = 1; i < NR_X86_REGS; i++) {
-		if (!x86_regs[i]) {
-			x86_regs[i]++;
-			return (i);
+	done = new_label();
+	top = new_label();
+	for (i = 0; i < vl->nr_ops; i++) {
+		v = &vl->ops[i];
+		if (v->op != IR_LOAD || v->a == s->a)
+			continue;
+		as_load(AS_LEA, 8, x86_reg(ir->args[s->a]), -1, 1,
+		    s->disp - v->disp - 1, X86_R11);
+		as_rr(AS_SUB, 8, x86_reg(ir->args[v->a]), X86_R11);
+		as_ri(AS_CMP, 8, width - 1, X86_R11);
+		as_jmp(AS_JB, done);
+	}
+	for (i = 0; i < vl->nr_ops; i++)
+		if (vl->ops[i].op == IR_MOV) {
+			as_vrr(AS_MOVQ, 16, arg_reg(ir->args[vl->ops[i].a],
+			    X86_R11), 0, i);
+			emit_broadcast(i, elem, width);
+		}
+	r = arg_reg(ir->args[1], X86_R11);
+	as_rr(AS_CMP, 8, r, X86_R10);
+	as_jmp(vl->cmp == IR_LT ? AS_JGE : AS_JG, done);
+	if (r != X86_R11)
+		as_rr(AS_MOV, 8, r, X86_R11);
+	as_rr(AS_SUB, 8, X86_R10, X86_R11);
+	if (vl->cmp == IR_LE)
+		as_ri(AS_ADD, 8, 1, X86_R11);
+	as_ri(AS_AND, 8, -lanes, X86_R11);
+	as_jmp(AS_JE, done);
+	as_rr(AS_ADD, 8, X86_R10, X86_R11);
+
+	as_label(top);
+	for (i = 0; i < vl->nr_ops; i++) {
+		v = &vl->ops[i];
+		switch (v->op) {
+		case IR_MOV:
+			break;
+		case IR_LOAD:
+			as_vload(width, x86_reg(ir->args[v->a]), X86_R10, elem,
+			    v->disp, i);
+			break;
+		case IR_STORE:
+			as_vstore(width, v->b, x86_reg(ir->args[v->a]),
+			    X86_R10, elem, v->disp);
+			break;
+		default:
+			if (width == 32) {
+				as_vrr(vec_op(v->op, elem), 32, v->b, v->a, i);
+				break;
+			}
+			as_vrr(AS_MOVDQA, 16, v->a, 0, i);
+			as_vrr(vec_op(v->op, elem), 16, v->b, i, i);
+			break;
 		}
 	}
+	as_ri(AS_ADD, 8, lanes, X86_R10);
+	as_rr(AS_CMP, 8, X86_R11, X86_R10);
+	as_jmp(AS_JNE, top);
+	as_label(done);
+	if (width == 32)
+		as_op(AS_VZEROUPPER);
+scalar:
+	if (x86_reg(ir->dst) != X86_R10)
+		as_rr(AS_MOV, 8, X86_R10, x86_reg(ir->dst));
+}
+
+static enum as_op
+setcc(int op)
+{
+	switch (op) {
+	case IR_EQ:
+		return (AS_SETE);
+	case IR_NE:
+		return (AS_SETNE);
+	case IR_LT:
+		return (AS_SETL);
+	case IR_LE:
+		return (AS_SETLE);
+	case IR_GT:
+		return (AS_SETG);
+	default:
+		return (AS_SETGE);
+	}
+}
 
-	errx(1, "Ran out of x86 registers\n");
+static enum as_op
+jcc(int op)
+{
+	switch (op) {
+	case IR_EQ:
+		return (AS_JE);
+	case IR_NE:
+		return (AS_JNE);
+	case IR_LT:
+		return (AS_JL);
+	case IR_LE:
+		return (AS_JLE);
+	case IR_GT:
+		return (AS_JG);
+	default:
+		return (AS_JGE);
+	}
 }
 
-static char *
-x86_reg(int ireg, int size)
+static int
+negate(int op)
 {
-	if (ireg && !ir_regs[ireg])
-		ir_regs[ireg] = next_x86_reg();
+	switch (op) {
+	case IR_EQ:
+		return (IR_NE);
+	case IR_NE:
+		return (IR_EQ);
+	case IR_LT:
+		return (IR_GE);
+	case IR_LE:
+		return (IR_GT);
+	case IR_GT:
+		return (IR_LE);
+	default:
+		return (IR_LT);
+	}
+}
 
-	if (size == 1)
-		return (x86_8_regs_names[ir_regs[ireg]]);
-	else if (size == 2)
-		return (x86_16_regs_names[ir_regs[ireg]]);
-	else if (size == 4)
-		return (x86_32_regs_names[ir_regs[ireg]]);
+/* Whether control gets from ir to label without a jump. */
+static int
+falls_to(struct ir *ir, long label)
+{
+	for (ir = ir->next; ir && ir->op == IR_LABEL; ir = ir->next)
+		if (ir->o1 == label)
+			return (1);
+	return (0);
+}
+
+/*
+ * Go to o2 if the flags say op and to dst if not, leaving out the jump
+ * to a block that comes next.
+ */
+static void
+emit_branch(struct ir *ir, int op)
+{
+	if (falls_to(ir, ir->o2)) {
+		as_jmp(jcc(negate(op)), ir->dst);
+		return;
+	}
+	as_jmp(jcc(op), ir->o2);
+	if (!falls_to(ir, ir->dst))
+		as_jmp(AS_JMP, ir->dst);
+}
+
+static int
+mem_size(int op)
+{
+	switch (op) {
+	case IR_LOADO:
+	case IR_STORE:
+		return (8);
+	case IR_LOADO32:
+	case IR_STORE32:
+		return (4);
+	default:
+		return (1);
+	}
+}
+
+/* Bytes are zero-extended as they are loaded, like the byte MOVs. */
+static void
+emit_load(struct ir *ir)
+{
+	int size;
+
+	size = mem_size(ir->op);
+	as_load(size == 1 ? AS_MOVZB : AS_MOV, size == 1 ? 8 : size,
+	    x86_reg(ir->o1), ir->o2 == -1 ? -1 : x86_reg(ir->o2), ir->scale,
+	    ir->imm, x86_reg(ir->dst));
+}
+
+/*
+ * Stores reload on their own: the value goes to r10 and the address to
+ * r11, adding up a spilled base and index there first.
+ */
+static void
+emit_store(struct ir *ir)
+{
+	int base, index, scale;
+
+	index = -1;
+	scale = ir->scale;
+	if (spilled(ir->dst) && ir->o2 != -1 && spilled(ir->o2)) {
+		arg_reg(ir->dst, X86_R11);
+		arg_reg(ir->o2, X86_R10);
+		as_load(AS_LEA, 8, X86_R11, X86_R10, scale, 0, X86_R11);
+		base = X86_R11;
+		scale = 1;
+	} else {
+		base = arg_reg(ir->dst, X86_R11);
+		if (ir->o2 != -1)
+			index = arg_reg(ir->o2, X86_R11);
+	}
+	as_store(mem_size(ir->op), arg_reg(ir->o1, X86_R10), base, index,
+	    scale, ir->imm);
+}
+
+static void
+emit_alu_imm(struct ir *ir)
+{
+	static enum as_op ops[NR_IR_OPS] = { [IR_ADD] = AS_ADD,
+	    [IR_SUB] = AS_SUB, [IR_AND] = AS_AND, [IR_OR] = AS_OR,
+	    [IR_XOR] = AS_XOR };
+	long disp;
+	int dst, o1;
+
+	o1 = x86_reg(ir->o1);
+	dst = x86_reg(ir->dst);
+	disp = ir->op == IR_SUB ? -ir->imm : ir->imm;
+	if (dst != o1 && (ir->op == IR_ADD || ir->op == IR_SUB) &&
+	    disp == (int)disp) {
+		as_load(AS_LEA, 8, o1, -1, 1, disp, dst);
+		return;
+	}
+	if (dst != o1)
+		as_rr(AS_MOV, 8, o1, dst);
+	as_ri(ops[ir->op], 8, ir->imm, dst);
+}
+
+/* 3, 5 and 9 times x are x plus x scaled. */
+static void
+emit_mul_imm(struct ir *ir)
+{
+	int o1;
+
+	o1 = x86_reg(ir->o1);
+	if (ir->imm == 3 || ir->imm == 5 || ir->imm == 9)
+		as_load(AS_LEA, 8, o1, o1, ir->imm - 1, 0, x86_reg(ir->dst));
 	else
-		return (x86_regs_names[ir_regs[ireg]]);
+		as_rri(AS_IMUL, 8, ir->imm, o1, x86_reg(ir->dst));
 }
 
 static void
-kill_reg(int ireg)
+emit_shift_imm(struct ir *ir)
 {
-	int x;
+	static enum as_op ops[NR_IR_OPS] = { [IR_SHL] = AS_SHL,
+	    [IR_SHR] = AS_SHR, [IR_SAR] = AS_SAR };
+	int dst, o1;
 
-	x = ir_regs[ireg];
-	if (x == 0)
-		errx(1, "Kill on free register %d\n", ireg);
-	x86_regs[x] = 0;
-	ir_regs[ireg] = 0;
+	o1 = x86_reg(ir->o1);
+	dst = x86_reg(ir->dst);
+	if (dst != o1)
+		as_rr(AS_MOV, 8, o1, dst);
+	as_ri(ops[ir->op], 8, ir->imm & 63, dst);
 }
 
+/* A compare without a result is there for the CBR after it. */
 static void
-kill_all(void)
+emit_cmp_imm(struct ir *ir)
 {
-	int i;
+	as_ri(AS_CMP, 8, ir->imm, x86_reg(ir->o1));
+	if (ir->dst == -1)
+		return;
+	as_r(setcc(ir->op), 1, x86_reg(ir->dst));
+	as_rr(AS_MOVZB, 8, x86_reg(ir->dst), x86_reg(ir->dst));
+}
 
-	for (i = 0; i < MAX_IR_REGS; i++)
-		if (ir_regs[i])
-			kill_reg(i);
+static void
+emit_cbr_flags(struct ir *ir)
+{
+	emit_branch(ir, ir->imm);
+}
+
+/*
+ * What isel() may fold into an instruction, best first. Every load and
+ * store has a pattern, as do the shifts, which only come from strength
+ * reduction with a constant count; the rest falls back to emit_x86_op()
+ * with all operands in registers.
+ */
+static struct pattern x86_patterns[] = {
+	/* op		o1	o2	dst	emit */
+	{ IR_LOAD,	P_MEM,	P_NONE,	P_REG,	emit_load },
+	{ IR_LOAD32,	P_MEM,	P_NONE,	P_REG,	emit_load },
+	{ IR_LOAD8,	P_MEM,	P_NONE,	P_REG,	emit_load },
+	{ IR_LOADO,	P_MEM,	P_MEM,	P_REG,	emit_load },
+	{ IR_LOADO32,	P_MEM,	P_MEM,	P_REG,	emit_load },
+	{ IR_LOADO8,	P_MEM,	P_MEM,	P_REG,	emit_load },
+	{ IR_STORE,	P_REG,	P_NONE,	P_MEM,	emit_store },
+	{ IR_STORE32,	P_REG,	P_NONE,	P_MEM,	emit_store },
+	{ IR_STORE8,	P_REG,	P_NONE,	P_MEM,	emit_store },
+	{ IR_ADD,	P_REG,	P_IMM,	P_REG,	emit_alu_imm },
+	{ IR_SUB,	P_REG,	P_IMM,	P_REG,	emit_alu_imm },
+	{ IR_AND,	P_REG,	P_IMM,	P_REG,	emit_alu_imm },
+	{ IR_OR,	P_REG,	P_IMM,	P_REG,	emit_alu_imm },
+	{ IR_XOR,	P_REG,	P_IMM,	P_REG,	emit_alu_imm },
+	{ IR_MUL,	P_REG,	P_IMM,	P_REG,	emit_mul_imm },
+	{ IR_SHL,	P_REG,	P_IMM,	P_REG,	emit_shift_imm },
+	{ IR_SHR,	P_REG,	P_IMM,	P_REG,	emit_shift_imm },
+	{ IR_SAR,	P_REG,	P_IMM,	P_REG,	emit_shift_imm },
+	{ IR_EQ,	P_REG,	P_IMM,	P_REG,	emit_cmp_imm },
+	{ IR_NE,	P_REG,	P_IMM,	P_REG,	emit_cmp_imm },
+	{ IR_LT,	P_REG,	P_IMM,	P_REG,	emit_cmp_imm },
+	{ IR_LE,	P_REG,	P_IMM,	P_REG,	emit_cmp_imm },
+	{ IR_GT,	P_REG,	P_IMM,	P_REG,	emit_cmp_imm },
+	{ IR_GE,	P_REG,	P_IMM,	P_REG,	emit_cmp_imm },
+	{ IR_CBR,	P_FLAGS, P_NONE, P_NONE, emit_cbr_flags },
+};
+
+#define	NR_X86_PATTERNS (sizeof(x86_patterns) / sizeof(x86_patterns[0]))
+
+/* Anything that isn't a byte, word or long is moved as a quad. */
+static int
+op_size(int size)
+{
+	if (size == 1 || size == 2 || size == 4)
+		return (size);
+	return (8);
 }
 
+/* A copy that zero-extends a byte or a long, as MOV's o2 says. */
 static void
-emit_x86_op(struct ir *ir)
+emit_mov(int size, int src, int dst)
+{
+	if (size == 1)
+		as_rr(AS_MOVZB, 8, src, dst);
+	else if (size == 4)
+		as_rr(AS_MOV, 4, src, dst);
+	else if (src != dst)
+		as_rr(AS_MOV, 8, src, dst);
+}
+
+/*
+ * Parameters go to the AR, unless an ARG after the ENTER keeps them in a
+ * register. The parameter registers rdx, rcx, r8 and r9 are colors too,
+ * so the ARGs are done here at once as a parallel move: first everything
+ * that only reads them, then each move whose target no other move still
+ * reads, breaking cycles through r11.
+ */
+static void
+emit_params(struct ir *enter)
 {
 	struct param *p;
-	char *instr;
-	int i, off;
+	struct ir *ir;
+	int from[NR_FUNC_PARAM_REGS], to[NR_FUNC_PARAM_REGS];
+	int ext[NR_FUNC_PARAM_REGS], in_reg[NR_FUNC_PARAM_REGS];
+	int i, j, n, off, size;
 
-	emit_no_nl("# ");
-	dump_ir_op(out, ir);
+	memset(in_reg, 0, sizeof(in_reg));
+	n = 0;
+	for (ir = enter->next; ir && ir->op == IR_ARG; ir = ir->next) {
+		in_reg[ir->o1] = 1;
+		if (ir_locs[ir->dst] == 0)
+			continue;
+		if (spilled(ir->dst)) {
+			emit_mov(ir->o2, param_regs[ir->o1], X86_R11);
+			as_store(8, X86_R11, X86_RBP, -1, 1,
+			    spill_off(ir->dst));
+			continue;
+		}
+		from[n] = param_regs[ir->o1];
+		to[n] = x86_reg(ir->dst);
+		ext[n++] = ir->o2;
+	}
+	for (off = i = 0, p = (struct param *)enter->o2;
+	    p && i < NR_FUNC_PARAM_REGS; p = p->next, i++) {
+		size = p->sym->type->size;
+		if (!in_reg[i])
+			as_store(op_size(size), param_regs[i], X86_RSP, -1, 1,
+			    off);
+		off += size;
+	}
 
-	switch (ir->op) {
+	while (n) {
+		for (i = 0; i < n; i++) {
+			for (j = 0; j < n; j++)
+				if (j != i && from[j] == to[i])
+					break;
+			if (j == n)
+				break;
+		}
+		if (i == n) {
+			as_rr(AS_MOV, 8, to[0], X86_R11);
+			for (j = 0; j < n; j++)
+				if (from[j] == to[0])
+					from[j] = X86_R11;
+			continue;
+		}
+		emit_mov(ext[i], from[i], to[i]);
+		n--;
+		from[i] = from[n];
+		to[i] = to[n];
+		ext[i] = ext[n];
+	}
+}
+
+static void
+emit_x86_op(struct ir *ir)
+{
+	long *u[MAX_IR_USES];
+	int i, k;
+
+	if (ir_comments)
+		as_comment("%s %ld, %ld, %ld", ir_op_name(ir->op), ir->o1,
+		    ir->o2, ir->dst);
+	/* The ENTER took care of these. */
+	if (ir->op == IR_ARG)
+		return;
+
+	/*
+	 * Spilled operands are loaded into r10 for o1 and r11 for the other
+	 * one, and a spilled result is computed in r10 and stored after.
+	 * Every case below reads its operands before it writes the result.
+	 */
+	nr_reloads = 0;
+	if (ir->op != IR_CALL && ir->op != IR_STORE && ir->op != IR_STORE32 &&
+	    ir->op != IR_STORE8) {
+		k = ir_uses(ir, u);
+		for (i = 0; i < k; i++)
+			if (spilled(*u[i]))
+				reload(*u[i], u[i] == &ir->o1 ? X86_R10 : X86_R11,
+				    1);
+		if (ir_defines(ir) && spilled(ir->dst))
+			reload(ir->dst, X86_R10, 0);
+	}
+
+	if (ir->pat)
+		x86_patterns[ir->pat - 1].emit(ir);
+	else switch (ir->op) {
 	case IR_LOADI:
-		emit("movq $%ld, %%%s", ir->o1, x86_reg(ir->dst, 8));
+		if (ir->o1 == 0)
+			as_rr(AS_XOR, 4, x86_reg(ir->dst), x86_reg(ir->dst));
+		else if (ir->o1 > 0 && ir->o1 <= INT_MAX)
+			as_ri(AS_MOV, 4, ir->o1, x86_reg(ir->dst));
+		else
+			as_ri(AS_MOV, 8, ir->o1, x86_reg(ir->dst));
 		break;
 	case IR_LOADG:
-		emit("leaq %s(%%rip), %%%s", (char *)ir->o1,
-		    x86_reg(ir->dst, 8));
-		break;
-	case IR_LOAD:
-		emit("movq (%%%s), %%%s", x86_reg(ir->o1, 8), x86_reg(ir->dst,
-		    8));
-		break;
-	case IR_LOAD32:
-		emit("movl (%%%s), %%%s", x86_reg(ir->o1, 8), x86_reg(ir->dst,
-		    4));
-		break;
-	case IR_LOAD8:
-		emit("movb (%%%s), %%%s", x86_reg(ir->o1, 8), x86_reg(ir->dst,
-		    1));
-		break;
-	case IR_LOADO:
-		emit("movq 0(%%%s,%%%s,1), %%%s", x86_reg(ir->o1, 8),
-		    x86_reg(ir->o2, 8), x86_reg(ir->dst, 8));
-		break;
-	case IR_LOADO32:
-		emit("movl 0(%%%s,%%%s,1), %%%s", x86_reg(ir->o1, 8),
-		    x86_reg(ir->o2, 8), x86_reg(ir->dst, 4));
-		break;
-	case IR_LOADO8:
-		emit("movb 0(%%%s,%%%s,1), %%%s", x86_reg(ir->o1, 8),
-		    x86_reg(ir->o2, 8), x86_reg(ir->dst, 1));
-		break;
-	case IR_STORE:
-		emit("movq %%%s, (%%%s)", x86_reg(ir->o1, 8), x86_reg(ir->dst,
-		    8));
-		break;
-	case IR_STORE32:
-		emit("movl %%%s, (%%%s)", x86_reg(ir->o1, 4), x86_reg(ir->dst,
-		    8));
-		break;
-	case IR_STORE8:
-		emit("movb %%%s, (%%%s)", x86_reg(ir->o1, 1), x86_reg(ir->dst,
-		    8));
-		break;
-	case IR_KILL:
-		kill_reg(ir->o1);
+		as_sym(AS_LEA, (char *)ir->o1, x86_reg(ir->dst));
 		break;
 	case IR_ADD:
+		as_load(AS_LEA, 8, x86_reg(ir->o2), x86_reg(ir->o1), 1, 0,
+		    x86_reg(ir->dst));
+		break;
 	case IR_SUB:
-		if (ir->op == IR_SUB)
-			emit("negq %%%s", x86_reg(ir->o2, 8));
-		emit("leaq (%%%s, %%%s), %%%s", x86_reg(ir->o2, 8),
-		    x86_reg(ir->o1, 8), x86_reg(ir->dst, 8));
+		emit_alu(AS_SUB, 0, ir);
 		break;
 	case IR_MUL:
-		if (ir->next->op !=  IR_KILL || ir->next->o1 != ir->o1)
-			emit("pushq %%%s", x86_reg(ir->o1, 8));
-		if (ir->op == IR_MUL)
-			emit("imulq %%%s, %%%s", x86_reg(ir->o2, 8),
-			    x86_reg(ir->o1, 8));
-		emit("movq %%%s, %%%s", x86_reg(ir->o1, 8), x86_reg(ir->dst,
-		    8));
-		if (ir->next->op !=  IR_KILL || ir->next->o1 != ir->o1)
-			emit("popq %%%s", x86_reg(ir->o1, 8));
+		emit_alu(AS_IMUL, 1, ir);
 		break;
 	case IR_DIV:
-		emit("pushq %%rax");
-		emit("pushq %%rdx");
-		if (ir_regs[ir->o2] == RAX) {
-			emit("xchg %%%s, %%rax", x86_reg(ir->o1, 8));
-			emit("xorl %%edx,%%edx");
-			emit("idivq %%%s", x86_reg(ir->o1, 8));
-		} else {
-			emit("movq %%%s,%%rax", x86_reg(ir->o1, 8));
-			emit("xorl %%edx,%%edx");
-			emit("idivq %%%s", x86_reg(ir->o2, 8));
-		}
-		emit("popq %%rdx");
-		emit("movq %%rax, %%%s", x86_reg(ir->dst, 8));
-		if (ir_regs[ir->dst] != RAX)
-			emit("popq %%rax");
+	case IR_MOD:
+	case IR_MULH:
+		emit_div(ir);
 		break;
 	case IR_OR:
+		emit_alu(AS_OR, 1, ir);
+		break;
 	case IR_AND:
+		emit_alu(AS_AND, 1, ir);
+		break;
 	case IR_XOR:
-		if (ir->op == IR_OR)
-			instr = "orq";
-		else if (ir->op == IR_AND)
-			instr = "andq";
-		else if (ir->op == IR_XOR)
-			instr = "xorq";
-		emit("pushq %%%s", x86_reg(ir->o2, 8));
-		emit("%s %%%s, %%%s", instr, x86_reg(ir->o1, 8),
-		    x86_reg(ir->o2, 8));
-		emit("movq %%%s, %%%s", x86_reg(ir->o2, 8), x86_reg(ir->dst,
-		    8));
-		emit("popq %%%s", x86_reg(ir->o2, 8));
+		emit_alu(AS_XOR, 1, ir);
 		break;
 	case IR_NOT:
-		emit("testq %%%s, %%%s", x86_reg(ir->o1, 8), x86_reg(ir->o1,
-		    8));
-		emit("seteb %%%s", x86_reg(ir->dst, 1));
-		emit("movzbq %%%s, %%%s", x86_reg(ir->dst, 1), x86_reg(ir->dst,
-		    8));
+		as_rr(AS_TEST, 8, x86_reg(ir->o1), x86_reg(ir->o1));
+		as_r(AS_SETE, 1, x86_reg(ir->dst));
+		as_rr(AS_MOVZB, 8, x86_reg(ir->dst), x86_reg(ir->dst));
 		break;
 	case IR_NE:
 	case IR_EQ:
@@ -241,118 +728,85 @@ emit_x86_op(struct ir *ir)
 	case IR_LE:
 	case IR_GT:
 	case IR_GE:
-		emit("xorl %%%s,%%%s", x86_reg(ir->dst, 4), x86_reg(ir->dst,
-		    4));
-		emit("cmpq %%%s,%%%s", x86_reg(ir->o2, 8), x86_reg(ir->o1, 8));
-		if (ir->op == IR_EQ)
-			emit("sete %%%s", x86_reg(ir->dst, 1));
-		else if (ir->op == IR_NE)
-			emit("setne %%%s", x86_reg(ir->dst, 1));
-		else if (ir->op == IR_LT)
-			emit("setl %%%s", x86_reg(ir->dst, 1));
-		else if (ir->op == IR_LE)
-			emit("setle %%%s", x86_reg(ir->dst, 1));
-		else if (ir->op == IR_GT)
-			emit("setg %%%s", x86_reg(ir->dst, 1));
-		else if (ir->op == IR_GE)
-			emit("setge %%%s", x86_reg(ir->dst, 1));
+		as_rr(AS_CMP, 8, x86_reg(ir->o2), x86_reg(ir->o1));
+		if (ir->dst == -1)
+			break;
+		as_r(setcc(ir->op), 1, x86_reg(ir->dst));
+		as_rr(AS_MOVZB, 8, x86_reg(ir->dst), x86_reg(ir->dst));
 		break;
 	case IR_CBR:
-		emit("testq %%%s, %%%s", x86_reg(ir->o1, 8), x86_reg(ir->o1,
-		    8));
-		emit("jne .L%d", ir->o2);
-		emit("je .L%d", ir->dst);
+		as_rr(AS_TEST, 8, x86_reg(ir->o1), x86_reg(ir->o1));
+		emit_branch(ir, IR_NE);
 		break;
 	case IR_JUMP:
-		emit("jmp .L%d", ir->dst);
+		if (!falls_to(ir, ir->dst))
+			as_jmp(AS_JMP, ir->dst);
 		break;
 	case IR_LABEL:
-		emit(".L%d:", ir->o1);
+		as_label(ir->o1);
 		break;
 	case IR_MOV:
-		emit("mov %%%s, %%%s", x86_reg(ir->o1, 8), x86_reg(ir->dst, 8));
+		emit_mov(ir->o2, x86_reg(ir->o1), x86_reg(ir->dst));
 		break;
 	case IR_CALL:
-		for (i = 1; i < MAX_IR_REGS; i++)
-			if (ir_regs[i] && i != ir->dst)
-				emit("pushq %%%s", x86_regs_names[ir_regs[i]]);
-		p = (struct param *)ir->o2;
-		i = 0;
-		while (p) {
-			int size;
-
-			size = p->n->type->size;
-			/* XXX more than 6 params */
-			if (i < NR_FUNC_PARAM_REGS)
-				emit("mov %%%s, %%%s", x86_reg(p->val, size),
-				    func_param_reg(i++, size));
-			p = p->next;
-		}
-		emit("xorl %%eax, %%eax");
-		emit("callq %s", ((struct symbol *)ir->o1)->name);
-		emit("movq %%rax, %%%s", x86_reg(ir->dst, 8));
-		for (i = MAX_IR_REGS; i >= 1; i--)
-			if (ir_regs[i] && i != ir->dst)
-				emit("popq %%%s", x86_regs_names[ir_regs[i]]);
+		emit_call(ir);
+		break;
+	case IR_VLOOP:
+		emit_vloop(ir);
 		break;
 	case IR_ENTER:
-		kill_all();
-		emit("pushq %%rbp");
-		emit("movq %%rsp, %%rbp");
-		emit("subq $%d, %%rsp", ir->o1);
-		p = (struct param *)ir->o2;
-		off = i = 0;
-		while (p) {
-			if (i < NR_FUNC_PARAM_REGS)
-				emit("mov %%%s, %d(%%rsp)",
-				    func_param_reg(i, p->sym->type->size), off);
-			i++;
-			off += p->sym->type->size;
-			p = p->next;
-		}
+		as_r(AS_PUSH, 8, X86_RBP);
+		as_rr(AS_MOV, 8, X86_RSP, X86_RBP);
+		as_ri(AS_SUB, 8, ir->o1, X86_RSP);
+		emit_params(ir);
 		break;
 	case IR_RET:
-		emit("movq %%%s, %%rax", x86_reg(ir->o1, 8));
-		emit("leaveq");
-		emit("retq");
+		if (ir->o1 != -1)
+			as_rr(AS_MOV, 8, x86_reg(ir->o1), X86_RAX);
+		as_op(AS_LEAVE);
+		as_op(AS_RET);
 		break;
 	default:
 		errx(1, "Unknown IR instruction %d", ir->op);
 	}
+	if (ir->op != IR_CALL && ir_defines(ir) && spilled(ir->dst))
+		as_store(8, x86_reg(ir->dst), X86_RBP, -1, 1,
+		    spill_off(ir->dst));
 }
 
 void
-emit_x86(void)
+emit_x86_data(void)
 {
-	struct ir *ir;
-	int i;
-
-	if ((out = fopen("out.S", "w")) < 0)
-		err(1, "fopen");
+	struct symbol *s;
 
-	emit(".data");
-	for (i = 0; i < SYMTAB_SIZE; i++) {
-		if (symtab->tab[i] && !symtab->tab[i]->func) {
-			emit("%s:", symtab->tab[i]->name);
-			emit(".skip %ld", symtab->tab[i]->type->stacksize);
+	as_section(AS_DATA);
+	for (s = globals; s; s = s->next) {
+		if (!s->func) {
+			as_symbol(s->name);
+			as_skip(s->type->stacksize);
 		}
 	}
+	as_section(AS_RODATA);
 	while (strings) {
-		emit("%s:", strings->name);
-		emit(".asciz \"%s\"", strings->str);
+		as_symbol(strings->name);
+		as_asciz(strings->str);
 		strings = strings->next;
 	}
 
-	emit(".text");
-	for (i = 0; i < SYMTAB_SIZE; i++) {
-		if (symtab->tab[i] && symtab->tab[i]->body) {
-			emit(".globl %s", symtab->tab[i]->name);
-			emit("%s:", symtab->tab[i]->name);
-			for(ir = symtab->tab[i]->ir; ir; ir = ir->next)
-				emit_x86_op(ir);
-		}
-	}
+	as_section(AS_TEXT);
+}
+
+void
+emit_x86_func(struct symbol *s)
+{
+	struct ir *ir;
 
-	if (fclose(out))
-		err(1, "fclose");
+	s->ir = isel(strip_kills(s->ir), x86_patterns, NR_X86_PATTERNS);
+	ir_locs = regalloc(s->ir, NR_X86_ALLOC_REGS);
+	as_global(s->name);
+	as_symbol(s->name);
+	as_record();
+	for (ir = s->ir; ir; ir = ir->next)
+		emit_x86_op(ir);
+	as_replay(opt_level > 0);
 }
@@ -0,0 +1,1133 @@
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <elf.h>
+#include <err.h>
+
+#include "rcc.h"
+
+/*
+ * x86-64 instruction output. The code generator describes each
+ * instruction once; it is either printed as AT&T assembly (-S) or encoded
+ * into the sections of an ELF relocatable object. Vector instructions of
+ * size 16 are SSE2 and of size 32 the VEX-encoded AVX2 ones, which take
+ * a second source instead of overwriting it.
+ */
+
+static int as_object;
+static enum as_section cur_sect;
+
+/* A function's instructions, held back for the peephole optimiser. */
+static struct minst *insts;
+static int nr_insts, max_insts;
+static int recording;
+
+static char *as_names[NR_AS_OPS] = {
+    [AS_ADD] = "add",
+    [AS_SUB] = "sub",
+    [AS_AND] = "and",
+    [AS_OR] = "or",
+    [AS_XOR] = "xor",
+    [AS_CMP] = "cmp",
+    [AS_TEST] = "test",
+    [AS_MOV] = "mov",
+    [AS_XCHG] = "xchg",
+    [AS_IMUL] = "imul",
+    [AS_SHL] = "shl",
+    [AS_SHR] = "shr",
+    [AS_SAR] = "sar",
+    [AS_MOVZB] = "movzb",
+    [AS_LEA] = "lea",
+    [AS_NEG] = "neg",
+    [AS_IDIV] = "idiv",
+    [AS_PUSH] = "push",
+    [AS_POP] = "pop",
+    [AS_SETE] = "sete",
+    [AS_SETNE] = "setne",
+    [AS_SETL] = "setl",
+    [AS_SETLE] = "setle",
+    [AS_SETG] = "setg",
+    [AS_SETGE] = "setge",
+    [AS_JMP] = "jmp",
+    [AS_JE] = "je",
+    [AS_JNE] = "jne",
+    [AS_JL] = "jl",
+    [AS_JLE] = "jle",
+    [AS_JG] = "jg",
+    [AS_JGE] = "jge",
+    [AS_JB] = "jb",
+    [AS_JAE] = "jae",
+    [AS_CALL] = "call",
+    [AS_LEAVE] = "leave",
+    [AS_RET] = "ret",
+    [AS_CQTO] = "cqto",
+    [AS_MOVDQU] = "movdqu",
+    [AS_MOVDQA] = "movdqa",
+    [AS_MOVQ] = "movq",
+    [AS_PADDB] = "paddb",
+    [AS_PADDD] = "paddd",
+    [AS_PADDQ] = "paddq",
+    [AS_PSUBB] = "psubb",
+    [AS_PSUBD] = "psubd",
+    [AS_PSUBQ] = "psubq",
+    [AS_PAND] = "pand",
+    [AS_POR] = "por",
+    [AS_PXOR] = "pxor",
+    [AS_PUNPCKLBW] = "punpcklbw",
+    [AS_PUNPCKLWD] = "punpcklwd",
+    [AS_PUNPCKLQDQ] = "punpcklqdq",
+    [AS_PSHUFD] = "pshufd",
+    [AS_PBROADCASTB] = "pbroadcastb",
+    [AS_PBROADCASTD] = "pbroadcastd",
+    [AS_PBROADCASTQ] = "pbroadcastq",
+    [AS_VZEROUPPER] = "vzeroupper",
+};
+
+/* Opcode of the r/m, reg form; the 8-bit form is one less. */
+static unsigned char alu_opcodes[NR_AS_OPS] = {
+    [AS_ADD] = 0x01,
+    [AS_SUB] = 0x29,
+    [AS_AND] = 0x21,
+    [AS_OR] = 0x09,
+    [AS_XOR] = 0x31,
+    [AS_CMP] = 0x39,
+    [AS_TEST] = 0x85,
+    [AS_MOV] = 0x89,
+    [AS_XCHG] = 0x87,
+};
+
+/* The /digit of the 0x81 and 0x83 immediate forms. */
+static unsigned char alu_imm_ext[NR_AS_OPS] = {
+    [AS_ADD] = 0,
+    [AS_OR] = 1,
+    [AS_AND] = 4,
+    [AS_SUB] = 5,
+    [AS_XOR] = 6,
+    [AS_CMP] = 7,
+};
+
+/* The /digit of the 0xc1 shifts and of the 0xf7 group. */
+static unsigned char grp_ext[NR_AS_OPS] = {
+    [AS_SHL] = 4,
+    [AS_SHR] = 5,
+    [AS_SAR] = 7,
+    [AS_NEG] = 3,
+    [AS_IMUL] = 5,
+    [AS_IDIV] = 7,
+};
+
+static unsigned char setcc_opcodes[NR_AS_OPS] = {
+    [AS_SETE] = 0x94,
+    [AS_SETNE] = 0x95,
+    [AS_SETL] = 0x9c,
+    [AS_SETGE] = 0x9d,
+    [AS_SETLE] = 0x9e,
+    [AS_SETG] = 0x9f,
+};
+
+static unsigned char jcc_opcodes[NR_AS_OPS] = {
+    [AS_JE] = 0x84,
+    [AS_JNE] = 0x85,
+    [AS_JL] = 0x8c,
+    [AS_JGE] = 0x8d,
+    [AS_JLE] = 0x8e,
+    [AS_JG] = 0x8f,
+    [AS_JB] = 0x82,
+    [AS_JAE] = 0x83,
+};
+
+/* Opcode after 0x0f of the reg, r/m forms; the broadcasts are 0x0f 0x38. */
+static unsigned char vec_opcodes[NR_AS_OPS] = {
+    [AS_MOVDQA] = 0x6f,
+    [AS_MOVQ] = 0x6e,
+    [AS_PADDB] = 0xfc,
+    [AS_PADDD] = 0xfe,
+    [AS_PADDQ] = 0xd4,
+    [AS_PSUBB] = 0xf8,
+    [AS_PSUBD] = 0xfa,
+    [AS_PSUBQ] = 0xfb,
+    [AS_PAND] = 0xdb,
+    [AS_POR] = 0xeb,
+    [AS_PXOR] = 0xef,
+    [AS_PUNPCKLBW] = 0x60,
+    [AS_PUNPCKLWD] = 0x61,
+    [AS_PUNPCKLQDQ] = 0x6c,
+    [AS_PSHUFD] = 0x70,
+    [AS_PBROADCASTB] = 0x78,
+    [AS_PBROADCASTD] = 0x58,
+    [AS_PBROADCASTQ] = 0x59,
+};
+
+static char *reg_names_64[NR_X86_HW_REGS] = { "rax", "rcx", "rdx", "rbx",
+    "rsp", "rbp", "rsi", "rdi", "r8", "r9", "r10", "r11", "r12", "r13", "r14",
+    "r15" };
+static char *reg_names_32[NR_X86_HW_REGS] = { "eax", "ecx", "edx", "ebx",
+    "esp", "ebp", "esi", "edi", "r8d", "r9d", "r10d", "r11d", "r12d", "r13d",
+    "r14d", "r15d" };
+static char *reg_names_16[NR_X86_HW_REGS] = { "ax", "cx", "dx", "bx", "sp",
+    "bp", "si", "di", "r8w", "r9w", "r10w", "r11w", "r12w", "r13w", "r14w",
+    "r15w" };
+static char *reg_names_8[NR_X86_HW_REGS] = { "al", "cl", "dl", "bl", "spl",
+    "bpl", "sil", "dil", "r8b", "r9b", "r10b", "r11b", "r12b", "r13b", "r14b",
+    "r15b" };
+
+static char size_suffix[9] = { [1] = 'b', [2] = 'w', [4] = 'l', [8] = 'q' };
+
+/* Branches are encoded with rel32 and patched when the unit is done. */
+struct fixup {
+	unsigned long off;
+	int label;
+};
+
+static long *labels;
+static int max_labels;
+static struct fixup *fixups;
+static int nr_fixups, max_fixups;
+
+struct enc {
+	unsigned char b[16];
+	int n;
+};
+
+static void
+text_reg(int r, int size)
+{
+	out_char('%');
+	if (size == 1)
+		out_str(reg_names_8[r]);
+	else if (size == 2)
+		out_str(reg_names_16[r]);
+	else if (size == 4)
+		out_str(reg_names_32[r]);
+	else
+		out_str(reg_names_64[r]);
+}
+
+static void
+text_vreg(int r, int size)
+{
+	out_str(size == 32 ? "%ymm" : "%xmm");
+	out_long(r);
+}
+
+static void
+text_mem(int base, int index, int scale, int disp)
+{
+	if (disp)
+		out_long(disp);
+	out_char('(');
+	text_reg(base, 8);
+	if (index != -1) {
+		out_char(',');
+		text_reg(index, 8);
+		out_char(',');
+		out_char('0' + scale);
+	}
+	out_char(')');
+}
+
+static void
+text_op(enum as_op op, int size)
+{
+	out_str(as_names[op]);
+	if (size)
+		out_char(size_suffix[size]);
+	out_char(' ');
+}
+
+static void
+enc_byte(struct enc *e, int b)
+{
+	e->b[e->n++] = b;
+}
+
+static void
+enc_int(struct enc *e, long v, int len)
+{
+	while (len--) {
+		e->b[e->n++] = v;
+		v >>= 8;
+	}
+}
+
+/*
+ * Operand size and REX prefixes. Byte operands in spl, bpl, sil and dil
+ * need an empty REX to not mean ah, ch, dh and bh.
+ */
+static void
+enc_prefix(struct enc *e, int size, int reg, int index, int rm, int byte_regs)
+{
+	int rex;
+
+	rex = 0;
+	if (size == 2)
+		enc_byte(e, 0x66);
+	if (size == 8)
+		rex |= 8;
+	if (reg >= 8)
+		rex |= 4;
+	if (index >= 8)
+		rex |= 2;
+	if (rm >= 8)
+		rex |= 1;
+	if (rex || (byte_regs && ((reg >= 4 && reg < 8) || (rm >= 4 &&
+	    rm < 8))))
+		enc_byte(e, 0x40 | rex);
+}
+
+/*
+ * The prefixes and the opcode escape of a vector instruction: 0x66 or
+ * 0xf3, REX and 0x0f (0x0f 0x38 if map is 2) for SSE, or all of that
+ * folded into a VEX prefix for size 32, with vvvv the second source.
+ */
+static void
+enc_vec(struct enc *e, int size, int pp, int map, int w, int reg, int vvvv,
+    int index, int rm)
+{
+	static unsigned char pp_bytes[3] = { 0, 0x66, 0xf3 };
+	int rxb;
+
+	if (size != 32) {
+		enc_byte(e, pp_bytes[pp]);
+		enc_prefix(e, w ? 8 : 4, reg, index, rm, 0);
+		enc_byte(e, 0x0f);
+		if (map == 2)
+			enc_byte(e, 0x38);
+		return;
+	}
+	rxb = (reg < 8) << 7 | (index < 8) << 6 | (rm < 8) << 5;
+	if ((rxb & 0x60) == 0x60 && map == 1 && !w)
+		enc_byte(e, 0xc5);
+	else {
+		enc_byte(e, 0xc4);
+		enc_byte(e, rxb | map);
+		rxb = w << 7;
+	}
+	enc_byte(e, (rxb & 0x80) | (~vvvv & 15) << 3 | 4 | pp);
+}
+
+static void
+enc_modrm_reg(struct enc *e, int reg, int rm)
+{
+	enc_byte(e, 0xc0 | (reg & 7) << 3 | (rm & 7));
+}
+
+static void
+enc_modrm_mem(struct enc *e, int reg, int base, int index, int scale,
+    int disp)
+{
+	static unsigned char ss[9] = { [2] = 1, [4] = 2, [8] = 3 };
+	int mod;
+
+	if (disp == 0 && (base & 7) != 5)
+		mod = 0;
+	else if (disp >= -128 && disp <= 127)
+		mod = 1;
+	else
+		mod = 2;
+	if (index != -1) {
+		enc_byte(e, mod << 6 | (reg & 7) << 3 | 4);
+		enc_byte(e, ss[scale] << 6 | (index & 7) << 3 | (base & 7));
+	} else if ((base & 7) == 4) {
+		enc_byte(e, mod << 6 | (reg & 7) << 3 | 4);
+		enc_byte(e, 0x24);
+	} else
+		enc_byte(e, mod << 6 | (reg & 7) << 3 | (base & 7));
+	if (mod == 1)
+		enc_int(e, disp, 1);
+	else if (mod == 2)
+		enc_int(e, disp, 4);
+}
+
+static void
+enc_emit(struct enc *e)
+{
+	elf_bytes(cur_sect, e->b, e->n);
+}
+
+static struct minst *
+record(int kind, enum as_op op, int size)
+{
+	struct minst *mi;
+
+	if (nr_insts == max_insts) {
+		max_insts = max_insts ? max_insts * 2 : 1024;
+		if ((insts = realloc(insts, max_insts *
+		    sizeof(struct minst))) == NULL)
+			err(1, "realloc");
+	}
+	mi = &insts[nr_insts++];
+	memset(mi, 0, sizeof(struct minst));
+	mi->kind = kind;
+	mi->op = op;
+	mi->size = size;
+	return (mi);
+}
+
+/* Hold back what follows until as_replay(). */
+void
+as_record(void)
+{
+	recording = 1;
+	nr_insts = 0;
+}
+
+/* Put out what was held back, through the peephole optimiser if peep. */
+void
+as_replay(int peep)
+{
+	struct minst *mi;
+	int i;
+
+	recording = 0;
+	if (peep)
+		peephole(insts, nr_insts);
+	for (i = 0; i < nr_insts; i++) {
+		mi = &insts[i];
+		switch (mi->kind) {
+		case MI_COMMENT:
+			as_comment("%s", mi->sym);
+			break;
+		case MI_LABEL:
+			as_label(mi->imm);
+			break;
+		case MI_RR:
+			as_rr(mi->op, mi->size, mi->src, mi->dst);
+			break;
+		case MI_RI:
+			as_ri(mi->op, mi->size, mi->imm, mi->dst);
+			break;
+		case MI_R:
+			as_r(mi->op, mi->size, mi->dst);
+			break;
+		case MI_RRI:
+			as_rri(mi->op, mi->size, mi->imm, mi->src, mi->dst);
+			break;
+		case MI_LOAD:
+			as_load(mi->op, mi->size, mi->base, mi->index,
+			    mi->scale, mi->disp, mi->dst);
+			break;
+		case MI_STORE:
+			as_store(mi->size, mi->src, mi->base, mi->index,
+			    mi->scale, mi->disp);
+			break;
+		case MI_SYM:
+			as_sym(mi->op, mi->sym, mi->dst);
+			break;
+		case MI_JMP:
+			as_jmp(mi->op, mi->imm);
+			break;
+		case MI_OP:
+			as_op(mi->op);
+			break;
+		case MI_VLOAD:
+			as_vload(mi->size, mi->base, mi->index, mi->scale,
+			    mi->disp, mi->dst);
+			break;
+		case MI_VSTORE:
+			as_vstore(mi->size, mi->src, mi->base, mi->index,
+			    mi->scale, mi->disp);
+			break;
+		case MI_VRR:
+			as_vrr(mi->op, mi->size, mi->src, mi->src2, mi->dst);
+			break;
+		}
+	}
+}
+
+void
+as_open(int object)
+{
+	as_object = object;
+	cur_sect = AS_TEXT;
+}
+
+void
+as_close(void)
+{
+	struct fixup *f;
+	int i;
+
+	if (!as_object) {
+		out_str(".section .note.GNU-stack,\"\",@progbits\n");
+		return;
+	}
+	for (i = 0; i < nr_fixups; i++) {
+		f = &fixups[i];
+		if (f->label >= max_labels || !labels[f->label])
+			errx(1, "Undefined label .L%d", f->label);
+		elf_patch32(AS_TEXT, f->off, labels[f->label] - 1 - (f->off +
+		    4));
+	}
+	elf_write();
+}
+
+void
+as_comment(char *fmt, ...)
+{
+	struct minst *mi;
+	char buf[256];
+	va_list ap;
+
+	if (as_object)
+		return;
+	if (recording) {
+		va_start(ap, fmt);
+		vsnprintf(buf, sizeof(buf), fmt, ap);
+		va_end(ap);
+		mi = record(MI_COMMENT, 0, 0);
+		mi->sym = arena_alloc(&ir_arena, strlen(buf) + 1);
+		strcpy(mi->sym, buf);
+		return;
+	}
+	va_start(ap, fmt);
+	out_str("# ");
+	out_vfmt(fmt, ap);
+	va_end(ap);
+	out_char('\n');
+}
+
+void
+as_section(enum as_section sect)
+{
+	static char *directives[NR_AS_SECTIONS] = {
+	    [AS_TEXT] = ".text\n",
+	    [AS_DATA] = ".data\n",
+	    [AS_RODATA] = ".section .rodata\n",
+	};
+
+	cur_sect = sect;
+	if (!as_object)
+		out_str(directives[sect]);
+}
+
+void
+as_global(char *name)
+{
+	if (as_object)
+		elf_global(name);
+	else {
+		out_str(".globl ");
+		out_str(name);
+		out_char('\n');
+	}
+}
+
+void
+as_symbol(char *name)
+{
+	if (as_object)
+		elf_symbol(name, cur_sect);
+	else {
+		out_str(name);
+		out_str(":\n");
+	}
+}
+
+void
+as_skip(int n)
+{
+	if (as_object)
+		elf_bytes(cur_sect, NULL, n);
+	else {
+		out_str(".skip ");
+		out_long(n);
+		out_char('\n');
+	}
+}
+
+/* The string is still spelled as in the source, escapes and all. */
+void
+as_asciz(char *s)
+{
+	char c;
+	int i, v;
+
+	if (!as_object) {
+		out_str(".asciz \"");
+		out_str(s);
+		out_str("\"\n");
+		return;
+	}
+	while ((c = *s++)) {
+		if (c == '\\') {
+			switch ((c = *s++)) {
+			case 'a':
+				c = '\a';
+				break;
+			case 'b':
+				c = '\b';
+				break;
+			case 'f':
+				c = '\f';
+				break;
+			case 'n':
+				c = '\n';
+				break;
+			case 'r':
+				c = '\r';
+				break;
+			case 't':
+				c = '\t';
+				break;
+			case 'v':
+				c = '\v';
+				break;
+			case 'x':
+				for (v = 0; isxdigit((unsigned char)*s); s++)
+					v = v * 16 + (isdigit((unsigned char)*s) ?
+					    *s - '0' : (*s | 0x20) - 'a' + 10);
+				c = v;
+				break;
+			case '\0':
+				errx(1, "Bad escape in string");
+			default:
+				if (c >= '0' && c <= '7') {
+					v = c - '0';
+					for (i = 1; i < 3 && *s >= '0' &&
+					    *s <= '7'; i++)
+						v = v * 8 + *s++ - '0';
+					c = v;
+				}
+				break;
+			}
+		}
+		elf_bytes(cur_sect, &c, 1);
+	}
+	elf_bytes(cur_sect, "", 1);
+}
+
+void
+as_label(int l)
+{
+	int max;
+
+	if (recording) {
+		record(MI_LABEL, 0, 0)->imm = l;
+		return;
+	}
+	if (!as_object) {
+		out_str(".L");
+		out_long(l);
+		out_str(":\n");
+		return;
+	}
+	if (l >= max_labels) {
+		max = max_labels;
+		while (l >= max_labels)
+			max_labels = max_labels ? max_labels * 2 : 1024;
+		if ((labels = realloc(labels, max_labels * sizeof(long))) ==
+		    NULL)
+			err(1, "realloc");
+		memset(labels + max, 0, (max_labels - max) * sizeof(long));
+	}
+	/* Offset + 1, so that 0 is an undefined label. */
+	labels[l] = elf_offset(AS_TEXT) + 1;
+}
+
+/* op src, dst */
+void
+as_rr(enum as_op op, int size, int src, int dst)
+{
+	struct minst *mi;
+	struct enc e;
+
+	if (recording) {
+		mi = record(MI_RR, op, size);
+		mi->src = src;
+		mi->dst = dst;
+		return;
+	}
+	if (!as_object) {
+		text_op(op, op == AS_MOVZB ? 8 : size);
+		text_reg(src, op == AS_MOVZB ? 1 : size);
+		out_str(", ");
+		text_reg(dst, op == AS_MOVZB ? 8 : size);
+		out_char('\n');
+		return;
+	}
+	e.n = 0;
+	switch (op) {
+	case AS_IMUL:
+		enc_prefix(&e, size, dst, -1, src, 0);
+		enc_byte(&e, 0x0f);
+		enc_byte(&e, 0xaf);
+		enc_modrm_reg(&e, dst, src);
+		break;
+	case AS_MOVZB:
+		enc_prefix(&e, 8, dst, -1, src, src >= 4 && src < 8);
+		enc_byte(&e, 0x0f);
+		enc_byte(&e, 0xb6);
+		enc_modrm_reg(&e, dst, src);
+		break;
+	default:
+		if (!alu_opcodes[op])
+			errx(1, "Bad register operation %s", as_names[op]);
+		enc_prefix(&e, size, src, -1, dst, size == 1);
+		enc_byte(&e, alu_opcodes[op] - (size == 1));
+		enc_modrm_reg(&e, src, dst);
+		break;
+	}
+	enc_emit(&e);
+}
+
+/* op $imm, dst */
+void
+as_ri(enum as_op op, int size, long imm, int dst)
+{
+	struct minst *mi;
+	struct enc e;
+
+	if (recording) {
+		mi = record(MI_RI, op, size);
+		mi->imm = imm;
+		mi->dst = dst;
+		return;
+	}
+	if (!as_object) {
+		text_op(op, size);
+		out_char('$');
+		out_long(imm);
+		out_str(", ");
+		text_reg(dst, size);
+		out_char('\n');
+		return;
+	}
+	e.n = 0;
+	if (op == AS_MOV) {
+		if (size == 8 && imm == (int)imm) {
+			enc_prefix(&e, 8, 0, -1, dst, 0);
+			enc_byte(&e, 0xc7);
+			enc_modrm_reg(&e, 0, dst);
+			enc_int(&e, imm, 4);
+		} else {
+			enc_prefix(&e, size, 0, -1, dst, 0);
+			enc_byte(&e, 0xb8 + (dst & 7));
+			enc_int(&e, imm, size);
+		}
+	} else if (op == AS_SHL || op == AS_SHR || op == AS_SAR) {
+		enc_prefix(&e, size, 0, -1, dst, 0);
+		enc_byte(&e, 0xc1);
+		enc_modrm_reg(&e, grp_ext[op], dst);
+		enc_int(&e, imm, 1);
+	} else {
+		if (size != 8 || imm != (int)imm)
+			errx(1, "Bad immediate operation %s", as_names[op]);
+		enc_prefix(&e, 8, 0, -1, dst, 0);
+		if (imm >= -128 && imm <= 127) {
+			enc_byte(&e, 0x83);
+			enc_modrm_reg(&e, alu_imm_ext[op], dst);
+			enc_int(&e, imm, 1);
+		} else {
+			enc_byte(&e, 0x81);
+			enc_modrm_reg(&e, alu_imm_ext[op], dst);
+			enc_int(&e, imm, 4);
+		}
+	}
+	enc_emit(&e);
+}
+
+/* op reg */
+void
+as_r(enum as_op op, int size, int r)
+{
+	struct enc e;
+
+	if (recording) {
+		record(MI_R, op, size)->dst = r;
+		return;
+	}
+	if (!as_object) {
+		text_op(op, setcc_opcodes[op] ? 0 : size);
+		text_reg(r, size);
+		out_char('\n');
+		return;
+	}
+	e.n = 0;
+	switch (op) {
+	case AS_PUSH:
+	case AS_POP:
+		enc_prefix(&e, 4, 0, -1, r, 0);
+		enc_byte(&e, (op == AS_PUSH ? 0x50 : 0x58) + (r & 7));
+		break;
+	case AS_NEG:
+	case AS_IMUL:
+	case AS_IDIV:
+		enc_prefix(&e, size, 0, -1, r, size == 1);
+		enc_byte(&e, size == 1 ? 0xf6 : 0xf7);
+		enc_modrm_reg(&e, grp_ext[op], r);
+		break;
+	default:
+		if (!setcc_opcodes[op])
+			errx(1, "Bad register operation %s", as_names[op]);
+		enc_prefix(&e, 1, 0, -1, r, 1);
+		enc_byte(&e, 0x0f);
+		enc_byte(&e, setcc_opcodes[op]);
+		enc_modrm_reg(&e, 0, r);
+		break;
+	}
+	enc_emit(&e);
+}
+
+/*
+ * %rsp can't be an index, but with a scale of 1 it can be swapped with
+ * the base.
+ */
+static void
+swap_rsp(int *base, int *index, int scale)
+{
+	if (*index == X86_RSP) {
+		if (scale != 1)
+			errx(1, "%%rsp can't be scaled");
+		*index = *base;
+		*base = X86_RSP;
+	}
+}
+
+/*
+ * op disp(base,index,scale), dst: mov and movzb loads and lea. index is
+ * -1 if unused.
+ */
+void
+as_load(enum as_op op, int size, int base, int index, int scale, int disp,
+    int dst)
+{
+	struct minst *mi;
+	struct enc e;
+
+	if (recording) {
+		mi = record(MI_LOAD, op, size);
+		mi->base = base;
+		mi->index = index;
+		mi->scale = scale;
+		mi->disp = disp;
+		mi->dst = dst;
+		return;
+	}
+	if (!as_object) {
+		text_op(op, size);
+		text_mem(base, index, scale, disp);
+		out_str(", ");
+		text_reg(dst, size);
+		out_char('\n');
+		return;
+	}
+	swap_rsp(&base, &index, scale);
+	e.n = 0;
+	enc_prefix(&e, size, dst, index == -1 ? 0 : index, base, size == 1);
+	if (op == AS_LEA)
+		enc_byte(&e, 0x8d);
+	else if (op == AS_MOV)
+		enc_byte(&e, size == 1 ? 0x8a : 0x8b);
+	else if (op == AS_MOVZB) {
+		enc_byte(&e, 0x0f);
+		enc_byte(&e, 0xb6);
+	} else
+		errx(1, "Bad load operation %s", as_names[op]);
+	enc_modrm_mem(&e, dst, base, index, scale, disp);
+	enc_emit(&e);
+}
+
+/* mov src, disp(base,index,scale) */
+void
+as_store(int size, int src, int base, int index, int scale, int disp)
+{
+	struct minst *mi;
+	struct enc e;
+
+	if (recording) {
+		mi = record(MI_STORE, AS_MOV, size);
+		mi->src = src;
+		mi->base = base;
+		mi->index = index;
+		mi->scale = scale;
+		mi->disp = disp;
+		return;
+	}
+	if (!as_object) {
+		text_op(AS_MOV, size);
+		text_reg(src, size);
+		out_str(", ");
+		text_mem(base, index, scale, disp);
+		out_char('\n');
+		return;
+	}
+	swap_rsp(&base, &index, scale);
+	e.n = 0;
+	enc_prefix(&e, size, src, index == -1 ? 0 : index, base, size == 1);
+	enc_byte(&e, size == 1 ? 0x88 : 0x89);
+	enc_modrm_mem(&e, src, base, index, scale, disp);
+	enc_emit(&e);
+}
+
+/* imul $imm, src, dst */
+void
+as_rri(enum as_op op, int size, long imm, int src, int dst)
+{
+	struct minst *mi;
+	struct enc e;
+
+	if (recording) {
+		mi = record(MI_RRI, op, size);
+		mi->imm = imm;
+		mi->src = src;
+		mi->dst = dst;
+		return;
+	}
+	if (!as_object) {
+		text_op(op, size);
+		out_char('$');
+		out_long(imm);
+		out_str(", ");
+		text_reg(src, size);
+		out_str(", ");
+		text_reg(dst, size);
+		out_char('\n');
+		return;
+	}
+	if (op != AS_IMUL || imm != (int)imm)
+		errx(1, "Bad immediate operation %s", as_names[op]);
+	e.n = 0;
+	enc_prefix(&e, size, dst, -1, src, 0);
+	if (imm >= -128 && imm <= 127) {
+		enc_byte(&e, 0x6b);
+		enc_modrm_reg(&e, dst, src);
+		enc_int(&e, imm, 1);
+	} else {
+		enc_byte(&e, 0x69);
+		enc_modrm_reg(&e, dst, src);
+		enc_int(&e, imm, 4);
+	}
+	enc_emit(&e);
+}
+
+/* leaq sym(%rip), dst or callq sym */
+void
+as_sym(enum as_op op, char *sym, int dst)
+{
+	struct minst *mi;
+	struct enc e;
+
+	if (recording) {
+		mi = record(MI_SYM, op, 8);
+		mi->sym = sym;
+		mi->dst = dst;
+		return;
+	}
+	if (!as_object) {
+		text_op(op, 8);
+		out_str(sym);
+		if (op == AS_LEA) {
+			out_str("(%rip), ");
+			text_reg(dst, 8);
+		}
+		out_char('\n');
+		return;
+	}
+	e.n = 0;
+	if (op == AS_LEA) {
+		enc_prefix(&e, 8, dst, -1, 0, 0);
+		enc_byte(&e, 0x8d);
+		enc_byte(&e, (dst & 7) << 3 | 5);
+		elf_reloc(elf_offset(AS_TEXT) + e.n, sym, R_X86_64_PC32, -4);
+	} else if (op == AS_CALL) {
+		enc_byte(&e, 0xe8);
+		elf_reloc(elf_offset(AS_TEXT) + e.n, sym, R_X86_64_PLT32, -4);
+	} else
+		errx(1, "Bad symbol operation %s", as_names[op]);
+	enc_int(&e, 0, 4);
+	enc_emit(&e);
+}
+
+void
+as_jmp(enum as_op op, int label)
+{
+	struct enc e;
+
+	if (recording) {
+		record(MI_JMP, op, 0)->imm = label;
+		return;
+	}
+	if (!as_object) {
+		text_op(op, 0);
+		out_str(".L");
+		out_long(label);
+		out_char('\n');
+		return;
+	}
+	e.n = 0;
+	if (op == AS_JMP)
+		enc_byte(&e, 0xe9);
+	else {
+		enc_byte(&e, 0x0f);
+		enc_byte(&e, jcc_opcodes[op]);
+	}
+	if (nr_fixups == max_fixups) {
+		max_fixups = max_fixups ? max_fixups * 2 : 1024;
+		if ((fixups = realloc(fixups, max_fixups *
+		    sizeof(struct fixup))) == NULL)
+			err(1, "realloc");
+	}
+	fixups[nr_fixups].off = elf_offset(AS_TEXT) + e.n;
+	fixups[nr_fixups++].label = label;
+	enc_int(&e, 0, 4);
+	enc_emit(&e);
+}
+
+/* Operand-less instructions: leaveq, retq, cqto and vzeroupper. */
+void
+as_op(enum as_op op)
+{
+	struct enc e;
+
+	if (recording) {
+		record(MI_OP, op, 0);
+		return;
+	}
+	if (!as_object) {
+		out_str(as_names[op]);
+		out_str(op == AS_CQTO || op == AS_VZEROUPPER ? "\n" : "q\n");
+		return;
+	}
+	e.n = 0;
+	if (op == AS_LEAVE)
+		enc_byte(&e, 0xc9);
+	else if (op == AS_RET)
+		enc_byte(&e, 0xc3);
+	else if (op == AS_CQTO) {
+		enc_byte(&e, 0x48);
+		enc_byte(&e, 0x99);
+	} else if (op == AS_VZEROUPPER) {
+		enc_byte(&e, 0xc5);
+		enc_byte(&e, 0xf8);
+		enc_byte(&e, 0x77);
+	} else
+		errx(1, "Bad operation %s", as_names[op]);
+	enc_emit(&e);
+}
+
+/* movdqu disp(base,index,scale), dst */
+void
+as_vload(int size, int base, int index, int scale, int disp, int dst)
+{
+	struct minst *mi;
+	struct enc e;
+
+	if (recording) {
+		mi = record(MI_VLOAD, AS_MOVDQU, size);
+		mi->base = base;
+		mi->index = index;
+		mi->scale = scale;
+		mi->disp = disp;
+		mi->dst = dst;
+		return;
+	}
+	if (!as_object) {
+		out_str(size == 32 ? "vmovdqu " : "movdqu ");
+		text_mem(base, index, scale, disp);
+		out_str(", ");
+		text_vreg(dst, size);
+		out_char('\n');
+		return;
+	}
+	swap_rsp(&base, &index, scale);
+	e.n = 0;
+	enc_vec(&e, size, 2, 1, 0, dst, 0, index == -1 ? 0 : index, base);
+	enc_byte(&e, 0x6f);
+	enc_modrm_mem(&e, dst, base, index, scale, disp);
+	enc_emit(&e);
+}
+
+/* movdqu src, disp(base,index,scale) */
+void
+as_vstore(int size, int src, int base, int index, int scale, int disp)
+{
+	struct minst *mi;
+	struct enc e;
+
+	if (recording) {
+		mi = record(MI_VSTORE, AS_MOVDQU, size);
+		mi->src = src;
+		mi->base = base;
+		mi->index = index;
+		mi->scale = scale;
+		mi->disp = disp;
+		return;
+	}
+	if (!as_object) {
+		out_str(size == 32 ? "vmovdqu " : "movdqu ");
+		text_vreg(src, size);
+		out_str(", ");
+		text_mem(base, index, scale, disp);
+		out_char('\n');
+		return;
+	}
+	swap_rsp(&base, &index, scale);
+	e.n = 0;
+	enc_vec(&e, size, 2, 1, 0, src, 0, index == -1 ? 0 : index, base);
+	enc_byte(&e, 0x7f);
+	enc_modrm_mem(&e, src, base, index, scale, disp);
+	enc_emit(&e);
+}
+
+/* Whether op combines two vectors, and so has a second source in VEX. */
+static int
+two_sources(enum as_op op)
+{
+	return (op >= AS_PADDB && op <= AS_PUNPCKLQDQ);
+}
+
+/*
+ * op src, dst, which for two sources is dst = src2 op src; SSE needs src2
+ * to be dst. movq is from the general register src, the broadcasts are to
+ * a ymm register of size 32 from an xmm one.
+ */
+void
+as_vrr(enum as_op op, int size, int src, int src2, int dst)
+{
+	struct minst *mi;
+	struct enc e;
+	int map;
+
+	if (recording) {
+		mi = record(MI_VRR, op, size);
+		mi->src = src;
+		mi->src2 = src2;
+		mi->dst = dst;
+		return;
+	}
+	if (!two_sources(op))
+		src2 = 0;
+	else if (size != 32 && src2 != dst)
+		errx(1, "Bad vector operation %s", as_names[op]);
+	if (!as_object) {
+		if (size == 32)
+			out_char('v');
+		out_str(as_names[op]);
+		out_str(op == AS_PSHUFD ? " $0, " : " ");
+		if (op == AS_MOVQ)
+			text_reg(src, 8);
+		else
+			text_vreg(src, op >= AS_PBROADCASTB ? 16 : size);
+		out_str(", ");
+		if (size == 32 && two_sources(op)) {
+			text_vreg(src2, size);
+			out_str(", ");
+		}
+		text_vreg(dst, size);
+		out_char('\n');
+		return;
+	}
+	if (!vec_opcodes[op])
+		errx(1, "Bad vector operation %s", as_names[op]);
+	map = op >= AS_PBROADCASTB ? 2 : 1;
+	e.n = 0;
+	enc_vec(&e, size, 1, map, op == AS_MOVQ, dst, src2, 0, src);
+	enc_byte(&e, vec_opcodes[op]);
+	enc_modrm_reg(&e, dst, src);
+	if (op == AS_PSHUFD)
+		enc_byte(&e, 0);
+	enc_emit(&e);
+}